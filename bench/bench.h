@@ -0,0 +1,136 @@
+// Minimal benchmark harness shared by the bench/ programs.
+//
+// Each result is printed as a console row, or collected into a JSON document
+// shaped like Google Benchmark's --benchmark_format=json output so existing
+// comparison tooling can diff runs.
+//
+// Common flags: --json, --filter=SUBSTRING, --min-time=SECONDS. Anything
+// else is left in positional() for the program itself.
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+struct BenchResult {
+    std::string name;
+    long long iterations;
+    double ns_per_op;
+    double bytes_per_op;
+};
+
+// Keeps the compiler from discarding a value computed only for timing.
+template <typename T>
+inline void keep_value(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class BenchRunner {
+public:
+    BenchRunner(int argc, char** argv) : program_(argv[0]) {
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], "--json") == 0) {
+                json_ = true;
+            } else if (std::strncmp(argv[i], "--filter=", 9) == 0) {
+                filter_ = argv[i] + 9;
+            } else if (std::strncmp(argv[i], "--min-time=", 11) == 0) {
+                min_time_ = std::atof(argv[i] + 11);
+            } else {
+                positional_.push_back(argv[i]);
+            }
+        }
+        if (!json_) {
+            std::printf("%-36s %12s %14s %12s\n", "benchmark", "iterations", "ns_per_op", "MB_per_s");
+        }
+    }
+    
+    const std::vector<std::string>& positional() const { return positional_; }
+    
+    bool enabled(const std::string& name) const {
+        return filter_.empty() || name.find(filter_) != std::string::npos;
+    }
+    
+    // Runs body() in doubling batches until a batch takes min_time.
+    template <typename F>
+    void run(const std::string& name, F&& body, double bytes_per_op = 0) {
+        if (!enabled(name)) return;
+        
+        long long batch = 1;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            for (long long i = 0; i < batch; i++) {
+                body();
+            }
+            double ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+            
+            if (ns >= min_time_ * 1e9 || batch >= (1LL << 30)) {
+                report(name, batch, ns, bytes_per_op);
+                return;
+            }
+            batch *= ns > 0 && ns * 10 < min_time_ * 1e9 ? 10 : 2;
+        }
+    }
+    
+    // Records a measurement taken by the caller.
+    void report(const std::string& name, long long iterations, double total_ns,
+                double bytes_per_op = 0) {
+        BenchResult result{name, iterations, total_ns / iterations, bytes_per_op};
+        if (json_) {
+            results_.push_back(result);
+            return;
+        }
+        
+        std::printf("%-36s %12lld %14.1f", name.c_str(), iterations, result.ns_per_op);
+        if (bytes_per_op > 0) {
+            std::printf(" %12.1f", bytes_per_op / result.ns_per_op * 1e3);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+    
+    int finish() {
+        if (!json_) return 0;
+        
+        char host[256] = "unknown";
+        gethostname(host, sizeof(host));
+        char date[64];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", std::localtime(&now));
+        
+        std::printf("{\n  \"context\": {\n");
+        std::printf("    \"date\": \"%s\",\n", date);
+        std::printf("    \"host_name\": \"%s\",\n", host);
+        std::printf("    \"executable\": \"%s\",\n", program_.c_str());
+        std::printf("    \"num_cpus\": %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+        std::printf("  },\n  \"benchmarks\": [");
+        for (size_t i = 0; i < results_.size(); i++) {
+            const BenchResult& r = results_[i];
+            std::printf("%s\n    {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %lld, "
+                        "\"real_time\": %.3f, \"time_unit\": \"ns\"",
+                        i ? "," : "", r.name.c_str(), r.iterations, r.ns_per_op);
+            if (r.bytes_per_op > 0) {
+                std::printf(", \"bytes_per_second\": %.0f", r.bytes_per_op / r.ns_per_op * 1e9);
+            }
+            std::printf("}");
+        }
+        std::printf("\n  ]\n}\n");
+        return 0;
+    }
+
+private:
+    std::string program_;
+    std::string filter_;
+    double min_time_ = 0.2;
+    bool json_ = false;
+    std::vector<std::string> positional_;
+    std::vector<BenchResult> results_;
+};
+
+#endif // BENCH_H
@@ -0,0 +1,120 @@
+// Throughput of the cat builtin (kernel-side copies through copy_fd) versus
+// spawning coreutils cat, for file -> file and file -> pipe.
+//
+// Usage: cat_bench [--json] [--filter=S] [size_mb] [scratch_dir]
+#include "bench.h"
+#include "builtins.h"
+#include "launch.h"
+#include "output.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void make_source(const std::string& path, size_t size_mb) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::vector<char> block(1 << 20);
+    for (size_t i = 0; i < block.size(); i++) {
+        block[i] = 'a' + i % 26;
+    }
+    for (size_t i = 0; i < size_mb; i++) {
+        if (write(fd, block.data(), block.size()) != static_cast<ssize_t>(block.size())) {
+            std::perror("write");
+            std::exit(1);
+        }
+    }
+    fsync(fd);
+    close(fd);
+}
+
+static void run_builtin_cat(const std::string& source, int out_fd) {
+    std::vector<std::string> args = {source};
+    OutputSink out(out_fd);
+    OutputSink err(STDERR_FILENO);
+    cat_command(args, STDIN_FILENO, out, err);
+    out.flush();
+}
+
+static void run_external_cat(const std::string& source, int out_fd) {
+    LaunchSpec spec;
+    spec.path = "/bin/cat";
+    spec.argv = {const_cast<char*>("cat"), const_cast<char*>(source.c_str()), nullptr};
+    spec.output_fd = out_fd;
+    spec.foreground = false;
+    int err = 0;
+    pid_t pid = launch_process(spec, err);
+    if (pid < 0) {
+        std::fprintf(stderr, "launch failed: %s\n", std::strerror(err));
+        std::exit(1);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+static double to_file_ns(void (*cat)(const std::string&, int), const std::string& source,
+                              const std::string& target) {
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    auto start = std::chrono::steady_clock::now();
+    cat(source, fd);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+    unlink(target.c_str());
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+static double to_pipe_ns(void (*cat)(const std::string&, int), const std::string& source) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        std::perror("pipe2");
+        std::exit(1);
+    }
+    
+    std::thread drain([fd = fds[0]] {
+        std::vector<char> buffer(1 << 17);
+        while (read(fd, buffer.data(), buffer.size()) > 0) {
+        }
+        close(fd);
+    });
+    
+    auto start = std::chrono::steady_clock::now();
+    cat(source, fds[1]);
+    close(fds[1]);
+    drain.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    size_t size_mb = args.size() > 0 ? std::strtoul(args[0].c_str(), nullptr, 10) : 1024;
+    std::string dir = args.size() > 1 ? args[1] : "/tmp";
+    double bytes = static_cast<double>(size_mb << 20);
+    std::string source = dir + "/cat_bench.src";
+    std::string target = dir + "/cat_bench.dst";
+    
+    make_source(source, size_mb);
+    
+    if (runner.enabled("cat/file_to_file/external")) {
+        runner.report("cat/file_to_file/external", 1,
+                      to_file_ns(run_external_cat, source, target), bytes);
+    }
+    if (runner.enabled("cat/file_to_file/builtin")) {
+        runner.report("cat/file_to_file/builtin", 1,
+                      to_file_ns(run_builtin_cat, source, target), bytes);
+    }
+    if (runner.enabled("cat/file_to_pipe/external")) {
+        runner.report("cat/file_to_pipe/external", 1, to_pipe_ns(run_external_cat, source), bytes);
+    }
+    if (runner.enabled("cat/file_to_pipe/builtin")) {
+        runner.report("cat/file_to_pipe/builtin", 1, to_pipe_ns(run_builtin_cat, source), bytes);
+    }
+    
+    unlink(source.c_str());
+    return runner.finish();
+}
@@ -0,0 +1,62 @@
+// End-to-end execution costs through process_command(): a trivial external
+// command, N-stage pipelines, and $(...) capture via execute_for_output()
+// for builtin-only and external commands; the exec environment cached
+// versus rebuilt after every change.
+//
+// Usage: exec_bench [--json] [--filter=S] [--min-time=SECONDS]
+#include "bench.h"
+#include "builtins.h"
+#include "executor.h"
+#include "parser.h"
+#include "shell.h"
+#include "variables.h"
+#include <string>
+
+static std::string pipeline_of(const char* stage, int stages) {
+    std::string line = stage;
+    for (int i = 1; i < stages; i++) {
+        line += " | ";
+        line += stage;
+    }
+    return line;
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    init_shell(false);
+    init_builtins();
+    
+    runner.run("exec/true", [] {
+        process_command("true");
+    });
+    for (int stages : {2, 4, 8}) {
+        std::string line = pipeline_of("true", stages);
+        runner.run("exec/pipeline_" + std::to_string(stages), [&] {
+            process_command(line);
+        });
+    }
+    runner.run("exec/builtin_pipeline_4", [] {
+        process_command("pwd | cat | cat | cat > /dev/null");
+    });
+    runner.run("exec/true_with_assignment", [] {
+        process_command("BENCH_VAR=1 true");
+    });
+    
+    export_variable("BENCH_COUNTER");
+    runner.run("env/cached", [] {
+        keep_value(exec_environment());
+    });
+    runner.run("env/rebuilt", [] {
+        set_variable("BENCH_COUNTER", "1");
+        keep_value(exec_environment());
+    });
+    
+    runner.run("subst/builtin_echo", [] {
+        keep_value(execute_for_output("echo hello"));
+    });
+    runner.run("subst/external_echo", [] {
+        keep_value(execute_for_output("/bin/echo hello"));
+    });
+    
+    return runner.finish();
+}
@@ -0,0 +1,95 @@
+// History log and search over a synthetic log: opening (index build), the
+// first query (search index build), indexed and short-pattern queries
+// against a linear scan of every entry, and per-command appends.
+//
+// Usage: history_bench [--json] [--filter=S] [--min-time=SECONDS] [entries] [scratch_dir]
+#include "bench.h"
+#include "history_log.h"
+#include "history_search.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+
+static const char* const verbs[] = {
+    "git status", "git commit -m", "git checkout", "ls -la", "cd", "make", "vim", "grep -rn",
+    "cat", "ssh", "docker run", "kubectl get pods -n", "python3", "cargo build --release", "tail -f"
+};
+
+static void make_log(const std::string& path, size_t entries) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    std::mt19937 rng(42);
+    std::geometric_distribution<int> popular(0.002);
+    for (size_t i = 0; i < entries; i++) {
+        const char* verb = verbs[rng() % (sizeof(verbs) / sizeof(verbs[0]))];
+        std::fprintf(file, "%s target_%d\n", verb, popular(rng));
+    }
+    std::fclose(file);
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t linear_scan(std::string_view pattern) {
+    size_t hits = 0;
+    for (size_t i = 0; i < history_log_size(); i++) {
+        if (history_log_entry(i).find(pattern) != std::string_view::npos) hits++;
+    }
+    return hits;
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    size_t entries = args.size() > 0 ? std::strtoul(args[0].c_str(), nullptr, 10) : 1000000;
+    std::string dir = args.size() > 1 ? args[1] : "/tmp";
+    std::string path = dir + "/history_bench.log";
+    std::string index_path = path + ".idx";
+    
+    make_log(path, entries);
+    unlink(index_path.c_str());
+    
+    auto start = std::chrono::steady_clock::now();
+    open_history_log(path);
+    double open_cold = elapsed_ns(start);
+    close_history_log();
+    
+    start = std::chrono::steady_clock::now();
+    open_history_log(path);
+    double open_warm = elapsed_ns(start);
+    history_log_load_tail(1000);
+    
+    start = std::chrono::steady_clock::now();
+    keep_value(search_history("target_1", 10));
+    double first_query = elapsed_ns(start);
+    
+    if (runner.enabled("history/open_cold")) runner.report("history/open_cold", 1, open_cold);
+    if (runner.enabled("history/open_warm")) runner.report("history/open_warm", 1, open_warm);
+    if (runner.enabled("history/first_search")) runner.report("history/first_search", 1, first_query);
+    
+    runner.run("history/search_common", [] {
+        keep_value(search_history("git commit", 10));
+    });
+    runner.run("history/search_rare", [] {
+        keep_value(search_history("get pods -n target_317", 10));
+    });
+    runner.run("history/search_short", [] {
+        keep_value(search_history("vi", 10));
+    });
+    runner.run("history/linear_scan", [] {
+        keep_value(linear_scan("get pods -n target_317"));
+    });
+    runner.run("history/append", [] {
+        history_log_append("echo appended");
+    });
+    
+    close_history_log();
+    unlink(path.c_str());
+    unlink(index_path.c_str());
+    return runner.finish();
+}
@@ -0,0 +1,172 @@
+/*
+ * Example loadable builtin: prints the value of the first member named KEY
+ * in a JSON document. Strings are unescaped, objects and arrays printed as
+ * they appear.
+ *
+ *   cc -shared -fPIC -Isrc -o jsonfield.so bench/jsonfield_builtin.c
+ *   enable -f ./jsonfield.so jsonfield
+ *   jsonfield name < package.json
+ *
+ * Built with -DSTANDALONE it is an ordinary program doing the same, which
+ * loadable_bench uses to measure what fork and exec cost per call.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "shell_builtin.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char* read_all(int fd, size_t* length) {
+    size_t capacity = 4096, used = 0;
+    char* data = malloc(capacity);
+    for (;;) {
+        if (used == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+        ssize_t n = read(fd, data + used, capacity - used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        used += n;
+    }
+    *length = used;
+    return data;
+}
+
+static const char* skip_space(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+static const char* string_end(const char* p, const char* end) {
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p == '\\') p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+/* End of the value starting at p. */
+static const char* value_end(const char* p, const char* end) {
+    if (*p == '"') return string_end(p, end);
+    if (*p == '{' || *p == '[') {
+        int depth = 0;
+        while (p < end) {
+            if (*p == '"') {
+                p = string_end(p, end);
+                continue;
+            }
+            if (*p == '{' || *p == '[') depth++;
+            if (*p == '}' || *p == ']') depth--;
+            p++;
+            if (depth == 0) break;
+        }
+        return p;
+    }
+    while (p < end && !strchr(",}] \t\r\n", *p)) p++;
+    return p;
+}
+
+static void print_string(const char* p, const char* end, const struct shell_builtin_io* io) {
+    char buffer[4096];
+    size_t used = 0;
+    for (p++; p < end && *p != '"'; p++) {
+        char c = *p;
+        if (c == '\\' && p + 1 < end) {
+            c = *++p;
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+            else if (c == 'r') c = '\r';
+        }
+        buffer[used++] = c;
+        if (used == sizeof(buffer)) {
+            io->write_out(io->context, buffer, used);
+            used = 0;
+        }
+    }
+    io->write_out(io->context, buffer, used);
+}
+
+static int jsonfield_run(int argc, char* const* argv, const struct shell_builtin_io* io) {
+    if (argc < 2 || argc > 3) {
+        static const char usage[] = "usage: jsonfield key [file]\n";
+        io->write_err(io->context, usage, sizeof(usage) - 1);
+        return 2;
+    }
+
+    int fd = io->in_fd;
+    if (argc == 3 && (fd = open(argv[2], O_RDONLY | O_CLOEXEC)) == -1) {
+        const char* message = strerror(errno);
+        io->write_err(io->context, "jsonfield: ", 11);
+        io->write_err(io->context, message, strlen(message));
+        io->write_err(io->context, "\n", 1);
+        return 2;
+    }
+    size_t length;
+    char* data = read_all(fd, &length);
+    if (fd != io->in_fd) close(fd);
+
+    const char* key = argv[1];
+    size_t key_length = strlen(key);
+    const char* end = data + length;
+    int status = 1;
+    for (const char* p = data; p < end; p++) {
+        if (*p != '"') continue;
+        const char* after = string_end(p, end);
+        const char* colon = skip_space(after, end);
+        if (colon < end && *colon == ':' && (size_t)(after - p) == key_length + 2 &&
+            memcmp(p + 1, key, key_length) == 0) {
+            const char* value = skip_space(colon + 1, end);
+            if (value < end && *value == '"') {
+                print_string(value, end, io);
+            } else if (value < end) {
+                io->write_out(io->context, value, value_end(value, end) - value);
+            }
+            io->write_out(io->context, "\n", 1);
+            status = 0;
+            break;
+        }
+        p = after - 1;
+    }
+    free(data);
+    return status;
+}
+
+const struct shell_builtin jsonfield_builtin = {
+    SHELL_BUILTIN_ABI_VERSION,
+    SHELL_BUILTIN_PURE,
+    "jsonfield key [file]",
+    "Print the value of a JSON member",
+    jsonfield_run,
+    NULL,
+    NULL
+};
+
+#ifdef STANDALONE
+static int write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+static int write_stdout(void* context, const char* data, size_t length) {
+    (void)context;
+    return write_all(STDOUT_FILENO, data, length);
+}
+
+static int write_stderr(void* context, const char* data, size_t length) {
+    (void)context;
+    return write_all(STDERR_FILENO, data, length);
+}
+
+int main(int argc, char** argv) {
+    struct shell_builtin_io io = {SHELL_BUILTIN_ABI_VERSION, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO,
+                                  NULL, write_stdout, write_stderr, NULL, NULL};
+    return jsonfield_run(argc, argv, &io);
+}
+#endif
@@ -0,0 +1,70 @@
+// Cost of a helper command as a builtin loaded with `enable -f` versus the
+// same code run as an external program (bench/jsonfield_builtin.c built
+// both ways next to this binary), plus the load/unload cycle itself.
+//
+// Usage: loadable_bench [--json] [--filter=S] [--min-time=SECONDS]
+#include "bench.h"
+#include "builtins.h"
+#include "executor.h"
+#include "loadable.h"
+#include "parser.h"
+#include "shell.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    init_shell(false);
+    init_builtins();
+    
+    std::string dir = argv[0];
+    dir = dir.find('/') == std::string::npos ? "." : dir.substr(0, dir.rfind('/'));
+    std::string library = dir + "/jsonfield.so";
+    std::string program = dir + "/jsonfield";
+    std::string document = "/tmp/loadable_bench.json";
+    std::ofstream(document) << "{\"name\": \"shell\", \"version\": \"1.4.2\", \"deps\": [\"readline\"]}\n";
+    
+    std::string error;
+    runner.run("enable/load_unload", [&] {
+        if (!load_builtin(library, "jsonfield", error) || !unload_builtin("jsonfield", error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            std::exit(1);
+        }
+    });
+    if (!load_builtin(library, "jsonfield", error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    
+    std::string builtin_line = "jsonfield version " + document + " > /dev/null";
+    std::string external_line = program + " version " + document + " > /dev/null";
+    runner.run("call/builtin", [&] {
+        process_command(builtin_line);
+    });
+    runner.run("call/external", [&] {
+        process_command(external_line);
+    });
+    
+    std::string builtin_subst = "jsonfield version " + document;
+    std::string external_subst = program + " version " + document;
+    runner.run("subst/builtin", [&] {
+        keep_value(execute_for_output(builtin_subst));
+    });
+    runner.run("subst/external", [&] {
+        keep_value(execute_for_output(external_subst));
+    });
+    
+    std::string builtin_pipeline = "cat " + document + " | jsonfield version | cat > /dev/null";
+    std::string external_pipeline = "cat " + document + " | " + program + " version | cat > /dev/null";
+    runner.run("pipeline/builtin", [&] {
+        process_command(builtin_pipeline);
+    });
+    runner.run("pipeline/external", [&] {
+        process_command(external_pipeline);
+    });
+    
+    std::remove(document.c_str());
+    return runner.finish();
+}
@@ -0,0 +1,99 @@
+// Loop-heavy scripts run by the bytecode VM, against the same scripts under
+// bash and dash (when installed), in ns per loop iteration. The other shells
+// are timed with `sh -c`, so their numbers include one process startup;
+// compile/ is the cost of parsing a script and compiling it to bytecode.
+//
+// Usage: loop_bench [--json] [--filter=S] [--min-time=SECONDS] [iterations]
+#include "bench.h"
+#include "builtins.h"
+#include "bytecode.h"
+#include "executor.h"
+#include "parser.h"
+#include "shell.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+struct LoopScript {
+    const char* name;
+    std::string text;
+};
+
+static std::string replace_all(std::string text, const std::string& from, const std::string& to) {
+    for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size())) {
+        text.replace(pos, from.size(), to);
+    }
+    return text;
+}
+
+// Runs `script` under another shell; returns false if it is not installed.
+static bool run_other_shell(const std::string& path, const std::string& script) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl(path.c_str(), path.c_str(), "-c", script.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+template <typename F>
+static double time_ns(F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    long iterations = args.size() > 0 ? std::atol(args[0].c_str()) : 100000;
+    init_shell(false);
+    init_builtins();
+    
+    std::string n = std::to_string(iterations);
+    std::string inner = std::to_string(iterations / 100);
+    std::vector<LoopScript> scripts = {
+        {"while_counter", "i=0; while [ $i -lt N ]; do i=$((i + 1)); done"},
+        {"for_builtin", "for w in $(seq N); do :; done"},
+        {"for_case", "n=0; for w in $(seq N); do case $w in *0) n=$((n + 1)) ;; *[13579]) : ;; *) ;; esac; done"},
+        {"and_or", "for w in $(seq N); do [ $w -gt 5 ] && x=$w || x=0; done"},
+        {"nested_if", "for a in $(seq 100); do for b in $(seq M); do if [ $b = 7 ]; then continue; elif [ $b = 9 ]; then x=1; fi; done; done"},
+    };
+    
+    std::vector<std::pair<const char*, std::string>> others;
+    for (const char* shell : {"bash", "dash"}) {
+        std::string path = find_executable_in_path(shell);
+        if (!path.empty()) others.emplace_back(shell, path);
+    }
+    
+    for (LoopScript& script : scripts) {
+        script.text = replace_all(replace_all(script.text, "N", n), "M", inner);
+        std::string name = std::string("loop/") + script.name;
+        
+        runner.run("compile/" + std::string(script.name), [&] {
+            ParseTree tree = parse_to_ast(script.text);
+            keep_value(compile_program(tree.root).code.size());
+        });
+        
+        if (runner.enabled(name + "/shell")) {
+            runner.report(name + "/shell", iterations, time_ns([&] { process_command(script.text); }));
+        }
+        for (const auto& other : others) {
+            std::string other_name = name + "/" + other.first;
+            if (!runner.enabled(other_name)) continue;
+            bool ok = true;
+            double ns = time_ns([&] { ok = run_other_shell(other.second, script.text); });
+            if (ok) runner.report(other_name, iterations, ns);
+        }
+    }
+    
+    return runner.finish();
+}
@@ -0,0 +1,55 @@
+// Parse throughput of parse_to_ast() on representative command lines,
+// including multi-kilobyte pasted argument lists, and of expanding a
+// redirection-heavy command (what parse_redirection() used to do).
+//
+// Usage: parse_bench [--json] [--filter=S] [--min-time=SECONDS]
+#include "bench.h"
+#include "parser.h"
+#include <string>
+#include <vector>
+
+struct ParseCase {
+    const char* name;
+    std::string line;
+};
+
+static std::string long_argument_list(size_t bytes, bool quoted) {
+    std::string line = "printf '%s\\n'";
+    for (int i = 0; line.size() < bytes; i++) {
+        std::string arg = "/usr/share/doc/package-" + std::to_string(i) + "/changelog.gz";
+        line += quoted ? " \"" + arg + "\"" : " " + arg;
+    }
+    return line;
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    
+    std::vector<ParseCase> cases = {
+        {"simple", "ls -la /tmp"},
+        {"pipeline", "cat access.log | grep 'GET /api' | sort | uniq -c > counts.txt 2>> errors.log"},
+        {"quoted", "echo \"hello   world\" 'single quoted' escaped\\ space \"tab\\there\""},
+        {"args_4k", long_argument_list(4096, false)},
+        {"args_16k", long_argument_list(16384, false)},
+        {"quoted_16k", long_argument_list(16384, true)},
+    };
+    
+    for (const auto& c : cases) {
+        runner.run(std::string("parse/") + c.name, [&] {
+            ParseTree tree = parse_to_ast(c.line);
+            keep_value(tree.root);
+        }, c.line.size());
+    }
+    
+    std::string redirect_line = "sort -u < input.txt > \"out file.txt\" 2>> errors.log";
+    ParseTree tree = parse_to_ast(redirect_line);
+    std::string command;
+    std::vector<std::string> args;
+    runner.run("parse/redirection_expand", [&] {
+        RedirectionConfig redir;
+        expand_command(tree.root, command, args, redir);
+        keep_value(redir);
+    });
+    
+    return runner.finish();
+}
@@ -0,0 +1,93 @@
+// PATH lookups and completion against a synthetic long PATH: uncached and
+// hashed command lookup, full executable listing, the completion index and
+// readline's command_generator().
+//
+// Usage: path_bench [--json] [--filter=S] [--min-time=SECONDS] [dirs] [files_per_dir]
+#include "bench.h"
+#include "command_hash.h"
+#include "completion.h"
+#include "path_index.h"
+#include "builtins.h"
+#include "utils.h"
+#include "variables.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <string>
+
+static std::string make_path_tree(const std::string& root, int dirs, int files_per_dir) {
+    mkdir(root.c_str(), 0755);
+    std::string path;
+    for (int d = 0; d < dirs; d++) {
+        std::string dir = root + "/bin" + std::to_string(d);
+        mkdir(dir.c_str(), 0755);
+        for (int f = 0; f < files_per_dir; f++) {
+            std::string file = dir + "/tool" + std::to_string(d) + "_" + std::to_string(f);
+            int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0755);
+            if (fd != -1) close(fd);
+        }
+        if (!path.empty()) path += ':';
+        path += dir;
+    }
+    return path;
+}
+
+static void remove_path_tree(const std::string& root, int dirs, int files_per_dir) {
+    for (int d = 0; d < dirs; d++) {
+        std::string dir = root + "/bin" + std::to_string(d);
+        for (int f = 0; f < files_per_dir; f++) {
+            unlink((dir + "/tool" + std::to_string(d) + "_" + std::to_string(f)).c_str());
+        }
+        rmdir(dir.c_str());
+    }
+    rmdir(root.c_str());
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    int dirs = args.size() > 0 ? std::atoi(args[0].c_str()) : 64;
+    int files_per_dir = args.size() > 1 ? std::atoi(args[1].c_str()) : 200;
+    
+    char root_template[] = "/tmp/path_bench.XXXXXX";
+    std::string root = mkdtemp(root_template);
+    set_variable("PATH", make_path_tree(root, dirs, files_per_dir));
+    init_builtins();
+    
+    std::string last_dir_tool = "tool" + std::to_string(dirs - 1) + "_0";
+    
+    runner.run("path/find_executable_last_dir", [&] {
+        keep_value(find_executable_in_path(last_dir_tool));
+    });
+    runner.run("path/find_executable_missing", [&] {
+        keep_value(find_executable_in_path("no-such-command"));
+    });
+    runner.run("path/hash_lookup", [&] {
+        keep_value(hash_lookup(last_dir_tool));
+    });
+    runner.run("path/get_all_executables", [&] {
+        keep_value(get_all_executables());
+    });
+    runner.run("path/index_refresh_unchanged", [&] {
+        refresh_executable_index();
+    });
+    
+    std::vector<std::string> matches;
+    runner.run("path/index_prefix_search", [&] {
+        matches.clear();
+        find_executables_with_prefix("tool3", matches);
+        keep_value(matches);
+    });
+    
+    std::string prefix = "tool" + std::to_string(dirs / 2) + "_1";
+    runner.run("path/command_generator", [&] {
+        int state = 0;
+        while (char* match = command_generator(prefix.c_str(), state++)) {
+            free(match);
+        }
+    });
+    
+    remove_path_tree(root, dirs, files_per_dir);
+    return runner.finish();
+}
@@ -0,0 +1,166 @@
+// Throughput of the wc and grep builtins against coreutils wc and GNU grep
+// on a generated text file, plus the scalar/SSE2/AVX2 kernels on an
+// in-memory copy of the same data.
+//
+// Usage: scan_bench [--json] [--filter=S] [size_mb] [scratch_dir]
+#include "bench.h"
+#include "builtins.h"
+#include "launch.h"
+#include "output.h"
+#include "scan.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char* const NEEDLE = "checksum mismatch";
+
+// Log-like lines; roughly one in a thousand contains the needle.
+static std::string make_text(size_t size) {
+    static const char* const words[] = {"request", "served", "in", "ms", "user", "session", "cache",
+                                        "hit", "miss", "GET", "/api/v1/items", "200", "404", "upstream"};
+    std::mt19937 rng(42);
+    std::string text;
+    text.reserve(size + 256);
+    while (text.size() < size) {
+        int count = 4 + rng() % 10;
+        for (int i = 0; i < count; i++) {
+            if (i) text += ' ';
+            text += words[rng() % (sizeof(words) / sizeof(words[0]))];
+        }
+        if (rng() % 1000 == 0) {
+            text += ' ';
+            text += NEEDLE;
+        }
+        text += '\n';
+    }
+    text.resize(size);
+    text.back() = '\n';
+    return text;
+}
+
+static void write_source(const std::string& path, const std::string& text, size_t size_mb) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (size_t i = 0; i < size_mb; i++) {
+        if (write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size())) {
+            std::perror("write");
+            std::exit(1);
+        }
+    }
+    fsync(fd);
+    close(fd);
+}
+
+static double run_builtin(builtin_func builtin, const std::vector<std::string>& args, const std::string& target) {
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    auto start = std::chrono::steady_clock::now();
+    {
+        OutputSink out(fd);
+        OutputSink err(STDERR_FILENO);
+        builtin(args, STDIN_FILENO, out, err);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+// Output goes to a regular file: GNU grep stops at the first match when
+// its output is /dev/null.
+static double run_external(const std::string& name, const std::vector<std::string>& args,
+                           const std::string& target) {
+    std::string path = find_executable_in_path(name);
+    if (path.empty()) return -1;
+    
+    std::vector<char*> argv = {const_cast<char*>(name.c_str())};
+    for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    
+    int fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    LaunchSpec spec;
+    spec.path = path;
+    spec.argv = argv;
+    spec.output_fd = fd;
+    spec.foreground = false;
+    
+    auto start = std::chrono::steady_clock::now();
+    int err = 0;
+    pid_t pid = launch_process(spec, err);
+    if (pid < 0) {
+        std::fprintf(stderr, "launch failed: %s\n", std::strerror(err));
+        std::exit(1);
+    }
+    waitpid(pid, nullptr, 0);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    size_t size_mb = args.size() > 0 ? std::strtoul(args[0].c_str(), nullptr, 10) : 1024;
+    std::string dir = args.size() > 1 ? args[1] : "/tmp";
+    double bytes = static_cast<double>(size_mb << 20);
+    std::string source = dir + "/scan_bench.src";
+    std::string target = dir + "/scan_bench.out";
+    
+    std::string text = make_text(1 << 20);
+    write_source(source, text, size_mb);
+    ScanKernel best = active_scan_kernel();
+    
+    // In-memory kernels over 1 MiB of the same text.
+    for (ScanKernel kernel : {ScanKernel::SCALAR, ScanKernel::SSE2, ScanKernel::AVX2}) {
+        if (!set_scan_kernel(kernel)) continue;
+        std::string suffix = scan_kernel_name(kernel);
+        runner.run("kernel/newlines/" + suffix, [&] {
+            keep_value(count_newlines(text.data(), text.size()));
+        }, text.size());
+        runner.run("kernel/words/" + suffix, [&] {
+            bool in_word = false;
+            keep_value(count_words(text.data(), text.size(), in_word));
+        }, text.size());
+        runner.run("kernel/find/" + suffix, [&] {
+            size_t found = 0;
+            const char* end = text.data() + text.size();
+            for (const char* p = text.data(); (p = find_fixed(p, end, NEEDLE)); p++) found++;
+            keep_value(found);
+        }, text.size());
+    }
+    set_scan_kernel(best);
+    
+    // Whole commands on the file; the first pass warms the page cache.
+    run_builtin(wc_command, {"-l", source}, target);
+    const struct {
+        const char* name;
+        const char* tool;
+        builtin_func builtin;
+        std::vector<std::string> args;
+    } commands[] = {
+        {"wc_l", "wc", wc_command, {"-l", source}},
+        {"wc", "wc", wc_command, {source}},
+        {"grep_c", "grep", grep_command, {"-cF", NEEDLE, source}},
+        {"grep", "grep", grep_command, {"-F", NEEDLE, source}},
+        {"grep_v", "grep", grep_command, {"-vF", NEEDLE, source}},
+    };
+    for (const auto& command : commands) {
+        std::string name = std::string("file/") + command.name;
+        if (runner.enabled(name + "/external")) {
+            double ns = run_external(command.tool, command.args, target);
+            if (ns >= 0) runner.report(name + "/external", 1, ns, bytes);
+        }
+        if (runner.enabled(name + "/builtin")) {
+            runner.report(name + "/builtin", 1, run_builtin(command.builtin, command.args, target), bytes);
+        }
+    }
+    
+    unlink(target.c_str());
+    unlink(source.c_str());
+    return runner.finish();
+}
@@ -0,0 +1,67 @@
+// Loading a sourced file: a full lex and parse of every line against
+// mapping the cached image from disk and fixing up its pointers.
+//
+// Usage: source_bench [--json] [--filter=S] [--min-time=SECONDS] [lines] [scratch_dir]
+#include "bench.h"
+#include "source_cache.h"
+#include "variables.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static void make_script(const std::string& path, int lines) {
+    FILE* file = std::fopen(path.c_str(), "w");
+    for (int i = 0; i < lines; i++) {
+        switch (i % 4) {
+            case 0:
+                std::fprintf(file, "export OPT_%d=\"value with spaces %d\"\n", i, i);
+                break;
+            case 1:
+                std::fprintf(file, "# comment line %d\n", i);
+                break;
+            case 2:
+                std::fprintf(file, "echo \"$HOME/bin_%d\" | grep -v 'x' > /dev/null 2>> /tmp/err_%d\n", i, i);
+                break;
+            default:
+                std::fprintf(file, "alias_%d=$(printf '%%s' \"$OPT_%d\")\n", i, i - 3);
+                break;
+        }
+    }
+    std::fclose(file);
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    int lines = args.size() > 0 ? std::atoi(args[0].c_str()) : 4000;
+    std::string dir = args.size() > 1 ? args[1] : "/tmp";
+    std::string script_path = dir + "/source_bench.sh";
+    std::string cache_dir = dir + "/source_bench.cache";
+    
+    make_script(script_path, lines);
+    
+    set_variable("SHELL_SOURCE_CACHE", "");
+    runner.run("source/parse", [&] {
+        CompiledScript script;
+        std::string error;
+        compile_script(script_path, script, error);
+        keep_value(script.commands.size());
+    });
+    
+    set_variable("SHELL_SOURCE_CACHE", cache_dir);
+    runner.run("source/cached", [&] {
+        CompiledScript script;
+        std::string error;
+        compile_script(script_path, script, error);
+        keep_value(script.commands.size());
+    });
+    
+    const SourceCacheStats& stats = source_cache_stats();
+    std::fprintf(stderr, "cache: %zu hits, %zu misses, %zu writes\n", stats.hits, stats.misses, stats.writes);
+    
+    unlink(script_path.c_str());
+    std::string command = "rm -rf '" + cache_dir + "'";
+    keep_value(std::system(command.c_str()));
+    return runner.finish();
+}
@@ -0,0 +1,64 @@
+// Launch latency of /bin/true through the posix_spawn backend versus the
+// fork+exec fallback, measured while the shell holds increasing amounts of
+// resident memory.
+//
+// Usage: spawn_bench [--json] [--filter=S] [iterations] [rss_mb...]
+#include "bench.h"
+#include "launch.h"
+#include <sys/wait.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static double total_launch_ns(pid_t (*launch)(const LaunchSpec&, int&), const LaunchSpec& spec,
+                              int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        int err = 0;
+        pid_t pid = launch(spec, err);
+        if (pid < 0) {
+            std::fprintf(stderr, "launch failed: %s\n", std::strerror(err));
+            std::exit(1);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    int iterations = args.size() > 0 ? std::atoi(args[0].c_str()) : 200;
+    std::vector<size_t> sizes_mb;
+    for (size_t i = 1; i < args.size(); i++) {
+        sizes_mb.push_back(std::strtoul(args[i].c_str(), nullptr, 10));
+    }
+    if (sizes_mb.empty()) {
+        sizes_mb = {0, 64, 256, 1024};
+    }
+    
+    LaunchSpec spec;
+    spec.path = "/bin/true";
+    spec.argv = {const_cast<char*>("true"), nullptr};
+    
+    std::vector<char> ballast;
+    for (size_t mb : sizes_mb) {
+        // Touch every page so the memory is resident and must be mapped by fork().
+        ballast.assign(mb << 20, 1);
+        
+        std::string suffix = "/rss_" + std::to_string(mb) + "MB";
+        if (runner.enabled("spawn/fork_exec" + suffix)) {
+            runner.report("spawn/fork_exec" + suffix, iterations,
+                          total_launch_ns(fork_exec_process, spec, iterations));
+        }
+        if (runner.enabled("spawn/posix_spawn" + suffix)) {
+            runner.report("spawn/posix_spawn" + suffix, iterations,
+                          total_launch_ns(spawn_process, spec, iterations));
+        }
+    }
+    
+    return runner.finish();
+}
@@ -0,0 +1,128 @@
+// Throughput of `producer | tee FILE... | consumer` with the tee builtin
+// (tee(2) + splice) versus coreutils tee, which reads every byte into a
+// buffer and writes it out once per output. The producer and consumer are
+// threads copying through a pipe, so both sides pay the same for them.
+//
+// Usage: tee_bench [--json] [--filter=S] [size_mb] [scratch_dir]
+#include "bench.h"
+#include "builtins.h"
+#include "launch.h"
+#include "output.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::string external_tee;
+
+static void run_builtin_tee(const std::vector<std::string>& args, int in_fd, int out_fd) {
+    OutputSink out(out_fd);
+    OutputSink err(STDERR_FILENO);
+    tee_command(args, in_fd, out, err);
+    out.flush();
+}
+
+static void run_external_tee(const std::vector<std::string>& args, int in_fd, int out_fd) {
+    LaunchSpec spec;
+    spec.path = external_tee;
+    spec.argv.push_back(const_cast<char*>("tee"));
+    for (const auto& arg : args) {
+        spec.argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    spec.argv.push_back(nullptr);
+    spec.input_fd = in_fd;
+    spec.output_fd = out_fd;
+    int err = 0;
+    pid_t pid = launch_process(spec, err);
+    if (pid < 0) {
+        std::fprintf(stderr, "launch failed: %s\n", std::strerror(err));
+        std::exit(1);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+static double tee_ns(void (*tee)(const std::vector<std::string>&, int, int),
+                     const std::vector<std::string>& args, size_t size_mb) {
+    int in[2];
+    int out[2];
+    if (pipe2(in, O_CLOEXEC) == -1 || pipe2(out, O_CLOEXEC) == -1) {
+        std::perror("pipe2");
+        std::exit(1);
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    std::thread producer([fd = in[1], size_mb] {
+        std::vector<char> block(1 << 20);
+        for (size_t i = 0; i < block.size(); i++) {
+            block[i] = 'a' + i % 26;
+        }
+        for (size_t i = 0; i < size_mb; i++) {
+            for (size_t written = 0; written < block.size();) {
+                ssize_t n = write(fd, block.data() + written, block.size() - written);
+                if (n <= 0) break;
+                written += n;
+            }
+        }
+        close(fd);
+    });
+    std::thread consumer([fd = out[0]] {
+        std::vector<char> buffer(1 << 17);
+        while (read(fd, buffer.data(), buffer.size()) > 0) {
+        }
+        close(fd);
+    });
+    
+    tee(args, in[0], out[1]);
+    close(in[0]);
+    close(out[1]);
+    producer.join();
+    consumer.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    
+    for (const auto& arg : args) {
+        if (arg[0] != '-') unlink(arg.c_str());
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count();
+}
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    const auto& args = runner.positional();
+    size_t size_mb = args.size() > 0 ? std::strtoul(args[0].c_str(), nullptr, 10) : 1024;
+    std::string dir = args.size() > 1 ? args[1] : "/tmp";
+    double bytes = static_cast<double>(size_mb << 20);
+    
+    external_tee = find_executable_in_path("tee");
+    if (external_tee.empty()) {
+        std::fprintf(stderr, "tee_bench: coreutils tee not found in PATH\n");
+        return 1;
+    }
+    
+    struct Case {
+        const char* name;
+        std::vector<std::string> args;
+    };
+    std::string first = dir + "/tee_bench.1";
+    std::string second = dir + "/tee_bench.2";
+    const Case cases[] = {
+        {"tee/pipe_only", {}},
+        {"tee/one_file", {first}},
+        {"tee/two_files", {first, second}},
+        {"tee/one_file_append", {"-a", first}},
+    };
+    
+    for (const Case& c : cases) {
+        std::string name = std::string(c.name) + "/external";
+        if (runner.enabled(name)) runner.report(name, 1, tee_ns(run_external_tee, c.args, size_mb), bytes);
+        name = std::string(c.name) + "/builtin";
+        if (runner.enabled(name)) runner.report(name, 1, tee_ns(run_builtin_tee, c.args, size_mb), bytes);
+    }
+    return runner.finish();
+}
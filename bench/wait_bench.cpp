@@ -0,0 +1,50 @@
+// Waiting on children: the timeout builtin against coreutils timeout (which
+// forks a helper process and waits for the command from there), how late a
+// deadline fires, and collecting the members of a pipeline with pidfds.
+//
+// Usage: wait_bench [--json] [--filter=S] [--min-time=SECONDS]
+#include "bench.h"
+#include "builtins.h"
+#include "executor.h"
+#include "shell.h"
+#include "utils.h"
+#include <cstdio>
+#include <string>
+
+int main(int argc, char** argv) {
+    BenchRunner runner(argc, argv);
+    init_shell(false);
+    init_builtins();
+    
+    std::string external = find_executable_in_path("timeout");
+    if (external.empty()) {
+        std::fprintf(stderr, "wait_bench: coreutils timeout not found in PATH\n");
+        return 1;
+    }
+    
+    runner.run("timeout/builtin", [&] {
+        process_command("timeout 5 true");
+    });
+    runner.run("timeout/external", [&] {
+        process_command(external + " 5 true");
+    });
+    
+    // A 10 ms limit on a command that would run for a second: the excess
+    // over 10 ms is the cost of noticing the deadline and killing.
+    runner.run("deadline_10ms/builtin", [&] {
+        process_command("timeout 0.01 sleep 1");
+    });
+    runner.run("deadline_10ms/external", [&] {
+        process_command(external + " 0.01 sleep 1");
+    });
+    
+    runner.run("pipeline/2_stages", [&] {
+        process_command("/bin/true | /bin/true");
+    });
+    runner.run("pipeline/8_stages", [&] {
+        process_command("/bin/true | /bin/true | /bin/true | /bin/true | "
+                        "/bin/true | /bin/true | /bin/true | /bin/true");
+    });
+    
+    return runner.finish();
+}
@@ -0,0 +1,285 @@
+#include "arithmetic.h"
+#include "parser.h"
+#include "shell.h"
+#include "variables.h"
+#include <iostream>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+enum class ArithOp : uint8_t {
+    ASSIGN, OR, AND, BIT_OR, BIT_XOR, BIT_AND, EQ, NE, LE, GE, LT, GT, SHL, SHR, ADD, SUB, MUL, DIV, MOD
+};
+
+struct OperatorInfo {
+    char text[3];
+    ArithOp op;
+    int level;                         // binding strength, loosest first
+};
+
+// Two-character operators come first so that `<=` is not read as `<`.
+static const OperatorInfo binary_operators[] = {
+    {"||", ArithOp::OR, 0}, {"&&", ArithOp::AND, 1}, {"==", ArithOp::EQ, 5}, {"!=", ArithOp::NE, 5},
+    {"<=", ArithOp::LE, 6}, {">=", ArithOp::GE, 6}, {"<<", ArithOp::SHL, 7}, {">>", ArithOp::SHR, 7},
+    {"|", ArithOp::BIT_OR, 2}, {"^", ArithOp::BIT_XOR, 3}, {"&", ArithOp::BIT_AND, 4},
+    {"<", ArithOp::LT, 6}, {">", ArithOp::GT, 6}, {"+", ArithOp::ADD, 8}, {"-", ArithOp::SUB, 8},
+    {"*", ArithOp::MUL, 9}, {"/", ArithOp::DIV, 9}, {"%", ArithOp::MOD, 9},
+};
+
+static bool is_comparison(ArithOp op) {
+    return op == ArithOp::EQ || op == ArithOp::NE || op == ArithOp::LE || op == ArithOp::GE;
+}
+
+// Precedence climbing over the binary operators; assignment and ?: are
+// handled above them. When `skip` is set (the unevaluated side of &&, ||
+// and ?:) the expression is only parsed: nothing is assigned and division
+// by zero is not an error.
+class ArithmeticParser {
+public:
+    explicit ArithmeticParser(std::string_view text) : text_(text), pos_(0) {}
+    
+    bool parse(long& value, std::string& error) {
+        value = assignment(false);
+        skip_spaces();
+        if (error_.empty() && pos_ < text_.size()) fail("syntax error in expression");
+        error = error_;
+        return error_.empty();
+    }
+
+private:
+    char at(size_t pos) const {
+        return pos < text_.size() ? text_[pos] : '\0';
+    }
+    
+    void fail(const char* message) {
+        if (error_.empty()) error_ = message;
+    }
+    
+    void skip_spaces() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) pos_++;
+    }
+    
+    bool accept(char c) {
+        skip_spaces();
+        if (at(pos_) != c) return false;
+        pos_++;
+        return true;
+    }
+    
+    static bool is_name_char(char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+    
+    long variable_value(const std::string& name) {
+        const char* value = lookup_variable(name);
+        if (!value || !*value) return 0;
+        
+        // Most values are plain integers; anything else is evaluated as an expression.
+        char* end = nullptr;
+        long number = std::strtol(value, &end, 10);
+        if (*end == '\0' && !std::isspace(static_cast<unsigned char>(*value))) return number;
+        
+        if (depth_ > 16) {
+            fail("expression recursion level exceeded");
+            return 0;
+        }
+        long result = 0;
+        std::string error;
+        depth_++;
+        bool ok = evaluate_arithmetic(value, result, error);
+        depth_--;
+        if (!ok) fail(error.c_str());
+        return result;
+    }
+    
+    // Length of the `=` or `op=` at the cursor, or 0; sets `op` to the
+    // operator combined with the assignment.
+    size_t assignment_operator(ArithOp& op) const {
+        char c = at(pos_);
+        char next = at(pos_ + 1);
+        if (c == '=' && next != '=') {
+            op = ArithOp::ASSIGN;
+            return 1;
+        }
+        if ((c == '<' || c == '>') && next == c && at(pos_ + 2) == '=') {
+            op = c == '<' ? ArithOp::SHL : ArithOp::SHR;
+            return 3;
+        }
+        if (next != '=' || c == '\0' || !std::strchr("+-*/%&^|", c)) return 0;
+        for (const OperatorInfo& info : binary_operators) {
+            if (info.text[0] == c && info.text[1] == '\0') {
+                op = info.op;
+                return 2;
+            }
+        }
+        return 0;
+    }
+    
+    long assignment(bool skip) {
+        skip_spaces();
+        size_t start = pos_;
+        size_t end = start;
+        while (end < text_.size() && is_name_char(text_[end])) end++;
+        
+        if (end > start && !std::isdigit(static_cast<unsigned char>(text_[start]))) {
+            pos_ = end;
+            skip_spaces();
+            ArithOp op;
+            size_t length = assignment_operator(op);
+            if (length > 0) {
+                std::string name(text_.substr(start, end - start));
+                pos_ += length;
+                long result = assignment(skip);
+                if (op != ArithOp::ASSIGN) {
+                    result = apply(op, skip ? 0 : variable_value(name), result, skip);
+                }
+                if (!skip && error_.empty() && !set_variable(name, std::to_string(result))) {
+                    fail("readonly variable");
+                }
+                return result;
+            }
+            pos_ = start;
+        }
+        return conditional(skip);
+    }
+    
+    long conditional(bool skip) {
+        long condition = binary(0, skip);
+        if (!accept('?')) return condition;
+        long if_true = assignment(skip || !condition);
+        if (!accept(':')) {
+            fail("`:' expected for conditional expression");
+            return 0;
+        }
+        long if_false = assignment(skip || condition);
+        return condition ? if_true : if_false;
+    }
+    
+    // The binary operator at the cursor, without consuming it.
+    const OperatorInfo* peek_operator() {
+        skip_spaces();
+        char c = at(pos_);
+        char next = at(pos_ + 1);
+        for (const OperatorInfo& info : binary_operators) {
+            if (info.text[0] != c || (info.text[1] && info.text[1] != next)) continue;
+            size_t length = info.text[1] ? 2 : 1;
+            if (at(pos_ + length) == '=' && !is_comparison(info.op)) return nullptr;  // op=
+            return &info;
+        }
+        return nullptr;
+    }
+    
+    long binary(int min_level, bool skip) {
+        long left = unary(skip);
+        while (error_.empty()) {
+            const OperatorInfo* info = peek_operator();
+            if (!info || info->level < min_level) break;
+            pos_ += info->text[1] ? 2 : 1;
+            
+            bool short_circuit = (info->op == ArithOp::AND && !left) || (info->op == ArithOp::OR && left);
+            long right = binary(info->level + 1, skip || short_circuit);
+            left = apply(info->op, left, right, skip || short_circuit);
+        }
+        return left;
+    }
+    
+    long apply(ArithOp op, long left, long right, bool skip) {
+        unsigned long a = static_cast<unsigned long>(left);
+        unsigned long b = static_cast<unsigned long>(right);
+        switch (op) {
+            case ArithOp::ASSIGN: return right;
+            case ArithOp::OR: return left || right;
+            case ArithOp::AND: return left && right;
+            case ArithOp::BIT_OR: return left | right;
+            case ArithOp::BIT_XOR: return left ^ right;
+            case ArithOp::BIT_AND: return left & right;
+            case ArithOp::EQ: return left == right;
+            case ArithOp::NE: return left != right;
+            case ArithOp::LE: return left <= right;
+            case ArithOp::GE: return left >= right;
+            case ArithOp::LT: return left < right;
+            case ArithOp::GT: return left > right;
+            case ArithOp::SHL: return static_cast<long>(a << (right & 63));
+            case ArithOp::SHR: return left >> (right & 63);
+            case ArithOp::ADD: return static_cast<long>(a + b);
+            case ArithOp::SUB: return static_cast<long>(a - b);
+            case ArithOp::MUL: return static_cast<long>(a * b);
+            case ArithOp::DIV:
+            case ArithOp::MOD:
+                break;
+        }
+        
+        if (right == 0) {
+            if (!skip) fail("division by 0");
+            return 0;
+        }
+        if (right == -1) return op == ArithOp::DIV ? static_cast<long>(0UL - a) : 0;  // LONG_MIN / -1
+        return op == ArithOp::DIV ? left / right : left % right;
+    }
+    
+    long unary(bool skip) {
+        skip_spaces();
+        if (accept('!')) return !unary(skip);
+        if (accept('~')) return ~unary(skip);
+        if (accept('-')) return static_cast<long>(0UL - static_cast<unsigned long>(unary(skip)));
+        if (accept('+')) return unary(skip);
+        
+        if (accept('(')) {
+            long value = assignment(skip);
+            if (!accept(')')) fail("missing `)'");
+            return value;
+        }
+        
+        size_t start = pos_;
+        while (pos_ < text_.size() && is_name_char(text_[pos_])) pos_++;
+        if (pos_ == start) {
+            fail("syntax error: operand expected");
+            return 0;
+        }
+        
+        std::string token(text_.substr(start, pos_ - start));
+        if (!std::isdigit(static_cast<unsigned char>(token[0]))) {
+            return skip ? 0 : variable_value(token);
+        }
+        
+        char* end = nullptr;
+        long value = std::strtol(token.c_str(), &end, 0);
+        if (*end) fail("value too great for base");
+        return value;
+    }
+    
+    std::string_view text_;
+    size_t pos_;
+    std::string error_;
+    static int depth_;
+};
+
+int ArithmeticParser::depth_ = 0;
+
+bool evaluate_arithmetic(std::string_view expression, long& value, std::string& error) {
+    ArithmeticParser parser(expression);
+    return parser.parse(value, error);
+}
+
+// Parameters and command substitutions inside the expression are expanded
+// first, as in $(( $i + 1 )).
+std::string expand_arithmetic(std::string_view expression) {
+    std::string expanded;
+    if (expression.find_first_of("$`\"'\\") != std::string_view::npos) {
+        std::vector<std::string> fields;
+        expand_word(Word{expression, true}, fields, false);
+        for (const std::string& field : fields) expanded += field;
+        expression = expanded;
+    }
+    
+    long value = 0;
+    std::string error;
+    if (!evaluate_arithmetic(expression, value, error)) {
+        std::cerr << expression << ": " << error << std::endl;
+        last_exit_status = 1;
+        expansion_failed = true;
+        return "";
+    }
+    return std::to_string(value);
+}
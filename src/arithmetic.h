@@ -0,0 +1,12 @@
+#ifndef ARITHMETIC_H
+#define ARITHMETIC_H
+
+#include <string>
+#include <string_view>
+
+// $((expression)): C-style integer arithmetic on long values. Bare names
+// read shell variables (unset or empty is 0) and `=`, `+=`, ... assign them.
+bool evaluate_arithmetic(std::string_view expression, long& value, std::string& error);
+std::string expand_arithmetic(std::string_view expression);
+
+#endif // ARITHMETIC_H
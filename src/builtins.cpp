@@ -2,14 +2,31 @@
 #include "utils.h"
 #include "job_control.h"
 #include "shell.h"
+#include "command_hash.h"
+#include "copy.h"
+#include "heredoc.h"
+#include "parallel.h"
+#include "history_search.h"
+#include "variables.h"
+#include "source_cache.h"
+#include "executor.h"
+#include "scan.h"
+#include "loadable.h"
+#include "timeout.h"
+#include "child_wait.h"
 #include <iostream>
+#include <memory>
 #include <unistd.h>
 #include <cstdlib>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <fstream>
 #include <readline/history.h>
 #include <signal.h>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
 
 std::map<std::string, builtin_func> builtins;
 std::map<std::string, int> last_written_positions;
@@ -28,14 +45,307 @@ void init_builtins() {
     builtins["bg"] = bg_command;
     builtins["jobs"] = jobs_command;
     builtins["help"] = help_command;
+    builtins["hash"] = hash_command;
+    builtins["cat"] = cat_command;
+    builtins["parallel"] = parallel_command;
+    builtins["export"] = export_command;
+    builtins["readonly"] = readonly_command;
+    builtins["unset"] = unset_command;
+    builtins["source"] = source_command;
+    builtins["."] = source_command;
+    builtins["true"] = true_command;
+    builtins["false"] = false_command;
+    builtins[":"] = true_command;
+    builtins["test"] = test_command;
+    builtins["["] = bracket_command;
+    builtins["break"] = break_command;
+    builtins["continue"] = continue_command;
+    builtins["wc"] = wc_command;
+    builtins["grep"] = grep_command;
+    builtins["enable"] = enable_command;
+    builtins["tee"] = tee_command;
+    builtins["timeout"] = timeout_command;
+    builtins["wait"] = wait_command;
+    builtins["set"] = set_command;
 }
 
 bool is_builtin(const std::string& cmd) {
     return builtins.find(cmd) != builtins.end();
 }
 
-void exit_command(const std::vector<std::string>& args) {
-    int code = 0;
+// Options we do not implement are left to the external command.
+static bool has_unsupported_options(const std::vector<std::string>& args) {
+    for (const auto& arg : args) {
+        if (arg.size() > 1 && arg[0] == '-') return true;
+    }
+    return false;
+}
+
+struct WcOptions {
+    bool lines = false;
+    bool words = false;
+    bool bytes = false;
+    std::vector<std::string> files;
+};
+
+struct GrepOptions {
+    std::string pattern;
+    std::vector<std::string> files;
+    bool count = false;
+    bool invert = false;
+    bool line_numbers = false;
+    bool quiet = false;
+    bool list_files = false;
+    bool no_messages = false;
+    int with_filename = -1;        // -H / -h; otherwise set when there are several files
+};
+
+// Options after the operands would be permuted by GNU getopt; leave those
+// command lines to the external tool rather than guess.
+static bool has_late_option(const std::vector<std::string>& args, size_t first_operand) {
+    for (size_t i = first_operand; i < args.size(); i++) {
+        if (args[i].size() > 1 && args[i][0] == '-') return true;
+    }
+    return false;
+}
+
+static bool parse_wc_options(const std::vector<std::string>& args, WcOptions& options) {
+    size_t i = 0;
+    for (; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "--") {
+            i++;
+            break;
+        }
+        if (arg.size() < 2 || arg[0] != '-') {
+            if (has_late_option(args, i)) return false;
+            break;
+        }
+        if (arg == "--lines") {
+            options.lines = true;
+        } else if (arg == "--words") {
+            options.words = true;
+        } else if (arg == "--bytes") {
+            options.bytes = true;
+        } else {
+            for (size_t j = 1; j < arg.size(); j++) {
+                if (arg[j] == 'l') options.lines = true;
+                else if (arg[j] == 'w') options.words = true;
+                else if (arg[j] == 'c') options.bytes = true;
+                else return false;
+            }
+        }
+    }
+    
+    if (!options.lines && !options.words && !options.bytes) {
+        options.lines = options.words = options.bytes = true;
+    }
+    options.files.assign(args.begin() + i, args.end());
+    return true;
+}
+
+// Only fixed strings are searched here: -F, or a pattern without regular
+// expression characters. Several patterns and other options go to grep(1).
+static bool parse_grep_options(const std::vector<std::string>& args, GrepOptions& options) {
+    bool fixed = false;
+    bool have_pattern = false;
+    size_t i = 0;
+    for (; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "--") {
+            i++;
+            break;
+        }
+        if (arg.size() < 2 || arg[0] != '-') break;
+        for (size_t j = 1; j < arg.size(); j++) {
+            switch (arg[j]) {
+                case 'F': fixed = true; break;
+                case 'c': options.count = true; break;
+                case 'v': options.invert = true; break;
+                case 'n': options.line_numbers = true; break;
+                case 'q': options.quiet = true; break;
+                case 'l': options.list_files = true; break;
+                case 's': options.no_messages = true; break;
+                case 'H': options.with_filename = 1; break;
+                case 'h': options.with_filename = 0; break;
+                case 'e':
+                    if (have_pattern) return false;
+                    if (j + 1 < arg.size()) {
+                        options.pattern = arg.substr(j + 1);
+                    } else if (++i < args.size()) {
+                        options.pattern = args[i];
+                    } else {
+                        return false;
+                    }
+                    have_pattern = true;
+                    j = arg.size();
+                    break;
+                default:
+                    return false;
+            }
+        }
+    }
+    
+    if (!have_pattern) {
+        if (i >= args.size()) return false;
+        options.pattern = args[i++];
+    }
+    if (has_late_option(args, i)) return false;
+    if (options.pattern.find('\n') != std::string::npos) return false;
+    if (!fixed && options.pattern.find_first_of(".[]*^$\\") != std::string::npos) return false;
+    
+    options.files.assign(args.begin() + i, args.end());
+    if (options.with_filename == -1) options.with_filename = options.files.size() > 1;
+    return true;
+}
+
+struct TeeOptions {
+    bool append = false;
+    std::vector<std::string> files;
+};
+
+// tee [-a] [file...]; -i, -p and a "-" operand are left to coreutils.
+static bool parse_tee_options(const std::vector<std::string>& args, TeeOptions& options) {
+    size_t i = 0;
+    for (; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "--") {
+            i++;
+            break;
+        }
+        if (arg.size() < 2 || arg[0] != '-') {
+            if (has_late_option(args, i)) return false;
+            break;
+        }
+        if (arg == "--append") {
+            options.append = true;
+            continue;
+        }
+        for (size_t j = 1; j < arg.size(); j++) {
+            if (arg[j] != 'a') return false;
+            options.append = true;
+        }
+    }
+    
+    options.files.assign(args.begin() + i, args.end());
+    return std::find(options.files.begin(), options.files.end(), "-") == options.files.end();
+}
+
+// timeout [-s SIG] [-k DURATION] DURATION command [args]. Options stop at
+// the duration, so the command's own options are left alone.
+static bool parse_timeout_options(const std::vector<std::string>& args, TimeoutOptions& options) {
+    size_t i = 0;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+        const std::string& arg = args[i];
+        if (arg == "--") {
+            i++;
+            break;
+        }
+        
+        std::string value;
+        char option = arg[1];
+        if (arg.compare(0, 9, "--signal=") == 0) {
+            option = 's';
+            value = arg.substr(9);
+        } else if (arg.compare(0, 13, "--kill-after=") == 0) {
+            option = 'k';
+            value = arg.substr(13);
+        } else if ((option == 's' || option == 'k') && arg.size() > 2) {
+            value = arg.substr(2);
+        } else if ((option == 's' || option == 'k') && arg.size() == 2 && i + 1 < args.size()) {
+            value = args[++i];
+        } else {
+            return false;
+        }
+        
+        if (option == 's') {
+            options.signal = parse_signal(value);
+            if (options.signal <= 0) return false;
+        } else if (option == 'k') {
+            if (!parse_duration(value, options.kill_after)) return false;
+        } else {
+            return false;
+        }
+    }
+    
+    if (i + 1 >= args.size() || !parse_duration(args[i], options.duration)) return false;
+    options.command.assign(args.begin() + i + 1, args.end());
+    return true;
+}
+
+bool should_run_as_builtin(const std::string& cmd, const std::vector<std::string>& args) {
+    if (!is_builtin(cmd)) return false;
+    if (cmd == "cat") return !has_unsupported_options(args);
+    if (cmd == "wc") {
+        WcOptions options;
+        return parse_wc_options(args, options);
+    }
+    if (cmd == "grep") {
+        GrepOptions options;
+        return parse_grep_options(args, options);
+    }
+    if (cmd == "tee") {
+        TeeOptions options;
+        return parse_tee_options(args, options);
+    }
+    if (cmd == "timeout") {
+        TimeoutOptions options;
+        return parse_timeout_options(args, options);
+    }
+    return true;
+}
+
+// cat, wc and grep without file operands or with a `-` one, and tee.
+bool builtin_reads_stdin(const std::string& cmd, const std::vector<std::string>& args) {
+    auto reads = [](const std::vector<std::string>& files) {
+        return files.empty() || std::find(files.begin(), files.end(), "-") != files.end();
+    };
+    if (cmd == "cat") return reads(args);
+    if (cmd == "tee") return true;
+    if (cmd == "wc") {
+        WcOptions options;
+        return parse_wc_options(args, options) && reads(options.files);
+    }
+    if (cmd == "grep") {
+        GrepOptions options;
+        return parse_grep_options(args, options) && reads(options.files);
+    }
+    return false;
+}
+
+// Builtins that only produce output can run inside the shell process for
+// command substitution; anything that changes shell state needs a subshell.
+bool is_side_effect_free_builtin(const std::string& cmd, const std::vector<std::string>& args) {
+    auto it = builtins.find(cmd);
+    if (it != builtins.end() && !it->second) {
+        return is_pure_loaded_builtin(cmd);
+    }
+    if (cmd == "echo" || cmd == "pwd" || cmd == "type" || cmd == "help" || cmd == "jobs" ||
+        cmd == "true" || cmd == "false" || cmd == ":" || cmd == "test" || cmd == "[") {
+        return true;
+    }
+    if (cmd == "cat") {
+        return !has_unsupported_options(args);
+    }
+    if (cmd == "wc" || cmd == "grep" || cmd == "tee") {
+        return should_run_as_builtin(cmd, args);
+    }
+    if (cmd == "history") {
+        return args.empty() || args[0].empty() || args[0][0] != '-';
+    }
+    if (cmd == "hash") {
+        return args.empty() || args[0] == "-t";
+    }
+    if (cmd == "export" || cmd == "readonly") {
+        return args.empty() || (args.size() == 1 && args[0] == "-p");
+    }
+    return false;
+}
+
+int exit_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    out.flush();
+    err.flush();
+    int code = last_exit_status;
     if (!args.empty()) {
         try {
             code = std::stoi(args[0]);
@@ -46,50 +356,65 @@ void exit_command(const std::vector<std::string>& args) {
     std::exit(code);
 }
 
-void echo_command(const std::vector<std::string>& args) {
+int echo_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink&) {
     for (size_t i = 0; i < args.size(); i++) {
-        std::cout << args[i];
-        if (i < args.size() - 1) std::cout << " ";
+        out << args[i];
+        if (i < args.size() - 1) out << " ";
     }
-    std::cout << std::endl;
+    out << '\n';
+    return 0;
 }
 
-void type_command(const std::vector<std::string>& args) {
-    if (args.empty()) return;
+int type_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    if (args.empty()) return 0;
     
     std::string cmd = args[0];
     
+    static const char* const keywords[] = {"time", "if", "then", "elif", "else", "fi", "while", "until",
+                                           "for", "in", "do", "done", "case", "esac", "!", "{", "}"};
+    if (std::find(std::begin(keywords), std::end(keywords), cmd) != std::end(keywords)) {
+        out << cmd << " is a shell keyword" << '\n';
+        return 0;
+    }
+    
     if (builtins.find(cmd) != builtins.end()) {
-        std::cout << cmd << " is a shell builtin" << std::endl;
-        return;
+        out << cmd << " is a shell builtin" << '\n';
+        return 0;
     }
     
-    std::string executable_path = find_executable_in_path(cmd);
+    std::string executable_path;
+    if (!hash_peek(cmd, executable_path)) {
+        executable_path = find_executable_in_path(cmd);
+    }
     if (!executable_path.empty()) {
-        std::cout << cmd << " is " << executable_path << std::endl;
-    } else {
-        std::cout << cmd << ": not found" << std::endl;
+        out << cmd << " is " << executable_path << '\n';
+        return 0;
     }
+    
+    err << cmd << ": not found" << '\n';
+    return 1;
 }
 
-void pwd_command(const std::vector<std::string>&) {
+int pwd_command(const std::vector<std::string>&, int, OutputSink& out, OutputSink&) {
     char cwd[4096];
     if (getcwd(cwd, sizeof(cwd))) {
-        std::cout << cwd << std::endl;
+        out << cwd << '\n';
+        return 0;
     }
+    return 1;
 }
 
-void cd_command(const std::vector<std::string>& args) {
+int cd_command(const std::vector<std::string>& args, int, OutputSink&, OutputSink& err) {
     std::string target_dir;
     
     if (args.empty()) {
-        const char* home = std::getenv("HOME");
+        const char* home = get_variable("HOME");
         target_dir = home ? home : ".";
     } else if (args[0] == "~") {
-        const char* home = std::getenv("HOME");
+        const char* home = get_variable("HOME");
         target_dir = home ? home : ".";
     } else if (args[0] == "-") {
-        const char* oldpwd = std::getenv("OLDPWD");
+        const char* oldpwd = get_variable("OLDPWD");
         target_dir = oldpwd ? oldpwd : ".";
     } else {
         target_dir = args[0];
@@ -98,14 +423,22 @@ void cd_command(const std::vector<std::string>& args) {
     char old_pwd[4096];
     if (getcwd(old_pwd, sizeof(old_pwd))) {
         if (chdir(target_dir.c_str()) == 0) {
-            setenv("OLDPWD", old_pwd, 1);
+            char new_pwd[4096];
+            set_variable("OLDPWD", old_pwd);
+            export_variable("OLDPWD");
+            if (getcwd(new_pwd, sizeof(new_pwd))) {
+                set_variable("PWD", new_pwd);
+                export_variable("PWD");
+            }
         } else {
-            std::cout << "cd: " << target_dir << ": No such file or directory" << std::endl;
+            err << "cd: " << target_dir << ": No such file or directory" << '\n';
+            return 1;
         }
     }
+    return 0;
 }
 
-void history_command(const std::vector<std::string>& args) {
+int history_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
     if (args.size() >= 2 && args[0] == "-r") {
         std::string history_file = args[1];
         std::ifstream file(history_file);
@@ -118,51 +451,71 @@ void history_command(const std::vector<std::string>& args) {
             }
             file.close();
         } else {
-            std::cout << "history: " << history_file << ": No such file or directory" << std::endl;
+            err << "history: " << history_file << ": No such file or directory" << '\n';
+            return 1;
         }
-        return;
+        return 0;
     }
     
-    if (args.size() >= 2 && args[0] == "-w") {
-        std::string history_file = args[1];
-        std::ofstream file(history_file);
-        if (file.is_open()) {
-            HISTORY_STATE* state = history_get_history_state();
-            for (int i = 0; i < state->length; i++) {
-                HIST_ENTRY* entry = history_get(i);
-                if (entry) {
-                    file << entry->line << std::endl;
+    if (!args.empty() && args[0] == "-s") {
+        std::string pattern;
+        size_t limit = 10;
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i] == "-n" && i + 1 < args.size()) {
+                try {
+                    limit = std::stoul(args[++i]);
+                } catch (...) {
+                    err << "history: " << args[i] << ": numeric argument required" << '\n';
+                    return 1;
                 }
+            } else if (pattern.empty()) {
+                pattern = args[i];
+            } else {
+                pattern += " " + args[i];
             }
-            file.close();
-            free(state);
-        } else {
-            std::cout << "history: " << history_file << ": Error writing file" << std::endl;
         }
-        return;
+        if (pattern.empty()) {
+            err << "history: usage: history -s pattern [-n count]" << '\n';
+            return 2;
+        }
+        
+        std::vector<HistoryMatch> matches = search_history(pattern, limit);
+        for (const HistoryMatch& match : matches) {
+            out << "    " << match.number << "  " << match.text << '\n';
+        }
+        return matches.empty() ? 1 : 0;
     }
     
-    if (args.size() >= 2 && args[0] == "-a") {
-        std::string history_file = args[1];
+    if (args.size() >= 2 && (args[0] == "-w" || args[0] == "-a")) {
+        const std::string& history_file = args[1];
+        bool append = args[0] == "-a";
         HISTORY_STATE* state = history_get_history_state();
-        int current_length = state->length;
-        int last_written = last_written_positions[history_file];
+        int total = history_base - 1 + state->length;
+        int first = 0;
+        if (append) {
+            first = std::max(0, last_written_positions[history_file] - (history_base - 1));
+        }
+        free(state);
         
-        std::ofstream file(history_file, std::ios::app);
-        if (file.is_open()) {
-            for (int i = last_written; i < current_length; i++) {
-                HIST_ENTRY* entry = history_get(i);
-                if (entry) {
-                    file << entry->line << std::endl;
-                }
+        auto file = OutputSink::open_file(history_file, append);
+        if (!file) {
+            err << "history: " << history_file << ": Error writing file" << '\n';
+            return 1;
+        }
+        for (int i = first; i < total - (history_base - 1); i++) {
+            HIST_ENTRY* entry = history_get(history_base + i);
+            if (entry) {
+                *file << entry->line << '\n';
             }
-            file.close();
-            last_written_positions[history_file] = current_length;
-        } else {
-            std::cout << "history: " << history_file << ": Error writing file" << std::endl;
         }
-        free(state);
-        return;
+        if (!file->flush()) {
+            err << "history: " << history_file << ": Error writing file" << '\n';
+            return 1;
+        }
+        if (append) {
+            last_written_positions[history_file] = total;
+        }
+        return 0;
     }
     
     HISTORY_STATE* state = history_get_history_state();
@@ -173,172 +526,1196 @@ void history_command(const std::vector<std::string>& args) {
             int requested_limit = std::stoi(args[0]);
             start = std::max(0, state->length - requested_limit);
         } catch (...) {
-            std::cout << "history: " << args[0] << ": numeric argument required" << std::endl;
+            err << "history: " << args[0] << ": numeric argument required" << '\n';
             free(state);
-            return;
+            return 1;
         }
     }
     
     for (int i = start; i < state->length; i++) {
-        HIST_ENTRY* entry = history_get(i);
+        HIST_ENTRY* entry = history_get(history_base + i);
         if (entry) {
-            std::cout << "    " << (i + 1) << "  " << entry->line << std::endl;
+            out << "    " << (history_base + i) << "  " << entry->line << '\n';
         }
     }
     free(state);
+    return 0;
 }
 
-void fg_command(const std::vector<std::string>& args) {
-    int job_id = jobs.empty() ? -1 : jobs.back().job_id;
+int fg_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    Job* job = current_job();
     
     if (!args.empty()) {
         try {
-            job_id = std::stoi(args[0]);
+            job = find_job(std::stoi(args[0]));
         } catch (...) {
-            std::cout << "fg: " << args[0] << ": no such job" << std::endl;
-            return;
+            job = nullptr;
         }
     }
     
-    Job* job = find_job(job_id);
     if (!job) {
-        std::cout << "fg: " << job_id << ": no such job" << std::endl;
-        return;
+        err << "fg: " << (args.empty() ? "current" : args[0]) << ": no such job" << '\n';
+        return 1;
     }
     
-    std::cout << job->command << std::endl;
+    out << job->command << '\n';
+    out.flush();
+    
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+    job->background = false;
     
     if (job->stopped) {
         kill(-job->pgid, SIGCONT);
         job->stopped = false;
     }
     
-    tcsetpgrp(STDIN_FILENO, job->pgid);
-    job->background = false;
-    
-    int status;
-    for (pid_t pid : job->pids) {
-        waitpid(pid, &status, WUNTRACED);
-    }
+    int status = wait_for_job(*job);
     
     tcsetpgrp(STDIN_FILENO, shell_pgid);
     
-    if (WIFSTOPPED(status)) {
-        job->stopped = true;
-    } else {
-        jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
-            [job_id](const Job& j) { return j.job_id == job_id; }), jobs.end());
+    if (!job->stopped) {
+        // A pipeline finishing in the foreground reports every stage, as it
+        // would have had it never stopped.
+        pipe_status = job->statuses;
+        pipe_status_published = true;
+        remove_job(job->job_id);
     }
+    return status;
 }
 
-void bg_command(const std::vector<std::string>& args) {
-    int job_id = -1;
-    
-    for (auto it = jobs.rbegin(); it != jobs.rend(); ++it) {
-        if (it->stopped) {
-            job_id = it->job_id;
-            break;
-        }
-    }
+int bg_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    Job* job = current_job();
     
     if (!args.empty()) {
         try {
-            job_id = std::stoi(args[0]);
+            job = find_job(std::stoi(args[0]));
         } catch (...) {
-            std::cout << "bg: " << args[0] << ": no such job" << std::endl;
-            return;
+            job = nullptr;
         }
     }
     
-    Job* job = find_job(job_id);
     if (!job) {
-        std::cout << "bg: " << job_id << ": no such job" << std::endl;
-        return;
+        err << "bg: " << (args.empty() ? "current" : args[0]) << ": no such job" << '\n';
+        return 1;
     }
     
     if (!job->stopped) {
-        std::cout << "bg: job " << job_id << " already in background" << std::endl;
-        return;
+        err << "bg: job " << job->job_id << " already in background" << '\n';
+        return 1;
     }
     
-    std::cout << "[" << job->job_id << "]+ " << job->command << " &" << std::endl;
+    out << "[" << job->job_id << "]+ " << job->command << " &" << '\n';
     
     job->stopped = false;
     job->background = true;
     kill(-job->pgid, SIGCONT);
+    return 0;
 }
 
-void jobs_command(const std::vector<std::string>&) {
-    for (const auto& job : jobs) {
-        std::cout << "[" << job.job_id << "]  ";
-        if (job.stopped) {
-            std::cout << "Stopped";
-        } else if (job.background) {
-            std::cout << "Running";
+int jobs_command(const std::vector<std::string>&, int, OutputSink& out, OutputSink&) {
+    for (const Job* job : sorted_jobs()) {
+        out << "[" << job->job_id << "]  ";
+        if (job->stopped) {
+            out << "Stopped";
+        } else if (job->pids.empty()) {
+            out << "Done";
         } else {
-            std::cout << "Running";
+            out << "Running";
         }
-        std::cout << "                 " << job.command;
-        if (job.background && !job.stopped) {
-            std::cout << " &";
+        out << "                 " << job->command;
+        if (job->background && !job->stopped) {
+            out << " &";
         }
-        std::cout << std::endl;
+        out << '\n';
     }
+    return 0;
 }
 
-void help_command(const std::vector<std::string>&) {
+int hash_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    if (args.empty()) {
+        if (command_hash.empty()) {
+            out << "hash: hash table empty" << '\n';
+            return 0;
+        }
+        
+        std::map<std::string, const HashEntry*> sorted;
+        for (const auto& entry : command_hash) {
+            sorted[entry.first] = &entry.second;
+        }
+        
+        out << "hits\tcommand\n";
+        for (const auto& entry : sorted) {
+            std::string hits = std::to_string(entry.second->hits);
+            out << std::string(hits.length() < 4 ? 4 - hits.length() : 0, ' ')
+                << hits << "\t" << entry.second->path << "\n";
+        }
+        return 0;
+    }
+    
+    size_t i = 0;
+    std::string option = args[0];
+    
+    if (option == "-r") {
+        hash_clear();
+        i = 1;
+        if (i >= args.size()) return 0;
+        option = args[i];
+    }
+    
+    if (option == "-p") {
+        if (args.size() < i + 3) {
+            err << "hash: -p: option requires an argument" << '\n';
+            return 1;
+        }
+        for (size_t j = i + 2; j < args.size(); j++) {
+            hash_insert(args[j], args[i + 1]);
+        }
+        return 0;
+    }
+    
+    int status = 0;
+    
+    if (option == "-d") {
+        for (size_t j = i + 1; j < args.size(); j++) {
+            if (command_hash.find(args[j]) == command_hash.end()) {
+                err << "hash: " << args[j] << ": not found" << '\n';
+                status = 1;
+            } else {
+                hash_remove(args[j]);
+            }
+        }
+        return status;
+    }
+    
+    if (option == "-t") {
+        for (size_t j = i + 1; j < args.size(); j++) {
+            std::string path;
+            if (hash_peek(args[j], path)) {
+                if (args.size() > i + 2) {
+                    out << args[j] << "\t";
+                }
+                out << path << '\n';
+            } else {
+                out.flush();
+                err << "hash: " << args[j] << ": not found" << '\n';
+                err.flush();
+                status = 1;
+            }
+        }
+        return status;
+    }
+    
+    for (size_t j = i; j < args.size(); j++) {
+        if (is_builtin(args[j])) continue;
+        
+        std::string path = find_executable_in_path(args[j]);
+        if (path.empty()) {
+            err << "hash: " << args[j] << ": not found" << '\n';
+            status = 1;
+        } else {
+            hash_insert(args[j], path);
+        }
+    }
+    return status;
+}
+
+int help_command(const std::vector<std::string>&, int, OutputSink& out, OutputSink&) {
     const char* CYAN = "\033[36m";
     const char* YELLOW = "\033[33m";
     const char* RESET = "\033[0m";
     
-    std::cout << YELLOW << "\nAvailable Builtin Commands:\n" << RESET;
-    std::cout << std::string(50, '-') << "\n";
-    std::cout << CYAN << "exit [code]" << RESET << "       - Exit the shell\n";
-    std::cout << CYAN << "echo <args>" << RESET << "       - Print arguments to stdout\n";
-    std::cout << CYAN << "type <cmd>" << RESET << "        - Show command type\n";
-    std::cout << CYAN << "pwd" << RESET << "               - Print working directory\n";
-    std::cout << CYAN << "cd [dir]" << RESET << "          - Change directory\n";
-    std::cout << CYAN << "history [n]" << RESET << "       - View command history\n";
-    std::cout << CYAN << "jobs" << RESET << "              - List background jobs\n";
-    std::cout << CYAN << "fg [job]" << RESET << "          - Bring job to foreground\n";
-    std::cout << CYAN << "bg [job]" << RESET << "          - Resume job in background\n";
-    std::cout << CYAN << "help" << RESET << "              - Show this help message\n";
-    std::cout << std::string(50, '-') << "\n\n";
-}
-
-void execute_builtin(const std::string& command, const std::vector<std::string>& args,
-                     const RedirectionConfig& redir) {
-    int saved_stdout = -1, saved_stderr = -1;
-    int stdout_fd = -1, stderr_fd = -1;
+    out << YELLOW << "\nAvailable Builtin Commands:\n" << RESET;
+    out << std::string(50, '-') << "\n";
+    out << CYAN << "exit [code]" << RESET << "       - Exit the shell\n";
+    out << CYAN << "echo <args>" << RESET << "       - Print arguments to stdout\n";
+    out << CYAN << "type <cmd>" << RESET << "        - Show command type\n";
+    out << CYAN << "pwd" << RESET << "               - Print working directory\n";
+    out << CYAN << "cd [dir]" << RESET << "          - Change directory\n";
+    out << CYAN << "history [n]" << RESET << "       - View command history\n";
+    out << CYAN << "history -s pat [-n N]" << RESET << " - Search all history, best matches first\n";
+    out << CYAN << "jobs" << RESET << "              - List background jobs\n";
+    out << CYAN << "fg [job]" << RESET << "          - Bring job to foreground\n";
+    out << CYAN << "bg [job]" << RESET << "          - Resume job in background\n";
+    out << CYAN << "hash [-r] [name]" << RESET << "  - Remember or list command locations\n";
+    out << CYAN << "cat [file...]" << RESET << "     - Concatenate files to stdout\n";
+    out << CYAN << "wc [-lwc] [file...]" << RESET << " - Count lines, words and bytes\n";
+    out << CYAN << "grep [-Fcvnqls] str [file...]" << RESET << " - Print lines containing a fixed string\n";
+    out << CYAN << "tee [-a] [file...]" << RESET << "  - Copy stdin to stdout and files\n";
+    out << CYAN << "parallel [-j N] [-k] cmd [::: args]" << RESET << " - Run cmd once per argument, N at a time\n";
+    out << CYAN << "time [-p] [-j] pipeline" << RESET << " - Report real/user/sys time, max RSS, context switches and I/O\n";
+    out << CYAN << "export [name[=value]...]" << RESET << " - Pass variables to commands, or list them\n";
+    out << CYAN << "readonly [name[=value]...]" << RESET << " - Make variables read-only, or list them\n";
+    out << CYAN << "unset name..." << RESET << "     - Remove variables\n";
+    out << CYAN << "source file" << RESET << "       - Run commands from file in this shell (also `.`)\n";
+    out << CYAN << "source -s" << RESET << "         - Show compiled-script cache statistics\n";
+    out << CYAN << "true, false, :" << RESET << "    - Return success (or failure)\n";
+    out << CYAN << "test expr, [ expr ]" << RESET << " - Compare strings and integers, check files\n";
+    out << CYAN << "break [n], continue [n]" << RESET << " - Leave or restart the enclosing loop\n";
+    out << CYAN << "timeout [-s sig] [-k dur] dur cmd" << RESET << " - Run cmd, signal it after dur (s, m, h, d)\n";
+    out << CYAN << "wait [-n] [%job|pid...]" << RESET << " - Wait for background jobs (-n: the next one)\n";
+    out << CYAN << "set -o pipefail" << RESET << "   - Fail a pipeline if any stage fails (+o to undo)\n";
+    out << CYAN << "enable -f lib.so name..." << RESET << " - Load builtins from a shared object\n";
+    out << CYAN << "enable -d name..." << RESET << " - Unload builtins loaded with -f\n";
+    for (const auto& info : loaded_builtins()) {
+        std::string usage = info.usage;
+        if (usage.size() < 18) usage.resize(18, ' ');
+        out << CYAN << usage << RESET << " - " << info.description << " (" << info.path << ")\n";
+    }
+    out << CYAN << "help" << RESET << "              - Show this help message\n";
+    out << std::string(50, '-') << "\n\n";
+    return 0;
+}
+
+// A copy or scan cut short by Ctrl-C ends the builtin quietly, with the
+// status of a command killed by SIGINT.
+static bool interrupted() {
+    return errno == EINTR && interrupt_pending;
+}
+
+// `cat f >> f`: the copy would keep reading what it has just appended.
+static bool is_output_file(int fd, const OutputSink& out) {
+    struct stat in_st, out_st;
+    if (out.fd() == -1 || fstat(fd, &in_st) == -1 || fstat(out.fd(), &out_st) == -1) return false;
+    if (!S_ISREG(out_st.st_mode) || in_st.st_dev != out_st.st_dev || in_st.st_ino != out_st.st_ino) {
+        return false;
+    }
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    return in_st.st_size > (offset > 0 ? offset : 0);
+}
+
+int cat_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    std::vector<std::string> files = args;
+    if (files.empty()) {
+        files.push_back("-");
+    }
+    
+    int status = 0;
+    for (const auto& file : files) {
+        int fd = in;
+        if (file != "-") {
+            fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                err << "cat: " << file << ": " << strerror(errno) << '\n';
+                err.flush();
+                status = 1;
+                continue;
+            }
+        }
+        
+        if (is_output_file(fd, out)) {
+            out.flush();
+            err << "cat: " << file << ": input file is output file" << '\n';
+            err.flush();
+            status = 1;
+            if (fd != in) close(fd);
+            continue;
+        }
+        
+        bool stop = false;
+        if (copy_fd_to_sink(fd, out) < 0 && errno != EPIPE) {
+            if (interrupted()) {
+                status = 128 + SIGINT;
+                stop = true;
+            } else {
+                err << "cat: " << file << ": " << strerror(errno) << '\n';
+                err.flush();
+                status = 1;
+            }
+        }
+        
+        if (fd != in) {
+            close(fd);
+        }
+        if (stop) break;
+    }
+    return status;
+}
+
+int tee_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    TeeOptions options;
+    if (!parse_tee_options(args, options)) {
+        err << "tee: usage: tee [-a] [file...]" << '\n';
+        return 2;
+    }
     
-    if (!redir.stdout_file.empty()) {
-        saved_stdout = dup(STDOUT_FILENO);
-        int flags = O_WRONLY | O_CREAT | (redir.stdout_append ? O_APPEND : O_TRUNC);
-        stdout_fd = open(redir.stdout_file.c_str(), flags, 0644);
-        if (stdout_fd != -1) {
-            dup2(stdout_fd, STDOUT_FILENO);
+    int status = 0;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (options.append ? O_APPEND : O_TRUNC);
+    std::vector<int> fds;
+    std::vector<const std::string*> names;
+    for (const auto& file : options.files) {
+        int fd = open(file.c_str(), flags, 0666);
+        if (fd == -1) {
+            err << "tee: " << file << ": " << strerror(errno) << '\n';
+            status = 1;
+            continue;
+        }
+        fds.push_back(fd);
+        names.push_back(&file);
+    }
+    err.flush();
+    
+    std::vector<int> errors;
+    if (tee_fd_to_sink(in, out, fds, errors) < 0 && errno != EPIPE) {
+        if (interrupted()) {
+            status = 128 + SIGINT;
+        } else {
+            err << "tee: " << strerror(errno) << '\n';
+            status = 1;
+        }
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (errors[i] != 0) {
+            err << "tee: " << *names[i] << ": " << strerror(errors[i]) << '\n';
+            status = 1;
+        }
+        if (close(fds[i]) == -1 && errors[i] == 0) {
+            err << "tee: " << *names[i] << ": " << strerror(errno) << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+// Opens a file operand; "-" is the builtin's standard input.
+static int open_operand(const std::string& file, int in) {
+    if (file == "-") return in;
+    return open(file.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+struct WcCounts {
+    size_t lines = 0;
+    size_t words = 0;
+    size_t bytes = 0;
+};
+
+static const size_t WC_SLICE = 256 * 1024;
+
+static int wc_count(int fd, const WcOptions& options, WcCounts& counts) {
+    // The size of a regular file is all -c needs.
+    struct stat st;
+    if (!options.lines && !options.words && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        if (offset >= 0) {
+            counts.bytes = st.st_size > offset ? st.st_size - offset : 0;
+            lseek(fd, 0, SEEK_END);
+            return 0;
+        }
+    }
+    
+    // Both counters run over the same slice while it is still in cache.
+    bool in_word = false;
+    return scan_fd(fd, false, [&](const char* data, size_t size) {
+        for (size_t done = 0; done < size; done += WC_SLICE) {
+            size_t length = std::min(WC_SLICE, size - done);
+            if (options.lines) counts.lines += count_newlines(data + done, length);
+            if (options.words) counts.words += count_words(data + done, length, in_word);
+        }
+        counts.bytes += size;
+        return true;
+    });
+}
+
+static void print_wc_counts(OutputSink& out, const WcOptions& options, const WcCounts& counts, int width,
+                            const std::string* name) {
+    std::string line;
+    auto field = [&](size_t value) {
+        std::string digits = std::to_string(value);
+        if (!line.empty()) line += ' ';
+        if (static_cast<int>(digits.size()) < width) line.append(width - digits.size(), ' ');
+        line += digits;
+    };
+    if (options.lines) field(counts.lines);
+    if (options.words) field(counts.words);
+    if (options.bytes) field(counts.bytes);
+    if (name) line += ' ' + *name;
+    line += '\n';
+    out << line;
+}
+
+int wc_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    WcOptions options;
+    if (!parse_wc_options(args, options)) {
+        err << "wc: unsupported option" << '\n';
+        return 1;
+    }
+    
+    bool named = !options.files.empty();
+    if (!named) options.files.push_back("-");
+    
+    // Inputs are opened up front because the column width, as in coreutils,
+    // depends on the total size of the regular files being counted.
+    // Their errors wait for their turn in the output.
+    std::vector<int> fds;
+    std::vector<int> open_errors;
+    int width = 1;
+    int minimum_width = 1;
+    off_t regular_total = 0;
+    int status = 0;
+    for (const auto& file : options.files) {
+        int fd = open_operand(file, in);
+        fds.push_back(fd);
+        open_errors.push_back(fd == -1 ? errno : 0);
+        
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0) {
+            if (S_ISREG(st.st_mode)) regular_total += st.st_size;
+            else minimum_width = 7;
+        }
+    }
+    int selected = options.lines + options.words + options.bytes;
+    if (!(options.files.size() == 1 && selected == 1)) {
+        for (; regular_total >= 10; regular_total /= 10) width++;
+        width = std::max(width, minimum_width);
+    }
+    
+    WcCounts total;
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i] == -1) {
+            out.flush();
+            err << "wc: " << options.files[i] << ": " << strerror(open_errors[i]) << '\n';
+            err.flush();
+            status = 1;
+            continue;
+        }
+        
+        WcCounts counts;
+        if (wc_count(fds[i], options, counts) == -1) {
+            if (interrupted()) {
+                for (size_t j = i; j < fds.size(); j++) {
+                    if (fds[j] != -1 && fds[j] != in) close(fds[j]);
+                }
+                return 128 + SIGINT;
+            }
+            out.flush();
+            err << "wc: " << options.files[i] << ": " << strerror(errno) << '\n';
+            err.flush();
+            status = 1;
+        }
+        if (fds[i] != in) close(fds[i]);
+        
+        print_wc_counts(out, options, counts, width, named ? &options.files[i] : nullptr);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+    }
+    
+    if (options.files.size() > 1) {
+        static const std::string total_name = "total";
+        print_wc_counts(out, options, total, width, &total_name);
+    }
+    return status;
+}
+
+// Searches one input for options.pattern and prints or counts the selected
+// lines. Returns the number of lines selected; -q and -l stop at the first.
+static size_t grep_input(int fd, const std::string& name, const GrepOptions& options, OutputSink& out,
+                         OutputSink& err, bool& failed) {
+    bool print = !options.count && !options.quiet && !options.list_files;
+    bool first_only = options.quiet || options.list_files;
+    size_t line = 0;               // lines before the current position
+    size_t selected = 0;
+    bool checked_binary = false;
+    bool binary = false;
+    
+    // A NUL in the first 32 KiB, or in a line about to be printed, makes
+    // this a binary file: one notice on stderr instead of the lines.
+    auto emit = [&](const char* begin, const char* end) {
+        selected++;
+        if (!print) return !first_only;
+        if (binary || memchr(begin, '\0', end - begin)) {
+            out.flush();
+            err << "grep: " << name << ": binary file matches" << '\n';
+            err.flush();
+            return false;
+        }
+        if (options.with_filename) out << name << ':';
+        if (options.line_numbers) out << line + 1 << ':';
+        out.write(begin, end - begin);
+        out << '\n';
+        return true;
+    };
+    
+    int result = scan_fd(fd, true, [&](const char* data, size_t size) {
+        if (!checked_binary) {
+            checked_binary = true;
+            binary = memchr(data, '\0', std::min<size_t>(size, 32 * 1024)) != nullptr;
+        }
+        
+        const char* pos = data;
+        const char* end = data + size;
+        while (pos < end) {
+            const char* match = find_fixed(pos, end, options.pattern);
+            const char* line_start = end;
+            if (match) {
+                const char* newline = static_cast<const char*>(memrchr(pos, '\n', match - pos));
+                line_start = newline ? newline + 1 : pos;
+            }
+            
+            // Everything in [pos, line_start) is whole lines without a match.
+            if (options.invert && !print && pos < line_start) {
+                size_t lines = count_newlines(pos, line_start - pos) + (line_start[-1] != '\n');
+                selected += lines;
+                line += lines;
+                if (first_only) return false;
+                pos = line_start;
+            }
+            while (options.invert && pos < line_start) {
+                const char* newline = static_cast<const char*>(memchr(pos, '\n', line_start - pos));
+                const char* line_end = newline ? newline : line_start;
+                if (!emit(pos, line_end)) return false;
+                line++;
+                pos = newline ? newline + 1 : line_start;
+            }
+            if (!options.invert && options.line_numbers) {
+                line += count_newlines(pos, line_start - pos);
+            }
+            if (!match) break;
+            
+            const char* newline = static_cast<const char*>(memchr(match, '\n', end - match));
+            const char* line_end = newline ? newline : end;
+            if (!options.invert && !emit(line_start, line_end)) return false;
+            line++;
+            pos = newline ? newline + 1 : end;
+        }
+        // Matches go out as each block is scanned, so `tail -f log | grep`
+        // shows them as they arrive.
+        return !print || out.flush();
+    });
+    
+    if (result == -1 && interrupted()) {
+        failed = true;
+        return selected;
+    }
+    if (result == -1 && !options.no_messages) {
+        out.flush();
+        err << "grep: " << name << ": " << strerror(errno) << '\n';
+        err.flush();
+    }
+    if (result == -1) failed = true;
+    return selected;
+}
+
+int grep_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    GrepOptions options;
+    if (!parse_grep_options(args, options)) {
+        err << "grep: unsupported pattern or option" << '\n';
+        return 2;
+    }
+    if (options.files.empty()) options.files.push_back("-");
+    
+    bool failed = false;
+    bool any = false;
+    for (const auto& file : options.files) {
+        std::string name = file == "-" ? "(standard input)" : file;
+        int fd = open_operand(file, in);
+        if (fd == -1) {
+            if (!options.no_messages) {
+                out.flush();
+                err << "grep: " << file << ": " << strerror(errno) << '\n';
+                err.flush();
+            }
+            failed = true;
+            continue;
         }
+        
+        size_t selected = grep_input(fd, name, options, out, err, failed);
+        bool stop = failed && interrupted();
+        if (fd != in) close(fd);
+        if (stop) return 128 + SIGINT;
+        any = any || selected > 0;
+        
+        if (options.count) {
+            if (options.with_filename) out << name << ':';
+            out << selected << '\n';
+        } else if (options.list_files && selected > 0) {
+            out << name << '\n';
+        }
+        if (options.quiet && any) break;
+    }
+    
+    if (options.quiet && any) return 0;
+    if (failed) return 2;
+    return any ? 0 : 1;
+}
+
+static void read_lines(int fd, std::vector<std::string>& lines) {
+    std::string data;
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n == -1 && errno == EINTR)) {
+        if (n > 0) data.append(buffer, n);
+    }
+    
+    size_t start = 0;
+    while (start < data.size()) {
+        size_t end = data.find('\n', start);
+        if (end == std::string::npos) end = data.size();
+        lines.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+int parallel_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    ParallelOptions options;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    options.slots = cpus > 0 ? cpus : 1;
+    
+    size_t i = 0;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-' && args[i] != ":::"; i++) {
+        if (args[i] == "-k") {
+            options.keep_order = true;
+        } else if (args[i].compare(0, 2, "-j") == 0) {
+            std::string value = args[i].substr(2);
+            if (value.empty() && i + 1 < args.size()) {
+                value = args[++i];
+            }
+            int slots = std::atoi(value.c_str());
+            if (slots <= 0) {
+                err << "parallel: -j: invalid number of slots: " << value << '\n';
+                return 2;
+            }
+            options.slots = slots;
+        } else {
+            err << "parallel: " << args[i] << ": invalid option" << '\n';
+            return 2;
+        }
+    }
+    
+    for (; i < args.size() && args[i] != ":::"; i++) {
+        options.command.push_back(args[i]);
+    }
+    if (options.command.empty()) {
+        err << "parallel: usage: parallel [-j N] [-k] command [args] [::: items...]" << '\n';
+        return 2;
+    }
+    
+    // Without ::: the items come from stdin, which the tasks must not share.
+    std::vector<std::string> items;
+    if (i < args.size()) {
+        items.assign(args.begin() + i + 1, args.end());
+    } else {
+        read_lines(in, items);
+        options.input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    
+    int status = run_parallel(options, items, out, err);
+    
+    if (options.input_fd != -1) {
+        close(options.input_fd);
+    }
+    return status;
+}
+
+int run_builtin(const std::string& command, const std::vector<std::string>& args, int in,
+                OutputSink& out, OutputSink& err) {
+    builtin_func builtin = builtins[command];
+    if (!builtin) return run_loaded_builtin(command, args, in, out, err);
+    return builtin(args, in, out, err);
+}
+
+int execute_builtin(const std::string& command, const std::vector<std::string>& args,
+                    const RedirectionConfig& redir, int in_fd, int out_fd) {
+    // Anything the shell itself queued on std::cout must land before our output.
+    if (out_fd == STDOUT_FILENO) {
+        std::cout.flush();
+    }
+    
+    std::unique_ptr<OutputSink> out_file;
+    std::unique_ptr<OutputSink> err_file;
+    
+    if (!redir.stdout_file.empty()) {
+        out_file = OutputSink::open_file(redir.stdout_file, redir.stdout_append);
+        if (!out_file) return 1;
     }
     
     if (!redir.stderr_file.empty()) {
-        saved_stderr = dup(STDERR_FILENO);
-        int flags = O_WRONLY | O_CREAT | (redir.stderr_append ? O_APPEND : O_TRUNC);
-        stderr_fd = open(redir.stderr_file.c_str(), flags, 0644);
-        if (stderr_fd != -1) {
-            dup2(stderr_fd, STDERR_FILENO);
+        err_file = OutputSink::open_file(redir.stderr_file, redir.stderr_append);
+        if (!err_file) return 1;
+    }
+    
+    int in_file = -1;
+    if (redir.use_heredoc) {
+        in_file = open_heredoc(redir.heredoc_fd);
+        if (in_file == -1) {
+            std::cerr << "heredoc: " << strerror(errno) << std::endl;
+            return 1;
+        }
+    } else if (!redir.stdin_file.empty()) {
+        in_file = open(redir.stdin_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in_file == -1) {
+            std::cerr << redir.stdin_file << ": " << strerror(errno) << std::endl;
+            return 1;
         }
     }
     
-    builtins[command](args);
+    OutputSink out(out_fd);
+    OutputSink err(STDERR_FILENO);
+    OutputSink& builtin_out = out_file ? *out_file : out;
+    OutputSink& builtin_err = err_file ? *err_file : err;
+    int status = run_builtin(command, args, in_file != -1 ? in_file : in_fd, builtin_out, builtin_err);
     
-    if (saved_stdout != -1) {
-        dup2(saved_stdout, STDOUT_FILENO);
-        close(saved_stdout);
+    // The sinks would flush err first on the way out of scope.
+    builtin_out.flush();
+    builtin_err.flush();
+    
+    if (in_file != -1) {
+        close(in_file);
+    }
+    return status;
+}
+
+static void print_declaration(OutputSink& out, const char* flag, const std::string& name, const Variable& variable) {
+    out << "declare " << flag << " " << name << "=\"";
+    for (char c : variable.value) {
+        if (c == '"' || c == '\\' || c == '$' || c == '`') out << '\\';
+        out << c;
+    }
+    out << "\"\n";
+}
+
+// Shared by export and readonly: applies `mark` to each NAME or NAME=value,
+// or lists the variables that already have the attribute.
+static int declare_variables(const std::vector<std::string>& args, OutputSink& out, OutputSink& err,
+                             const char* builtin, const char* flag, bool (*has)(const Variable&),
+                             void (*mark)(const std::string&)) {
+    if (args.empty() || (args.size() == 1 && args[0] == "-p")) {
+        for (const auto& entry : sorted_variables()) {
+            if (has(*entry.second)) print_declaration(out, flag, entry.first, *entry.second);
+        }
+        return 0;
     }
-    if (saved_stderr != -1) {
-        dup2(saved_stderr, STDERR_FILENO);
-        close(saved_stderr);
+    
+    int status = 0;
+    for (const std::string& arg : args) {
+        size_t equals = arg.find('=');
+        std::string name = arg.substr(0, equals);
+        if (!is_valid_name(name)) {
+            err << builtin << ": `" << arg << "': not a valid identifier" << '\n';
+            status = 1;
+            continue;
+        }
+        if (equals != std::string::npos && !set_variable(name, arg.substr(equals + 1))) {
+            err << builtin << ": " << name << ": readonly variable" << '\n';
+            status = 1;
+            continue;
+        }
+        mark(name);
+    }
+    return status;
+}
+
+int export_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    return declare_variables(args, out, err, "export", "-x",
+                             [](const Variable& v) { return v.exported; },
+                             [](const std::string& name) { export_variable(name); });
+}
+
+int readonly_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    return declare_variables(args, out, err, "readonly", "-r",
+                             [](const Variable& v) { return v.readonly; }, mark_readonly);
+}
+
+int unset_command(const std::vector<std::string>& args, int, OutputSink&, OutputSink& err) {
+    int status = 0;
+    for (const std::string& name : args) {
+        if (name == "-v") continue;
+        if (!unset_variable(name)) {
+            err << "unset: " << name << ": cannot unset: readonly variable" << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int true_command(const std::vector<std::string>&, int, OutputSink&, OutputSink&) {
+    return 0;
+}
+
+int false_command(const std::vector<std::string>&, int, OutputSink&, OutputSink&) {
+    return 1;
+}
+
+// Loops compile break and continue into jumps, so reaching the builtin
+// means there is no loop to leave.
+int break_command(const std::vector<std::string>&, int, OutputSink&, OutputSink& err) {
+    err << "break: only meaningful in a `for', `while', or `until' loop" << '\n';
+    return 0;
+}
+
+int continue_command(const std::vector<std::string>&, int, OutputSink&, OutputSink& err) {
+    err << "continue: only meaningful in a `for', `while', or `until' loop" << '\n';
+    return 0;
+}
+
+static bool parse_integer(const std::string& text, long& value) {
+    const char* start = text.c_str();
+    while (*start == ' ' || *start == '\t') start++;
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtol(start, &end, 10);
+    if (end == start || errno == ERANGE) return false;
+    while (*end == ' ' || *end == '\t') end++;
+    return *end == '\0';
+}
+
+// File and string tests: 1 if true, 0 if false, -1 for an unknown operator.
+static int test_unary(const std::string& op, const std::string& operand) {
+    if (op == "-n") return !operand.empty();
+    if (op == "-z") return operand.empty();
+    if (op == "-r") return access(operand.c_str(), R_OK) == 0;
+    if (op == "-w") return access(operand.c_str(), W_OK) == 0;
+    if (op == "-x") return access(operand.c_str(), X_OK) == 0;
+    if (op == "-t") return isatty(std::atoi(operand.c_str()));
+    
+    struct stat st;
+    if (op == "-L" || op == "-h") return lstat(operand.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+    
+    bool exists = stat(operand.c_str(), &st) == 0;
+    if (op == "-e") return exists;
+    if (op == "-f") return exists && S_ISREG(st.st_mode);
+    if (op == "-d") return exists && S_ISDIR(st.st_mode);
+    if (op == "-s") return exists && st.st_size > 0;
+    if (op == "-p") return exists && S_ISFIFO(st.st_mode);
+    if (op == "-S") return exists && S_ISSOCK(st.st_mode);
+    if (op == "-b") return exists && S_ISBLK(st.st_mode);
+    if (op == "-c") return exists && S_ISCHR(st.st_mode);
+    return -1;
+}
+
+static bool is_test_binary_operator(const std::string& op) {
+    return op == "=" || op == "==" || op == "!=" || op == "<" || op == ">" || op == "-eq" || op == "-ne" ||
+           op == "-lt" || op == "-le" || op == "-gt" || op == "-ge";
+}
+
+// Returns the exit status: 0 if true, 1 if false, 2 on a usage error.
+static int test_binary(const std::string& left, const std::string& op, const std::string& right, OutputSink& err) {
+    if (op == "=" || op == "==") return left == right ? 0 : 1;
+    if (op == "!=") return left != right ? 0 : 1;
+    if (op == "<") return left < right ? 0 : 1;
+    if (op == ">") return left > right ? 0 : 1;
+    
+    long a = 0;
+    long b = 0;
+    for (const std::string* operand : {&left, &right}) {
+        if (!parse_integer(*operand, operand == &left ? a : b)) {
+            err << "test: " << *operand << ": integer expression expected" << '\n';
+            return 2;
+        }
+    }
+    bool result = op == "-eq" ? a == b : op == "-ne" ? a != b : op == "-lt" ? a < b :
+                  op == "-le" ? a <= b : op == "-gt" ? a > b : a >= b;
+    return result ? 0 : 1;
+}
+
+// POSIX test: the meaning of the arguments is decided by how many there are.
+static int test_arguments(const std::vector<std::string>& args, size_t begin, size_t end, OutputSink& err) {
+    size_t count = end - begin;
+    const std::string* a = args.data() + begin;
+    
+    switch (count) {
+        case 0:
+            return 1;
+        case 1:
+            return a[0].empty() ? 1 : 0;
+        case 2: {
+            if (a[0] == "!") return a[1].empty() ? 0 : 1;
+            int result = test_unary(a[0], a[1]);
+            if (result == -1) {
+                err << "test: " << a[0] << ": unary operator expected" << '\n';
+                return 2;
+            }
+            return result ? 0 : 1;
+        }
+        case 3:
+            if (is_test_binary_operator(a[1])) return test_binary(a[0], a[1], a[2], err);
+            if (a[0] == "!") {
+                int status = test_arguments(args, begin + 1, end, err);
+                return status == 2 ? 2 : 1 - status;
+            }
+            if (a[0] == "(" && a[2] == ")") return test_arguments(args, begin + 1, end - 1, err);
+            err << "test: " << a[1] << ": binary operator expected" << '\n';
+            return 2;
+        case 4:
+            if (a[0] == "!") {
+                int status = test_arguments(args, begin + 1, end, err);
+                return status == 2 ? 2 : 1 - status;
+            }
+            if (a[0] == "(" && a[3] == ")") return test_arguments(args, begin + 1, end - 1, err);
+            break;
+    }
+    err << "test: too many arguments" << '\n';
+    return 2;
+}
+
+int test_command(const std::vector<std::string>& args, int, OutputSink&, OutputSink& err) {
+    return test_arguments(args, 0, args.size(), err);
+}
+
+int bracket_command(const std::vector<std::string>& args, int, OutputSink&, OutputSink& err) {
+    if (args.empty() || args.back() != "]") {
+        err << "[: missing `]'" << '\n';
+        return 2;
+    }
+    return test_arguments(args, 0, args.size() - 1, err);
+}
+
+// Like bash: a name without a slash is looked up in PATH, then in the
+// current directory.
+static std::string find_source_file(const std::string& name) {
+    if (name.find('/') == std::string::npos) {
+        for (const std::string& dir : path_directories()) {
+            std::string candidate = dir + "/" + name;
+            struct stat st;
+            if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), R_OK) == 0) {
+                return candidate;
+            }
+        }
+    }
+    return name;
+}
+
+int source_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    if (!args.empty() && args[0] == "-s") {
+        const SourceCacheStats& stats = source_cache_stats();
+        std::string dir = source_cache_dir();
+        out << "cache: " << (dir.empty() ? "disabled" : dir) << '\n';
+        out << "hits: " << stats.hits << '\n';
+        out << "misses: " << stats.misses << '\n';
+        out << "stale: " << stats.stale << '\n';
+        out << "writes: " << stats.writes << '\n';
+        out << "uncacheable: " << stats.uncacheable << '\n';
+        return 0;
+    }
+    if (args.empty()) {
+        err << "source: filename argument required" << '\n';
+        return 2;
+    }
+    
+    CompiledScript script;
+    std::string error;
+    if (!compile_script(find_source_file(args[0]), script, error)) {
+        err << "source: " << args[0] << ": " << error << '\n';
+        return 1;
+    }
+    
+    out.flush();
+    err.flush();
+    last_exit_status = 0;
+    for (ASTNode* command : script.commands) {
+        if (command) {
+            execute_ast_node(command, false);
+        } else {
+            last_exit_status = 2;
+        }
+    }
+    return last_exit_status;
+}
+
+int enable_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    std::string library;
+    bool unload = false;
+    size_t i = 0;
+    for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+        if (args[i] == "-f" && i + 1 < args.size()) {
+            library = args[++i];
+        } else if (args[i] == "-d") {
+            unload = true;
+        } else if (args[i] == "-a" || args[i] == "-p") {
+            continue;
+        } else {
+            err << "enable: usage: enable [-f file] [-d] [name ...]" << '\n';
+            return 2;
+        }
+    }
+    
+    if (i == args.size()) {
+        for (const auto& entry : builtins) {
+            out << "enable " << entry.first << '\n';
+        }
+        return 0;
+    }
+    
+    int status = 0;
+    for (; i < args.size(); i++) {
+        const std::string& name = args[i];
+        std::string error;
+        bool ok = true;
+        if (!library.empty()) {
+            ok = load_builtin(library, name, error);
+        } else if (unload) {
+            ok = unload_builtin(name, error);
+        } else if (!is_builtin(name)) {
+            error = name + ": not a shell builtin";
+            ok = false;
+        }
+        if (!ok) {
+            err << "enable: " << error << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+int timeout_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err) {
+    TimeoutOptions options;
+    if (!parse_timeout_options(args, options)) {
+        err << "timeout: usage: timeout [-s signal] [-k duration] duration command [args]" << '\n';
+        return 125;
+    }
+    return run_timeout(options, in, out, err);
+}
+
+struct WaitTarget {
+    std::string text;
+    int job_id;                    // %N, or -1
+    pid_t pid;                     // a pid, or -1
+};
+
+// Jobs keep the pids of members already reaped, so `wait $!` still finds
+// a pipeline whose last stage has exited.
+static Job* find_job_with_member(pid_t pid) {
+    for (auto& entry : jobs) {
+        const std::vector<pid_t>& members = entry.second.members;
+        if (std::find(members.begin(), members.end(), pid) != members.end()) return &entry.second;
+    }
+    return nullptr;
+}
+
+static Job* find_wait_target(const WaitTarget& target) {
+    return target.job_id != -1 ? find_job(target.job_id) : find_job_with_member(target.pid);
+}
+
+// Waits for background jobs, each until it finishes or stops. With
+// stop_at_first, returns after the first job to finish and sets finished_id.
+// Returns false if Ctrl-C interrupted the wait.
+static bool wait_for_background(const std::vector<int>& job_ids, bool stop_at_first, int& finished_id) {
+    ChildWaiter waiter(true);
+    for (int job_id : job_ids) {
+        Job* job = find_job(job_id);
+        if (!job || job->stopped) continue;
+        for (pid_t pid : job->pids) {
+            waiter.add(pid);
+        }
+    }
+    
+    while (waiter.size() > 0) {
+        pid_t pid;
+        int status;
+        if (waiter.next(pid, status, WaitClock::time_point::max(), true) == WaitEvent::INTERRUPT) return false;
+        
+        Job* job = find_job_by_pid(pid);
+        update_job_status(pid, status);
+        if (stop_at_first && job && job->pids.empty()) {
+            finished_id = job->job_id;
+            return true;
+        }
+    }
+    return true;
+}
+
+int wait_command(const std::vector<std::string>& args, int, OutputSink&, OutputSink& err) {
+    bool any = false;
+    size_t i = 0;
+    if (i < args.size() && args[i] == "-n") {
+        any = true;
+        i++;
+    }
+    if (i < args.size() && args[i] == "--") i++;
+    
+    std::vector<WaitTarget> targets;
+    for (; i < args.size(); i++) {
+        const std::string& text = args[i];
+        bool job_spec = !text.empty() && text[0] == '%';
+        const char* digits = text.c_str() + (job_spec ? 1 : 0);
+        char* end;
+        long number = std::strtol(digits, &end, 10);
+        if (end == digits || *end != '\0' || number <= 0) {
+            err << "wait: `" << text << "': not a pid or valid job spec" << '\n';
+            return 1;
+        }
+        targets.push_back({text, job_spec ? static_cast<int>(number) : -1,
+                           job_spec ? -1 : static_cast<pid_t>(number)});
+    }
+    
+    // Whatever has already finished gets its status saved first.
+    service_child_signals();
+    
+    std::vector<int> job_ids;
+    if (targets.empty()) {
+        for (const Job* job : sorted_jobs()) {
+            if (job->background) job_ids.push_back(job->job_id);
+        }
+    }
+    
+    if (!any && targets.empty()) {
+        int finished_id;
+        if (!wait_for_background(job_ids, false, finished_id)) return 128 + SIGINT;
+        forget_finished_jobs();
+        return 0;
+    }
+    
+    int status = 127;
+    if (any) {
+        // A job that finished before the call counts as the next one.
+        if (targets.empty() && take_finished_job(-1, -1, status)) return status;
+        for (const WaitTarget& target : targets) {
+            if (take_finished_job(target.job_id, target.pid, status)) return status;
+            if (Job* job = find_wait_target(target)) job_ids.push_back(job->job_id);
+        }
+        if (job_ids.empty()) return 127;
+        
+        int finished_id = -1;
+        if (!wait_for_background(job_ids, true, finished_id)) return 128 + SIGINT;
+        if (finished_id == -1 || !take_finished_job(finished_id, -1, status)) return 127;
+        return status;
+    }
+    
+    for (const WaitTarget& target : targets) {
+        Job* job = find_wait_target(target);
+        if (job && job->background) {
+            int finished_id;
+            if (!wait_for_background({job->job_id}, false, finished_id)) return 128 + SIGINT;
+            if (job->stopped) {
+                status = 128 + SIGTSTP;
+                continue;
+            }
+        }
+        if (!take_finished_job(target.job_id, target.pid, status)) {
+            if (target.job_id != -1) {
+                err << "wait: %" << target.job_id << ": no such job" << '\n';
+            } else {
+                err << "wait: pid " << target.pid << " is not a child of this shell" << '\n';
+            }
+            status = 127;
+        }
+    }
+    return status;
+}
+
+// Only the pipefail option exists; `set -o` and `set +o` list it.
+int set_command(const std::vector<std::string>& args, int, OutputSink& out, OutputSink& err) {
+    if (args.empty() || (args.size() == 1 && (args[0] == "-o" || args[0] == "+o"))) {
+        if (!args.empty() && args[0] == "+o") {
+            out << "set " << (option_pipefail ? '-' : '+') << "o pipefail" << '\n';
+        } else {
+            out << "pipefail       \t" << (option_pipefail ? "on" : "off") << '\n';
+        }
+        return 0;
+    }
+    
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg != "-o" && arg != "+o") {
+            err << "set: " << arg << ": invalid option" << '\n';
+            err << "set: usage: set [-o pipefail] [+o pipefail]" << '\n';
+            return 2;
+        }
+        if (i + 1 >= args.size() || args[i + 1] != "pipefail") {
+            err << "set: " << (i + 1 < args.size() ? args[i + 1] : arg) << ": invalid option name" << '\n';
+            return 2;
+        }
+        option_pipefail = arg == "-o";
+        i++;
     }
-    if (stdout_fd != -1) close(stdout_fd);
-    if (stderr_fd != -1) close(stderr_fd);
+    return 0;
 }
@@ -4,27 +4,58 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unistd.h>
 #include "parser.h"
+#include "output.h"
 
-typedef void (*builtin_func)(const std::vector<std::string>&);
+// Null for builtins loaded with `enable -f`; run_builtin() dispatches those.
+// out and err are buffered separately and may share a destination, so a
+// builtin that writes to err after out must flush out first (and err after).
+typedef int (*builtin_func)(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
 
 extern std::map<std::string, builtin_func> builtins;
 
 void init_builtins();
 bool is_builtin(const std::string& cmd);
-void execute_builtin(const std::string& command, const std::vector<std::string>& args,
-                     const RedirectionConfig& redir);
+bool should_run_as_builtin(const std::string& cmd, const std::vector<std::string>& args);
+bool is_side_effect_free_builtin(const std::string& cmd, const std::vector<std::string>& args);
+bool builtin_reads_stdin(const std::string& cmd, const std::vector<std::string>& args);
+int execute_builtin(const std::string& command, const std::vector<std::string>& args,
+                    const RedirectionConfig& redir, int in_fd = STDIN_FILENO,
+                    int out_fd = STDOUT_FILENO);
+int run_builtin(const std::string& command, const std::vector<std::string>& args, int in,
+                OutputSink& out, OutputSink& err);
 
 // Individual builtin functions
-void exit_command(const std::vector<std::string>& args);
-void echo_command(const std::vector<std::string>& args);
-void type_command(const std::vector<std::string>& args);
-void pwd_command(const std::vector<std::string>& args);
-void cd_command(const std::vector<std::string>& args);
-void history_command(const std::vector<std::string>& args);
-void fg_command(const std::vector<std::string>& args);
-void bg_command(const std::vector<std::string>& args);
-void jobs_command(const std::vector<std::string>& args);
-void help_command(const std::vector<std::string>& args);
+int exit_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int echo_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int type_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int pwd_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int cd_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int history_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int fg_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int bg_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int jobs_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int hash_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int help_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int cat_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int wc_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int grep_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int tee_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int parallel_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int export_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int readonly_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int unset_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int source_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int true_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int false_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int break_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int continue_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int test_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int bracket_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int enable_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int timeout_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int wait_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
+int set_command(const std::vector<std::string>& args, int in, OutputSink& out, OutputSink& err);
 
 #endif // BUILTINS_H
@@ -0,0 +1,367 @@
+#include "bytecode.h"
+#include "executor.h"
+#include "shell.h"
+#include "trace.h"
+#include "variables.h"
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <fnmatch.h>
+#include <signal.h>
+
+bool is_compound(const ASTNode* node) {
+    switch (node->type) {
+        case NodeType::SEQUENCE:
+        case NodeType::AND:
+        case NodeType::OR:
+        case NodeType::NOT:
+        case NodeType::IF:
+        case NodeType::WHILE:
+        case NodeType::UNTIL:
+        case NodeType::FOR:
+        case NodeType::CASE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Frames live on a stack while the program runs: one per active loop (the
+// words left to iterate and the status of the last body) and one per active
+// case (its word). The compiler tracks the depth so that break and continue
+// know how many frames to drop.
+class Compiler {
+public:
+    explicit Compiler(Program& program) : code_(program.code) {}
+    
+    void compile(ASTNode* node);
+
+private:
+    struct Loop {
+        uint32_t depth;                // frames inside the loop, its own included
+        uint32_t next;                 // where continue goes
+        std::vector<size_t> breaks;    // jumps to patch to the end of the loop
+    };
+    
+    size_t emit(OpCode op, uint32_t arg = 0, ASTNode* node = nullptr) {
+        code_.push_back({op, arg, node});
+        return code_.size() - 1;
+    }
+    
+    uint32_t here() const { return static_cast<uint32_t>(code_.size()); }
+    void patch(size_t at) { code_[at].arg = here(); }
+    
+    void compile_loop(ASTNode* node);
+    void compile_for(ASTNode* node);
+    void compile_case(ASTNode* node);
+    bool compile_break(ASTNode* node);
+    
+    std::vector<Instruction>& code_;
+    std::vector<Loop> loops_;
+    uint32_t depth_ = 0;
+};
+
+void Compiler::compile(ASTNode* node) {
+    switch (node->type) {
+        case NodeType::SEQUENCE:
+            for (ASTNode* child : node->children) {
+                compile(child);
+            }
+            break;
+        
+        case NodeType::AND:
+        case NodeType::OR: {
+            compile(node->children[0]);
+            size_t skip = emit(node->type == NodeType::AND ? OpCode::JUMP_IF_FAILED : OpCode::JUMP_IF_OK);
+            compile(node->children[1]);
+            patch(skip);
+            break;
+        }
+        
+        case NodeType::NOT:
+            compile(node->children[0]);
+            emit(OpCode::NOT);
+            break;
+        
+        case NodeType::IF: {
+            // The status is that of the branch taken, or 0 if none is.
+            std::vector<size_t> ends;
+            size_t i = 0;
+            for (; i + 1 < node->children.size; i += 2) {
+                compile(node->children[i]);
+                size_t next = emit(OpCode::JUMP_IF_FAILED);
+                compile(node->children[i + 1]);
+                ends.push_back(emit(OpCode::JUMP));
+                patch(next);
+            }
+            if (i < node->children.size) {
+                compile(node->children[i]);
+            } else {
+                emit(OpCode::SET_STATUS, 0);
+            }
+            for (size_t end : ends) {
+                patch(end);
+            }
+            break;
+        }
+        
+        case NodeType::WHILE:
+        case NodeType::UNTIL:
+            compile_loop(node);
+            break;
+        
+        case NodeType::FOR:
+            compile_for(node);
+            break;
+        
+        case NodeType::CASE:
+            compile_case(node);
+            break;
+        
+        default:
+            if (!compile_break(node)) {
+                emit(OpCode::RUN, 0, node);
+            }
+            break;
+    }
+}
+
+void Compiler::compile_loop(ASTNode* node) {
+    emit(OpCode::LOOP_BEGIN);
+    depth_++;
+    uint32_t top = here();
+    loops_.push_back({depth_, top, {}});
+    
+    compile(node->children[0]);
+    size_t exit = emit(node->type == NodeType::WHILE ? OpCode::JUMP_IF_FAILED : OpCode::JUMP_IF_OK);
+    compile(node->children[1]);
+    emit(OpCode::SAVE_STATUS);
+    emit(OpCode::JUMP, top);
+    patch(exit);
+    emit(OpCode::LOOP_END);
+    depth_--;
+    
+    for (size_t jump : loops_.back().breaks) {
+        patch(jump);
+    }
+    loops_.pop_back();
+}
+
+void Compiler::compile_for(ASTNode* node) {
+    emit(OpCode::FOR_BEGIN, 0, node);
+    depth_++;
+    size_t next = emit(OpCode::FOR_NEXT, 0, node);
+    loops_.push_back({depth_, static_cast<uint32_t>(next), {}});
+    
+    compile(node->children[0]);
+    emit(OpCode::SAVE_STATUS);
+    emit(OpCode::JUMP, static_cast<uint32_t>(next));
+    patch(next);
+    emit(OpCode::LOOP_END);
+    depth_--;
+    
+    for (size_t jump : loops_.back().breaks) {
+        patch(jump);
+    }
+    loops_.pop_back();
+}
+
+// The status is that of the body run, or 0 if no pattern matches.
+void Compiler::compile_case(ASTNode* node) {
+    emit(OpCode::CASE_BEGIN, 0, node);
+    depth_++;
+    
+    std::vector<size_t> ends;
+    for (ASTNode* item : node->children) {
+        size_t next = emit(OpCode::CASE_MATCH, 0, item);
+        if (!item->children.empty()) {
+            compile(item->children[0]);
+        } else {
+            emit(OpCode::SET_STATUS, 0);
+        }
+        ends.push_back(emit(OpCode::JUMP));
+        patch(next);
+    }
+    emit(OpCode::SET_STATUS, 0);
+    for (size_t end : ends) {
+        patch(end);
+    }
+    
+    emit(OpCode::POP, 1);
+    depth_--;
+}
+
+// `break [n]` and `continue [n]` with a literal count become jumps out of
+// the enclosing loops; redirections and assignments on them are ignored, as
+// they have nothing to act on. Anywhere else they run as builtins, which
+// complain.
+bool Compiler::compile_break(ASTNode* node) {
+    if (node->type != NodeType::COMMAND || loops_.empty() || node->words.empty() || node->words.size > 2) {
+        return false;
+    }
+    
+    const Word& name = node->words[0];
+    bool is_break = name.text == "break";
+    if (name.needs_expansion || (!is_break && name.text != "continue")) return false;
+    
+    size_t count = 1;
+    if (node->words.size == 2) {
+        const Word& arg = node->words[1];
+        if (arg.needs_expansion || arg.text.empty() || arg.text.size() > 9 ||
+            arg.text.find_first_not_of("0123456789") != std::string_view::npos) {
+            return false;
+        }
+        count = std::stoul(std::string(arg.text));
+        if (count == 0) return false;
+    }
+    
+    Loop& loop = loops_[loops_.size() - std::min(count, loops_.size())];
+    uint32_t frames = depth_ - loop.depth + (is_break ? 1 : 0);
+    if (frames > 0) emit(OpCode::POP, frames);
+    emit(OpCode::SET_STATUS, 0);
+    size_t jump = emit(OpCode::JUMP, loop.next);
+    if (is_break) loop.breaks.push_back(jump);
+    return true;
+}
+
+Program compile_program(ASTNode* root) {
+    Program program;
+    Compiler compiler(program);
+    compiler.compile(root);
+    return program;
+}
+
+namespace {
+
+struct Frame {
+    std::vector<std::string> words;
+    size_t next = 0;
+    int status = 0;
+};
+
+}
+
+void run_program(const Program& program) {
+    TraceSpan span("program");
+    // Frames are reused across iterations of outer loops, keeping the
+    // capacity of their word vectors.
+    std::vector<Frame> frames;
+    size_t depth = 0;
+    auto push_frame = [&]() -> Frame& {
+        if (depth == frames.size()) frames.emplace_back();
+        Frame& frame = frames[depth++];
+        frame.words.clear();
+        frame.next = 0;
+        frame.status = 0;
+        return frame;
+    };
+    
+    const Instruction* code = program.code.data();
+    size_t end = program.code.size();
+    size_t pc = 0;
+    
+    while (pc < end) {
+        const Instruction& instruction = code[pc++];
+        
+        switch (instruction.op) {
+            case OpCode::RUN:
+                execute_ast_node(instruction.node, false);
+                // A command killed by Ctrl-C stops the whole program, as in bash.
+                if (last_exit_status == 128 + SIGINT && shell_is_interactive) return;
+                break;
+            
+            case OpCode::JUMP:
+                // Ctrl-C ends loops at their back-edge; forward jumps in
+                // if, case, && and || carry on.
+                if (instruction.arg < pc && interrupt_pending) {
+                    last_exit_status = 128 + SIGINT;
+                    return;
+                }
+                pc = instruction.arg;
+                break;
+            
+            case OpCode::JUMP_IF_OK:
+                if (last_exit_status == 0) pc = instruction.arg;
+                break;
+            
+            case OpCode::JUMP_IF_FAILED:
+                if (last_exit_status != 0) pc = instruction.arg;
+                break;
+            
+            case OpCode::NOT:
+                last_exit_status = last_exit_status == 0 ? 1 : 0;
+                break;
+            
+            case OpCode::SET_STATUS:
+                last_exit_status = static_cast<int>(instruction.arg);
+                break;
+            
+            case OpCode::LOOP_BEGIN:
+                push_frame();
+                break;
+            
+            case OpCode::FOR_BEGIN: {
+                Frame& frame = push_frame();
+                const Span<Word>& words = instruction.node->words;
+                bool outer_failed = expansion_failed;
+                expansion_failed = false;
+                for (size_t i = 1; i < words.size; i++) {
+                    expand_word(words[i], frame.words);
+                }
+                if (expansion_failed) {
+                    frame.words.clear();
+                    frame.status = 1;
+                }
+                expansion_failed = outer_failed;
+                break;
+            }
+            
+            case OpCode::FOR_NEXT: {
+                Frame& frame = frames[depth - 1];
+                if (frame.next == frame.words.size()) {
+                    pc = instruction.arg;
+                    break;
+                }
+                std::string name(instruction.node->words[0].text);
+                if (!set_variable(name, frame.words[frame.next++])) {
+                    std::cerr << name << ": readonly variable" << std::endl;
+                    frame.status = 1;
+                    pc = instruction.arg;
+                }
+                break;
+            }
+            
+            case OpCode::SAVE_STATUS:
+                frames[depth - 1].status = last_exit_status;
+                break;
+            
+            case OpCode::LOOP_END:
+                last_exit_status = frames[--depth].status;
+                break;
+            
+            case OpCode::CASE_BEGIN: {
+                Frame& frame = push_frame();
+                expand_word(instruction.node->words[0], frame.words, false);
+                if (frame.words.empty()) frame.words.emplace_back();
+                break;
+            }
+            
+            case OpCode::CASE_MATCH: {
+                const std::string& subject = frames[depth - 1].words[0];
+                bool matched = false;
+                for (const Word& pattern : instruction.node->words) {
+                    if (fnmatch(expand_pattern(pattern).c_str(), subject.c_str(), 0) == 0) {
+                        matched = true;
+                        break;
+                    }
+                }
+                if (!matched) pc = instruction.arg;
+                break;
+            }
+            
+            case OpCode::POP:
+                depth -= instruction.arg;
+                break;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "parser.h"
+#include <cstdint>
+#include <vector>
+
+// Lists, && and ||, if, loops and case compiled to a flat program, so that a
+// loop costs a few jumps per iteration instead of a walk over its tree.
+// Commands, pipelines and subshells stay AST nodes run by the executor.
+enum class OpCode : uint8_t {
+    RUN,                           // execute `node`
+    JUMP,                          // continue at `arg`
+    JUMP_IF_OK,                    // ... if the last status is 0
+    JUMP_IF_FAILED,                // ... if it is not
+    NOT,                           // invert the last status
+    SET_STATUS,                    // last status = `arg`
+    LOOP_BEGIN,                    // push a frame for a while/until loop
+    FOR_BEGIN,                     // push a frame holding the expanded words of for `node`
+    FOR_NEXT,                      // assign the next word to the loop variable, or jump to `arg`
+    SAVE_STATUS,                   // record the status of the loop body in the top frame
+    LOOP_END,                      // pop the loop frame, leaving the status of the last body
+    CASE_BEGIN,                    // push a frame holding the expanded word of case `node`
+    CASE_MATCH,                    // jump to `arg` unless a pattern of CASE_ITEM `node` matches
+    POP                            // drop `arg` frames (leaving a case, or break and continue)
+};
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg;
+    ASTNode* node;
+};
+
+struct Program {
+    std::vector<Instruction> code;
+};
+
+bool is_compound(const ASTNode* node);
+Program compile_program(ASTNode* root);
+void run_program(const Program& program);
+
+#endif // BYTECODE_H
@@ -0,0 +1,149 @@
+#include "child_wait.h"
+#include "job_control.h"
+#include "shell.h"
+#include "timing.h"
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+// Wake-up interval when neither pidfds nor the SIGCHLD signalfd exist.
+static const int fallback_poll_ms = 10;
+
+static bool pidfd_unsupported = false;
+
+static int open_pidfd(pid_t pid) {
+    if (pidfd_unsupported) return -1;
+    int fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (fd == -1 && errno == ENOSYS) pidfd_unsupported = true;
+    return fd;
+}
+
+ChildWaiter::ChildWaiter(bool report_stops) : report_stops_(report_stops), epoll_fd_(-1) {}
+
+ChildWaiter::~ChildWaiter() {
+    for (const Child& child : children_) {
+        if (child.pidfd != -1) close(child.pidfd);
+    }
+    if (epoll_fd_ != -1) close(epoll_fd_);
+}
+
+// The pidfd is opened on the first wait that needs epoll, so the common
+// single-child wait costs no extra syscalls.
+void ChildWaiter::add(pid_t pid) {
+    children_.push_back({pid, -1});
+}
+
+void ChildWaiter::forget(size_t index) {
+    if (children_[index].pidfd != -1) close(children_[index].pidfd);
+    children_.erase(children_.begin() + index);
+}
+
+bool ChildWaiter::reap_ready(pid_t& pid, int& status) {
+    int options = WNOHANG | (report_stops_ ? WUNTRACED : 0);
+    for (size_t i = 0; i < children_.size(); i++) {
+        pid_t result = wait_child(children_[i].pid, &status, options);
+        if (result == 0) continue;
+        if (result == -1 && errno != ECHILD) continue;
+        
+        // ECHILD: reaped elsewhere, e.g. by a `parallel` collecting any child.
+        if (result == -1) status = 0;
+        pid = children_[i].pid;
+        forget(i);
+        return true;
+    }
+    return false;
+}
+
+WaitEvent ChildWaiter::next(pid_t& pid, int& status, WaitClock::time_point deadline, bool interruptible) {
+    if (children_.size() == 1 && deadline == WaitClock::time_point::max() && !interruptible) {
+        int options = report_stops_ ? WUNTRACED : 0;
+        pid_t result;
+        while ((result = wait_child(children_[0].pid, &status, options)) == -1 && errno == EINTR) {
+        }
+        if (result == -1) status = 0;
+        pid = children_[0].pid;
+        forget(0);
+        return WaitEvent::CHILD;
+    }
+    
+    if (epoll_fd_ == -1) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ != -1 && child_signal_fd() != -1) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = child_signal_fd();
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, child_signal_fd(), &event);
+        }
+    }
+    bool all_watched = epoll_fd_ != -1;
+    for (Child& child : children_) {
+        if (child.pidfd == -1 && epoll_fd_ != -1) {
+            child.pidfd = open_pidfd(child.pid);
+            if (child.pidfd != -1) {
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.fd = child.pidfd;
+                epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, child.pidfd, &event);
+            }
+        }
+        if (child.pidfd == -1) all_watched = false;
+    }
+    // Stops are only announced by SIGCHLD, exits by pidfds or SIGCHLD.
+    bool signal_watched = epoll_fd_ != -1 && child_signal_fd() != -1;
+    bool need_polling = !signal_watched && (report_stops_ || !all_watched);
+    
+    for (;;) {
+        if (reap_ready(pid, status)) return WaitEvent::CHILD;
+        if (children_.empty()) {
+            status = 0;
+            pid = -1;
+            return WaitEvent::CHILD;
+        }
+        if (interruptible && interrupt_pending) return WaitEvent::INTERRUPT;
+        
+        int timeout_ms = -1;
+        if (deadline != WaitClock::time_point::max()) {
+            auto remaining = deadline - WaitClock::now();
+            if (remaining <= WaitClock::duration::zero()) return WaitEvent::TIMEOUT;
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+            timeout_ms = static_cast<int>(std::min<long long>(ms, 1 << 30));
+        }
+        if (need_polling && (timeout_ms == -1 || timeout_ms > fallback_poll_ms)) {
+            timeout_ms = fallback_poll_ms;
+        }
+        
+        if (epoll_fd_ == -1) {
+            usleep(timeout_ms * 1000);
+            continue;
+        }
+        epoll_event events[8];
+        int n = epoll_wait(epoll_fd_, events, 8, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd != child_signal_fd()) continue;
+            // Background jobs sharing this SIGCHLD are still collected by
+            // service_child_signals(), which polls every child.
+            signalfd_siginfo info;
+            while (read(child_signal_fd(), &info, sizeof(info)) == sizeof(info)) {
+            }
+        }
+    }
+}
+
+int pipeline_status(const std::vector<int>& statuses) {
+    if (statuses.empty()) return 0;
+    if (option_pipefail) {
+        for (auto it = statuses.rbegin(); it != statuses.rend(); ++it) {
+            if (*it != 0) return *it;
+        }
+        return 0;
+    }
+    return statuses.back();
+}
@@ -0,0 +1,55 @@
+#ifndef CHILD_WAIT_H
+#define CHILD_WAIT_H
+
+#include <chrono>
+#include <sys/types.h>
+#include <vector>
+
+using WaitClock = std::chrono::steady_clock;
+
+enum class WaitEvent {
+    CHILD,                         // a watched child exited (or stopped)
+    TIMEOUT,                       // the deadline passed
+    INTERRUPT                      // Ctrl-C reached the shell
+};
+
+// Waits on many children at once: each gets a pidfd in one epoll set, next
+// to the SIGCHLD signalfd, which reports stops. Children are reaped through
+// wait_child(), so `time` still sees their resource usage. Without pidfds
+// (kernels before 5.3) the signalfd alone wakes the loop.
+class ChildWaiter {
+public:
+    explicit ChildWaiter(bool report_stops);
+    ~ChildWaiter();
+    
+    ChildWaiter(const ChildWaiter&) = delete;
+    ChildWaiter& operator=(const ChildWaiter&) = delete;
+    
+    void add(pid_t pid);
+    size_t size() const { return children_.size(); }
+    
+    // Blocks until a watched child exits or, with report_stops, stops; the
+    // child reported is no longer watched. Returns TIMEOUT at the deadline
+    // and INTERRUPT on Ctrl-C when `interruptible`.
+    WaitEvent next(pid_t& pid, int& status, WaitClock::time_point deadline = WaitClock::time_point::max(),
+                   bool interruptible = false);
+
+private:
+    struct Child {
+        pid_t pid;
+        int pidfd;
+    };
+    
+    bool reap_ready(pid_t& pid, int& status);
+    void forget(size_t index);
+    
+    bool report_stops_;
+    int epoll_fd_;
+    std::vector<Child> children_;
+};
+
+// Exit status of a pipeline from its per-stage statuses: the last one, or
+// with pipefail the last non-zero one.
+int pipeline_status(const std::vector<int>& statuses);
+
+#endif // CHILD_WAIT_H
@@ -0,0 +1,67 @@
+#include "command_hash.h"
+#include "utils.h"
+#include "variables.h"
+#include <cstdlib>
+#include <unistd.h>
+
+std::unordered_map<std::string, HashEntry> command_hash;
+
+// PATH value the table was filled against; any change to PATH drops every entry.
+static std::string hashed_path_env;
+
+static bool path_changed() {
+    const char* path_env = get_variable("PATH");
+    return hashed_path_env != (path_env ? path_env : "");
+}
+
+void check_path_changed() {
+    const char* path_env = get_variable("PATH");
+    if (hashed_path_env != (path_env ? path_env : "")) {
+        command_hash.clear();
+        hashed_path_env = path_env ? path_env : "";
+    }
+}
+
+std::string hash_lookup(const std::string& cmd) {
+    if (cmd.find('/') != std::string::npos) {
+        return access(cmd.c_str(), X_OK) == 0 ? cmd : "";
+    }
+    
+    check_path_changed();
+    
+    auto it = command_hash.find(cmd);
+    if (it != command_hash.end()) {
+        it->second.hits++;
+        return it->second.path;
+    }
+    
+    std::string path = find_executable_in_path(cmd);
+    if (!path.empty()) {
+        command_hash[cmd] = {path, 1};
+    }
+    return path;
+}
+
+// Read-only, so builtin pipeline stages may call it from their threads; a
+// table filled against another PATH is treated as empty.
+bool hash_peek(const std::string& cmd, std::string& path) {
+    if (path_changed()) return false;
+    
+    auto it = command_hash.find(cmd);
+    if (it == command_hash.end()) return false;
+    path = it->second.path;
+    return true;
+}
+
+void hash_insert(const std::string& cmd, const std::string& path, int hits) {
+    check_path_changed();
+    command_hash[cmd] = {path, hits};
+}
+
+void hash_remove(const std::string& cmd) {
+    command_hash.erase(cmd);
+}
+
+void hash_clear() {
+    command_hash.clear();
+}
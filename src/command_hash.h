@@ -0,0 +1,21 @@
+#ifndef COMMAND_HASH_H
+#define COMMAND_HASH_H
+
+#include <string>
+#include <unordered_map>
+
+struct HashEntry {
+    std::string path;
+    int hits;
+};
+
+extern std::unordered_map<std::string, HashEntry> command_hash;
+
+std::string hash_lookup(const std::string& cmd);
+bool hash_peek(const std::string& cmd, std::string& path);
+void hash_insert(const std::string& cmd, const std::string& path, int hits = 0);
+void hash_remove(const std::string& cmd);
+void hash_clear();
+void check_path_changed();
+
+#endif // COMMAND_HASH_H
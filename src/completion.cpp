@@ -1,6 +1,6 @@
 #include "completion.h"
 #include "builtins.h"
-#include "utils.h"
+#include "path_index.h"
 #include <readline/readline.h>
 #include <algorithm>
 #include <cstring>
@@ -15,18 +15,12 @@ char* command_generator(const char* text, int state) {
         
         std::string prefix(text);
         
-        for (const auto& builtin : builtins) {
-            if (builtin.first.find(prefix) == 0) {
-                matches.push_back(builtin.first);
-            }
+        for (auto it = builtins.lower_bound(prefix);
+             it != builtins.end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it) {
+            matches.push_back(it->first);
         }
         
-        auto executables = get_all_executables();
-        for (const auto& exe : executables) {
-            if (exe.find(prefix) == 0) {
-                matches.push_back(exe);
-            }
-        }
+        find_executables_with_prefix(prefix, matches);
         
         std::sort(matches.begin(), matches.end());
     }
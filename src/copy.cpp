@@ -0,0 +1,328 @@
+#include "copy.h"
+#include "shell.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+
+static const size_t COPY_CHUNK = 1 << 30;
+static const size_t SPLICE_CHUNK = 1 << 20;
+static const size_t BUFFER_SIZE = 128 * 1024;
+
+// Ctrl-C reached the shell: loops give up with EINTR between chunks, even on
+// worker threads, which never see the signal themselves.
+static bool cancelled() {
+    if (!interrupt_pending) return false;
+    errno = EINTR;
+    return true;
+}
+
+// Errors that mean "this mechanism does not apply to these fds", as opposed
+// to a real I/O failure.
+static bool unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+           err == EOPNOTSUPP || err == ESPIPE || err == ETXTBSY;
+}
+
+// Each mover returns bytes copied, or -1 with errno set. `fallback` is set
+// when the very first call reported the mechanism as unsupported.
+template <typename Step>
+static ssize_t run_mover(Step step, bool& fallback) {
+    ssize_t total = 0;
+    fallback = false;
+    
+    while (true) {
+        if (cancelled()) return -1;
+        ssize_t n = step();
+        if (n > 0) {
+            total += n;
+        } else if (n == 0) {
+            return total;
+        } else if (errno == EINTR) {
+            continue;
+        } else {
+            fallback = total == 0 && unsupported(errno);
+            return -1;
+        }
+    }
+}
+
+static ssize_t copy_read_write(int in_fd, int out_fd) {
+    std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+    ssize_t total = 0;
+    
+    while (true) {
+        if (cancelled()) return -1;
+        ssize_t n = read(in_fd, buffer.get(), BUFFER_SIZE);
+        if (n == 0) return total;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = write(out_fd, buffer.get() + written, n - written);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            written += w;
+        }
+        total += n;
+    }
+}
+
+ssize_t copy_fd(int in_fd, int out_fd, CopyMethod* used) {
+    struct stat in_st, out_st;
+    if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) {
+        return -1;
+    }
+    
+    bool in_file = S_ISREG(in_st.st_mode);
+    bool in_pipe = S_ISFIFO(in_st.st_mode);
+    bool out_file = S_ISREG(out_st.st_mode);
+    bool out_pipe = S_ISFIFO(out_st.st_mode);
+    bool out_append = (fcntl(out_fd, F_GETFL) & O_APPEND) != 0;
+    bool fallback = true;
+    ssize_t n;
+    
+    // file -> file: reflink or in-kernel copy, no data through userspace.
+    if (in_file && out_file && !out_append) {
+        if (used) *used = CopyMethod::COPY_FILE_RANGE;
+        n = run_mover([&] { return copy_file_range(in_fd, nullptr, out_fd, nullptr, COPY_CHUNK, 0); },
+                      fallback);
+        if (!fallback) return n;
+    }
+    
+    // Anything to or from a pipe: move page references instead of bytes.
+    if (in_pipe || out_pipe) {
+        if (used) *used = CopyMethod::SPLICE;
+        n = run_mover([&] {
+            return splice(in_fd, nullptr, out_fd, nullptr, SPLICE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        }, fallback);
+        if (!fallback) return n;
+    }
+    
+    // Regular file to anything else (tty, socket, appended file).
+    if (in_file) {
+        if (used) *used = CopyMethod::SENDFILE;
+        n = run_mover([&] { return sendfile(out_fd, in_fd, nullptr, COPY_CHUNK); }, fallback);
+        if (!fallback) return n;
+    }
+    
+    if (used) *used = CopyMethod::READ_WRITE;
+    return copy_read_write(in_fd, out_fd);
+}
+
+ssize_t copy_fd_to_sink(int in_fd, OutputSink& out) {
+    if (out.fd() != -1) {
+        out.flush();
+        return copy_fd(in_fd, out.fd());
+    }
+    
+    std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+    ssize_t total = 0;
+    
+    while (true) {
+        if (cancelled()) return -1;
+        ssize_t n = read(in_fd, buffer.get(), BUFFER_SIZE);
+        if (n == 0) return total;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        out.write(buffer.get(), n);
+        total += n;
+    }
+}
+
+struct TeeOutput {
+    int fd;
+    bool splice;                   // cleared when the fd refuses a splice
+    bool spliced;                  // a splice has succeeded, so errors are real
+    int error;
+};
+
+static int write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Moves exactly `size` bytes out of the pipe `from` into the output. Once
+// the output has failed the bytes are still drained, so every output stays
+// at the same position in the stream.
+static void deliver(int from, size_t size, TeeOutput& output, char* buffer) {
+    while (size > 0 && output.splice && output.error == 0) {
+        ssize_t n = splice(from, nullptr, output.fd, nullptr, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n > 0) {
+            output.spliced = true;
+            size -= n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && !output.spliced && unsupported(errno)) {
+            output.splice = false;
+        } else {
+            output.error = n < 0 ? errno : EIO;
+        }
+    }
+    
+    while (size > 0) {
+        ssize_t n = read(from, buffer, std::min(size, BUFFER_SIZE));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        size -= n;
+        if (output.error == 0) output.error = write_all(output.fd, buffer, n);
+    }
+}
+
+// The last output takes the pages from in_fd itself; each other output gets
+// a tee(2) copy in an empty scratch pipe as large as in_fd, which therefore
+// always holds the whole copy. outputs.back() is the required one (stdout).
+static ssize_t tee_pipe(int in_fd, std::vector<TeeOutput>& outputs, bool& fallback) {
+    fallback = true;
+    int size = fcntl(in_fd, F_GETPIPE_SZ);
+    int scratch[2];
+    if (size <= 0 || pipe2(scratch, O_CLOEXEC) == -1) return -1;
+    if (fcntl(scratch[1], F_SETPIPE_SZ, size) < size) {
+        close(scratch[0]);
+        close(scratch[1]);
+        return -1;
+    }
+    
+    std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+    TeeOutput& required = outputs.back();
+    ssize_t total = 0;
+    int error = 0;
+    
+    while (required.error == 0) {
+        if (cancelled()) {
+            error = EINTR;
+            break;
+        }
+        std::vector<TeeOutput*> live;
+        for (TeeOutput& output : outputs) {
+            if (output.error == 0) live.push_back(&output);
+        }
+        
+        size_t n;
+        if (live.size() > 1) {
+            ssize_t copied = tee(in_fd, scratch[1], size, 0);
+            if (copied < 0 && errno == EINTR) continue;
+            if (copied < 0) {
+                error = errno;
+                break;
+            }
+            if (copied == 0) break;
+            fallback = false;
+            n = copied;
+            
+            deliver(scratch[0], n, *live[0], buffer.get());
+            for (size_t i = 1; i + 1 < live.size() && error == 0; i++) {
+                while ((copied = tee(in_fd, scratch[1], n, 0)) < 0 && errno == EINTR) {
+                }
+                if (copied != static_cast<ssize_t>(n)) {
+                    error = copied < 0 ? errno : EIO;
+                } else {
+                    deliver(scratch[0], n, *live[i], buffer.get());
+                }
+            }
+            if (error != 0) break;
+        } else {
+            // Nothing left to duplicate: wait for data and take what is there.
+            struct pollfd ready = {in_fd, POLLIN, 0};
+            int available = 0;
+            if (poll(&ready, 1, -1) < 0 || ioctl(in_fd, FIONREAD, &available) < 0) {
+                if (errno == EINTR) continue;
+                error = errno;
+                break;
+            }
+            if (available == 0) {
+                if (ready.revents & (POLLHUP | POLLERR)) break;
+                continue;
+            }
+            fallback = false;
+            n = available;
+        }
+        
+        deliver(in_fd, n, *live.back(), buffer.get());
+        total += n;
+    }
+    
+    close(scratch[0]);
+    close(scratch[1]);
+    if (error == 0) error = required.error;
+    if (error != 0) {
+        fallback = fallback && unsupported(error);
+        errno = error;
+        return -1;
+    }
+    return total;
+}
+
+ssize_t tee_fd_to_sink(int in_fd, OutputSink& out, const std::vector<int>& file_fds,
+                       std::vector<int>& file_errors, CopyMethod* used) {
+    std::vector<TeeOutput> outputs;
+    for (int fd : file_fds) {
+        bool append = (fcntl(fd, F_GETFL) & O_APPEND) != 0;
+        outputs.push_back({fd, !append, false, 0});
+    }
+    
+    struct stat in_st;
+    bool in_pipe = fstat(in_fd, &in_st) == 0 && S_ISFIFO(in_st.st_mode);
+    ssize_t total = -1;
+    bool fallback = true;
+    if (in_pipe && out.fd() != -1) {
+        out.flush();
+        outputs.push_back({out.fd(), true, false, 0});
+        if (used) *used = CopyMethod::TEE;
+        total = tee_pipe(in_fd, outputs, fallback);
+        outputs.pop_back();
+    }
+    
+    if (fallback) {
+        if (used) *used = CopyMethod::READ_WRITE;
+        std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+        total = 0;
+        while (true) {
+            if (cancelled()) {
+                total = -1;
+                break;
+            }
+            ssize_t n = read(in_fd, buffer.get(), BUFFER_SIZE);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                total = -1;
+                break;
+            }
+            for (TeeOutput& output : outputs) {
+                if (output.error == 0) output.error = write_all(output.fd, buffer.get(), n);
+            }
+            out.write(buffer.get(), n);
+            if (out.fd() != -1 && !out.flush()) {
+                total = -1;
+                break;
+            }
+            total += n;
+        }
+    }
+    
+    file_errors.clear();
+    for (const TeeOutput& output : outputs) {
+        file_errors.push_back(output.error);
+    }
+    return total;
+}
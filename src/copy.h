@@ -0,0 +1,32 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include "output.h"
+#include <sys/types.h>
+#include <vector>
+
+enum class CopyMethod {
+    COPY_FILE_RANGE,
+    SPLICE,
+    TEE,
+    SENDFILE,
+    READ_WRITE
+};
+
+// Copies everything from in_fd to out_fd using the cheapest mechanism the
+// pair of descriptors allows. Returns the number of bytes copied, or -1
+// with errno set.
+ssize_t copy_fd(int in_fd, int out_fd, CopyMethod* used = nullptr);
+ssize_t copy_fd_to_sink(int in_fd, OutputSink& out);
+
+// Copies in_fd to out and to every file in file_fds, like tee(1). From a
+// pipe, tee(2) duplicates the pages for all but the last output and splice
+// moves them on, so no data passes through userspace; other inputs, and
+// outputs that refuse a splice (O_APPEND files, terminals), go through a
+// buffer. A file that fails is dropped with its errno in file_errors.
+// Returns the bytes read, or -1 with errno set when reading or writing to
+// `out` fails.
+ssize_t tee_fd_to_sink(int in_fd, OutputSink& out, const std::vector<int>& file_fds,
+                       std::vector<int>& file_errors, CopyMethod* used = nullptr);
+
+#endif // COPY_H
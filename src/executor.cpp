@@ -4,113 +4,230 @@
 #include "job_control.h"
 #include "shell.h"
 #include "utils.h"
+#include "command_hash.h"
+#include "launch.h"
+#include "timing.h"
+#include "trace.h"
+#include "variables.h"
+#include "bytecode.h"
+#include "child_wait.h"
+#include "heredoc.h"
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <memory>
 
 extern pid_t shell_pgid;
 extern bool shell_is_interactive;
 
+static void build_argv(const std::string& command, const std::vector<std::string>& args,
+                       std::vector<char*>& argv) {
+    argv.reserve(args.size() + 2);
+    argv.push_back(const_cast<char*>(command.c_str()));
+    for (const auto& arg : args) {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+}
+
+struct BuiltinStage {
+    std::string command;
+    std::vector<std::string> args;
+    RedirectionConfig redir;
+    int input_fd;
+    int output_fd;
+    int status;
+    size_t index;                  // position in the pipeline
+    std::atomic<bool> finished{false};
+    bool interrupted = false;      // cut short by a member dying from Ctrl-C
+};
+
+// Shared with the thread, which may outlive the pipeline's frame when the
+// job stops and its workers are detached.
+static void run_builtin_stage(std::shared_ptr<BuiltinStage> shared) {
+    BuiltinStage& stage = *shared;
+    TraceSpan span("builtin_thread", stage.command);
+    // Signals stay with the main thread. A SIGPIPE raised by writing to a
+    // pipe whose reader has exited is left pending on this thread, so the
+    // write fails with EPIPE instead of killing the shell.
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    
+    int in_fd = stage.input_fd != -1 ? stage.input_fd : STDIN_FILENO;
+    int out_fd = stage.output_fd != -1 ? stage.output_fd : STDOUT_FILENO;
+    stage.status = execute_builtin(stage.command, stage.args, stage.redir, in_fd, out_fd);
+    
+    if (stage.input_fd != -1) {
+        close(stage.input_fd);
+    }
+    if (stage.output_fd != -1) {
+        close(stage.output_fd);
+    }
+    stage.finished = true;
+}
+
+static std::string describe_command(const std::string& command, const std::vector<std::string>& args) {
+    std::string text = command;
+    for (const auto& arg : args) {
+        text += ' ';
+        text += arg;
+    }
+    return text;
+}
+
+static int report_launch_failure(const std::string& command, const std::string& path, int err) {
+    if (err == 0) return 1;  // redirection failure, already reported
+    if (err == ENOENT) {
+        hash_remove(command);
+    }
+    std::cerr << path << ": " << strerror(err) << std::endl;
+    return err == ENOENT ? 127 : 126;
+}
+
+// Waits for a launched foreground command, keeping it as a job if it stops,
+// or announces it as a background job.
+static void finish_command(pid_t pid, pid_t pgid, const std::string& text, bool in_background) {
+    if (!in_background) {
+        int status = 0;
+        wait_child(pid, &status, WUNTRACED);
+        last_exit_status = exit_status_from_wait(status);
+        
+        if (WIFSTOPPED(status)) {
+            add_job(pgid != 0 ? pgid : pid, text, {pid}, false);
+            update_job_status(pid, status);
+        }
+        
+        if (shell_is_interactive) {
+            tcsetpgrp(STDIN_FILENO, shell_pgid);
+        }
+    } else {
+        Job& job = add_job(pgid != 0 ? pgid : pid, text, {pid}, true);
+        std::cout << "[" << job.job_id << "] " << pid << std::endl;
+        last_background_pid = pid;
+        last_exit_status = 0;
+    }
+}
+
 void execute_external(const std::string& command, const std::vector<std::string>& args, 
                       const RedirectionConfig& redir, int input_fd, int output_fd,
-                      bool in_background, pid_t pgid) {
-    std::string executable_path = find_executable_in_path(command);
+                      bool in_background, pid_t pgid, char* const* envp) {
+    LaunchSpec spec;
+    spec.path = hash_lookup(command);
     
-    if (executable_path.empty()) {
+    if (spec.path.empty()) {
         std::cout << command << ": command not found" << std::endl;
+        last_exit_status = 127;
         return;
     }
     
-    pid_t pid = fork();
+    build_argv(command, args, spec.argv);
+    spec.redir = &redir;
+    spec.envp = envp;
+    spec.input_fd = input_fd;
+    spec.output_fd = output_fd;
+    if (shell_is_interactive) {
+        spec.pgid = pgid;
+        spec.foreground = !in_background;
+    }
+    
+    int err = 0;
+    pid_t pid = launch_process(spec, err);
+    
+    if (pid < 0) {
+        last_exit_status = report_launch_failure(command, spec.path, err);
+        return;
+    }
     
+    if (shell_is_interactive) {
+        if (pgid == 0) pgid = pid;
+        setpgid(pid, pgid);
+    }
+    finish_command(pid, pgid, describe_command(command, args), in_background);
+}
+
+// A builtin that would read the terminal runs in a forked child, which can
+// take the terminal and be stopped or interrupted like any other command,
+// instead of blocking the shell.
+static bool reads_terminal(const std::string& command, const std::vector<std::string>& args,
+                           const RedirectionConfig& redir, int input_fd) {
+    return input_fd == -1 && !redir.use_heredoc && redir.stdin_file.empty() && isatty(STDIN_FILENO) &&
+           builtin_reads_stdin(command, args);
+}
+
+// Child side of a forked builtin or compound command: joins the job's
+// process group, takes the terminal for a foreground job and restores the
+// default job control signals.
+static void enter_job(pid_t pgid, bool foreground) {
+    if (shell_is_interactive) {
+        setpgid(0, pgid);
+        if (foreground) tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+    reset_child_signals();
+}
+
+static void execute_forked_builtin(const std::string& command, const std::vector<std::string>& args,
+                                   const RedirectionConfig& redir, bool in_background) {
+    TraceSpan fork_span("fork_builtin", command);
+    std::cout.flush();
+    pid_t pid = fork();
     if (pid == 0) {
-        if (shell_is_interactive) {
-            pid = getpid();
-            if (pgid == 0) pgid = pid;
-            setpgid(pid, pgid);
-            
-            if (!in_background) {
-                tcsetpgrp(STDIN_FILENO, pgid);
-            }
-            
-            signal(SIGINT, SIG_DFL);
-            signal(SIGQUIT, SIG_DFL);
-            signal(SIGTSTP, SIG_DFL);
-            signal(SIGTTIN, SIG_DFL);
-            signal(SIGTTOU, SIG_DFL);
-            signal(SIGCHLD, SIG_DFL);
-        }
-        
-        if (redir.use_heredoc && !redir.heredoc_content.empty()) {
-            int pipefd[2];
-            if (pipe(pipefd) == 0) {
-                write(pipefd[1], redir.heredoc_content.c_str(), redir.heredoc_content.length());
-                close(pipefd[1]);
-                dup2(pipefd[0], STDIN_FILENO);
-                close(pipefd[0]);
-            }
-        } else if (!redir.stdin_file.empty()) {
-            int fd = open(redir.stdin_file.c_str(), O_RDONLY);
-            if (fd != -1) {
-                dup2(fd, STDIN_FILENO);
-                close(fd);
-            }
-        } else if (input_fd != -1) {
-            dup2(input_fd, STDIN_FILENO);
-            close(input_fd);
-        }
-        
-        if (!redir.stdout_file.empty()) {
-            int flags = O_WRONLY | O_CREAT | (redir.stdout_append ? O_APPEND : O_TRUNC);
-            int fd = open(redir.stdout_file.c_str(), flags, 0644);
-            if (fd != -1) {
-                dup2(fd, STDOUT_FILENO);
-                close(fd);
-            }
-        } else if (output_fd != -1) {
-            dup2(output_fd, STDOUT_FILENO);
-            close(output_fd);
-        }
-        
-        if (!redir.stderr_file.empty()) {
-            int flags = O_WRONLY | O_CREAT | (redir.stderr_append ? O_APPEND : O_TRUNC);
-            int fd = open(redir.stderr_file.c_str(), flags, 0644);
-            if (fd != -1) {
-                dup2(fd, STDERR_FILENO);
-                close(fd);
-            }
-        }
-        
-        std::vector<char*> argv;
-        argv.push_back(const_cast<char*>(command.c_str()));
-        for (const auto& arg : args) {
-            argv.push_back(const_cast<char*>(arg.c_str()));
-        }
-        argv.push_back(nullptr);
-        
-        execv(executable_path.c_str(), argv.data());
-        std::cerr << command << ": exec failed" << std::endl;
-        std::exit(1);
-    } else if (pid > 0) {
-        if (shell_is_interactive) {
-            if (pgid == 0) pgid = pid;
-            setpgid(pid, pgid);
+        enter_job(0, !in_background);
+        std::exit(execute_builtin(command, args, redir));
+    }
+    if (pid < 0) {
+        std::cerr << command << ": " << strerror(errno) << std::endl;
+        last_exit_status = 1;
+        return;
+    }
+    fork_span.set_track(pid);
+    
+    if (shell_is_interactive) setpgid(pid, pid);
+    finish_command(pid, shell_is_interactive ? pid : 0, describe_command(command, args), in_background);
+}
+
+static const char compound_job_text[] = "{ ... }";
+
+// Runs a compound command or `( list )` in a forked copy of the shell, as a
+// pipeline stage, a background job or a subshell. Whatever it launches
+// stays in the process group the parent gave it.
+[[noreturn]] static void run_subshell(ASTNode* node) {
+    shell_is_interactive = false;
+    reset_child_signals();
+    if (node->type == NodeType::SUBSHELL) {
+        std::string command;
+        std::vector<std::string> args;
+        RedirectionConfig redir;
+        if (!expand_command(node, command, args, redir) || !redirect_standard_fds(redir)) {
+            std::exit(1);
         }
-        
-        if (!in_background) {
-            int status;
-            waitpid(pid, &status, WUNTRACED);
-            
-            if (shell_is_interactive) {
-                tcsetpgrp(STDIN_FILENO, shell_pgid);
-            }
+        node = node->children[0];
+    }
+    execute_ast_node(node, false);
+    std::exit(last_exit_status);
+}
+
+// `NAME=value` words on their own set shell variables.
+static int assign_variables(const std::vector<std::string>& assignments) {
+    int status = 0;
+    for (const std::string& assignment : assignments) {
+        size_t equals = assignment.find('=');
+        std::string name = assignment.substr(0, equals);
+        if (!set_variable(name, assignment.substr(equals + 1))) {
+            std::cerr << name << ": readonly variable" << std::endl;
+            status = 1;
         }
-    } else {
-        std::cerr << "fork failed" << std::endl;
     }
+    return status;
 }
 
 void execute_ast_node(ASTNode* node, bool in_background) {
@@ -118,26 +235,69 @@ void execute_ast_node(ASTNode* node, bool in_background) {
     
     switch (node->type) {
         case NodeType::COMMAND: {
-            if (is_builtin(node->command)) {
-                execute_builtin(node->command, node->args, node->redir);
+            std::string command;
+            std::vector<std::string> args;
+            std::vector<std::string> assignments;
+            RedirectionConfig redir;
+            last_substitution_status = -1;
+            if (!expand_command(node, command, args, redir, &assignments)) {
+                last_exit_status = 1;
+                pipe_status.assign(1, last_exit_status);
+                break;
+            }
+            if (command.empty()) {
+                // Without a command, the status is that of the last substitution.
+                int status = assign_variables(assignments);
+                last_exit_status = status == 0 && last_substitution_status != -1 ? last_substitution_status : status;
+                pipe_status.assign(1, last_exit_status);
+                break;
+            }
+            
+            bool builtin = should_run_as_builtin(command, args);
+            bool published = false;
+            if (builtin && reads_terminal(command, args, redir, -1)) {
+                execute_forked_builtin(command, args, redir, in_background);
+            } else if (builtin) {
+                TraceSpan builtin_span("builtin", command);
+                pipe_status_published = false;
+                last_exit_status = execute_builtin(command, args, redir);
+                published = pipe_status_published;
             } else {
-                execute_external(node->command, node->args, node->redir, -1, -1, in_background);
+                std::vector<char*> envp;
+                if (!assignments.empty()) build_command_environment(assignments, envp);
+                execute_external(command, args, redir, -1, -1, in_background, 0,
+                                 envp.empty() ? nullptr : envp.data());
             }
+            if (!published) pipe_status.assign(1, last_exit_status);
             break;
         }
         
         case NodeType::PIPELINE: {
-            if (node->children.size() == 1) {
-                execute_ast_node(node->children[0].get(), in_background);
+            if (node->children.size == 1) {
+                execute_ast_node(node->children[0], in_background);
                 return;
             }
             
+            TraceSpan pipeline_span("pipeline");
             std::vector<int> pipe_fds;
             std::vector<pid_t> pids;
             pid_t pgid = 0;
+            std::vector<pid_t> members(node->children.size, -1);
+            std::vector<int> statuses(node->children.size, 0);
+            std::vector<std::shared_ptr<BuiltinStage>> threaded_stages;
+            std::string job_text;
             
-            for (size_t i = 0; i < node->children.size(); i++) {
-                auto* cmd_node = node->children[i].get();
+            for (size_t i = 0; i < node->children.size; i++) {
+                ASTNode* cmd_node = node->children[i];
+                
+                std::string command;
+                std::vector<std::string> args;
+                std::vector<std::string> assignments;
+                RedirectionConfig redir;
+                bool compound = cmd_node->type != NodeType::COMMAND;
+                bool expanded = compound || expand_command(cmd_node, command, args, redir, &assignments);
+                if (i > 0) job_text += " | ";
+                job_text += compound ? compound_job_text : describe_command(command, args);
                 
                 int input_fd = -1;
                 int output_fd = -1;
@@ -146,81 +306,70 @@ void execute_ast_node(ASTNode* node, bool in_background) {
                     input_fd = pipe_fds[(i - 1) * 2];
                 }
                 
-                if (i < node->children.size() - 1) {
+                if (i < node->children.size - 1) {
                     int pipefd[2];
-                    if (pipe(pipefd) == 0) {
+                    if (pipe2(pipefd, O_CLOEXEC) == 0) {
                         pipe_fds.push_back(pipefd[0]);
                         pipe_fds.push_back(pipefd[1]);
                         output_fd = pipefd[1];
                     }
                 }
                 
-                if (!is_builtin(cmd_node->command)) {
-                    pid_t pid = fork();
+                if (!compound && (!expanded || command.empty())) {
+                    statuses[i] = expanded ? 0 : 1;
+                } else if (!compound && !should_run_as_builtin(command, args)) {
+                    LaunchSpec spec;
+                    spec.path = hash_lookup(command);
                     
-                    if (pid == 0) {
-                        if (shell_is_interactive) {
-                            pid = getpid();
-                            if (pgid == 0) pgid = pid;
-                            setpgid(pid, pgid);
-                            
-                            if (!in_background) {
-                                tcsetpgrp(STDIN_FILENO, pgid);
-                            }
-                            
-                            signal(SIGINT, SIG_DFL);
-                            signal(SIGQUIT, SIG_DFL);
-                            signal(SIGTSTP, SIG_DFL);
-                            signal(SIGTTIN, SIG_DFL);
-                            signal(SIGTTOU, SIG_DFL);
+                    if (spec.path.empty()) {
+                        std::cerr << command << ": command not found" << std::endl;
+                        statuses[i] = 127;
+                    } else {
+                        std::vector<char*> envp;
+                        if (!assignments.empty()) {
+                            build_command_environment(assignments, envp);
+                            spec.envp = envp.data();
                         }
-                        
-                        if (input_fd != -1) {
-                            dup2(input_fd, STDIN_FILENO);
-                        }
-                        if (output_fd != -1) {
-                            dup2(output_fd, STDOUT_FILENO);
+                        build_argv(command, args, spec.argv);
+                        spec.redir = &redir;
+                        spec.input_fd = input_fd;
+                        spec.output_fd = output_fd;
+                        if (shell_is_interactive) {
+                            spec.pgid = pgid;
+                            spec.foreground = !in_background;
                         }
                         
-                        for (int fd : pipe_fds) {
-                            close(fd);
-                        }
+                        int err = 0;
+                        pid_t pid = launch_process(spec, err);
                         
-                        if (!cmd_node->redir.stdout_file.empty()) {
-                            int flags = O_WRONLY | O_CREAT | (cmd_node->redir.stdout_append ? O_APPEND : O_TRUNC);
-                            int fd = open(cmd_node->redir.stdout_file.c_str(), flags, 0644);
-                            if (fd != -1) {
-                                dup2(fd, STDOUT_FILENO);
-                                close(fd);
+                        if (pid < 0) {
+                            statuses[i] = report_launch_failure(command, spec.path, err);
+                        } else {
+                            if (shell_is_interactive) {
+                                if (pgid == 0) pgid = pid;
+                                setpgid(pid, pgid);
                             }
+                            pids.push_back(pid);
+                            members[i] = pid;
                         }
-                        
-                        std::string executable_path = find_executable_in_path(cmd_node->command);
-                        if (executable_path.empty()) {
-                            std::cerr << cmd_node->command << ": command not found" << std::endl;
-                            std::exit(127);
-                        }
-                        
-                        std::vector<char*> argv;
-                        argv.push_back(const_cast<char*>(cmd_node->command.c_str()));
-                        for (const auto& arg : cmd_node->args) {
-                            argv.push_back(const_cast<char*>(arg.c_str()));
-                        }
-                        argv.push_back(nullptr);
-                        
-                        execv(executable_path.c_str(), argv.data());
-                        std::exit(127);
-                    } else if (pid > 0) {
-                        if (shell_is_interactive) {
-                            if (pgid == 0) pgid = pid;
-                            setpgid(pid, pgid);
-                        }
-                        pids.push_back(pid);
                     }
+                } else if (!compound && !in_background && is_side_effect_free_builtin(command, args) &&
+                           !reads_terminal(command, args, redir, input_fd)) {
+                    // Runs on a worker thread once every process is launched;
+                    // the thread owns (and closes) its pipe ends.
+                    threaded_stages.emplace_back(new BuiltinStage{std::move(command), std::move(args), std::move(redir),
+                                                                  input_fd, output_fd, 0, i});
+                    input_fd = -1;
+                    output_fd = -1;
                 } else {
+                    // Builtins that change shell state, and compound commands.
+                    TraceSpan fork_span("fork_builtin", command);
+                    std::cout.flush();
                     pid_t pid = fork();
+                    if (pid > 0) fork_span.set_track(pid);
                     
                     if (pid == 0) {
+                        enter_job(pgid, !in_background);
                         if (input_fd != -1) {
                             dup2(input_fd, STDIN_FILENO);
                         }
@@ -232,14 +381,15 @@ void execute_ast_node(ASTNode* node, bool in_background) {
                             close(fd);
                         }
                         
-                        execute_builtin(cmd_node->command, cmd_node->args, cmd_node->redir);
-                        std::exit(0);
+                        if (compound) run_subshell(cmd_node);
+                        std::exit(execute_builtin(command, args, redir));
                     } else if (pid > 0) {
                         if (shell_is_interactive) {
                             if (pgid == 0) pgid = pid;
                             setpgid(pid, pgid);
                         }
                         pids.push_back(pid);
+                        members[i] = pid;
                     }
                 }
                 
@@ -247,43 +397,251 @@ void execute_ast_node(ASTNode* node, bool in_background) {
                 if (output_fd != -1) close(output_fd);
             }
             
-            for (int fd : pipe_fds) {
-                close(fd);
+            // Loadable builtins may ask for the envp and type/hash -t peek at
+            // the command hash; both are brought up to date here, so the
+            // workers only ever read them.
+            if (!threaded_stages.empty()) {
+                exec_environment();
+                check_path_changed();
+            }
+            std::vector<std::thread> workers;
+            workers.reserve(threaded_stages.size());
+            for (const auto& stage : threaded_stages) {
+                workers.emplace_back(run_builtin_stage, stage);
             }
             
-            if (!in_background && !pids.empty()) {
+            // Children are waited for while the workers run: a worker feeding
+            // or draining a process that stops would never finish.
+            int stop_status = 0;
+            std::vector<pid_t> stopped;
+            if (!in_background) {
+                // Members are reaped in whatever order they finish.
+                ChildWaiter waiter(true);
                 for (pid_t pid : pids) {
-                    waitpid(pid, nullptr, 0);
+                    waiter.add(pid);
+                }
+                while (waiter.size() > 0) {
+                    pid_t pid;
+                    int status;
+                    waiter.next(pid, status);
+                    if (WIFSTOPPED(status)) {
+                        stopped.push_back(pid);
+                        stop_status = status;
+                    }
+                    size_t stage = std::find(members.begin(), members.end(), pid) - members.begin();
+                    if (stage < members.size()) statuses[stage] = exit_status_from_wait(status);
+                    // Ctrl-C went to the job's group; the workers never see it.
+                    // Those still running, or draining the member that died,
+                    // count as interrupted too.
+                    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+                        for (const auto& worker : threaded_stages) {
+                            bool draining = worker->index > stage && worker->input_fd != -1 &&
+                                            builtin_reads_stdin(worker->command, worker->args);
+                            if (!worker->finished || draining) worker->interrupted = true;
+                        }
+                    }
+                }
+            }
+            
+            // A stopped job takes its workers along: they carry on once it is
+            // resumed, and stages still running keep status 0.
+            for (std::thread& worker : workers) {
+                if (stopped.empty()) {
+                    worker.join();
+                } else {
+                    worker.detach();
+                }
+            }
+            for (const auto& stage : threaded_stages) {
+                if (stopped.empty() || stage->finished) {
+                    statuses[stage->index] = stage->interrupted ? 128 + SIGINT : stage->status;
+                }
+            }
+            
+            if (!in_background) {
+                pipe_status = statuses;
+                last_exit_status = pipeline_status(statuses);
+                
+                if (!stopped.empty()) {
+                    Job& job = add_job(pgid, job_text, stopped, false);
+                    job.members = members;
+                    job.statuses = statuses;
+                    update_job_status(stopped.front(), stop_status);
+                    last_exit_status = exit_status_from_wait(stop_status);
                 }
                 
-                if (shell_is_interactive) {
+                if (shell_is_interactive && !pids.empty()) {
                     tcsetpgrp(STDIN_FILENO, shell_pgid);
                 }
-            } else if (in_background && !pids.empty()) {
-                add_job(pgid, "", pids, true);
-                std::cout << "[" << (next_job_id - 1) << "] " << pgid << std::endl;
+            } else if (!pids.empty()) {
+                Job& job = add_job(pgid != 0 ? pgid : pids.front(), job_text, pids, true);
+                job.members = members;
+                job.statuses = statuses;
+                last_background_pid = pids.back();
+                std::cout << "[" << job.job_id << "] " << job.pgid << std::endl;
             }
             
             break;
         }
         
         case NodeType::BACKGROUND: {
+            if (node->children.empty()) break;
+            ASTNode* child = node->children[0];
+            if (!is_compound(child) && child->type != NodeType::SUBSHELL) {
+                execute_ast_node(child, true);
+                break;
+            }
+            
+            std::cout.flush();
+            pid_t pid = fork();
+            if (pid == 0) {
+                if (shell_is_interactive) setpgid(0, 0);
+                run_subshell(child);
+            } else if (pid > 0) {
+                if (shell_is_interactive) setpgid(pid, pid);
+                Job& job = add_job(pid, compound_job_text, {pid}, true);
+                std::cout << "[" << job.job_id << "] " << pid << std::endl;
+                last_background_pid = pid;
+                last_exit_status = 0;
+            }
+            break;
+        }
+        
+        case NodeType::TIMED: {
+            bool posix_format = false;
+            bool json = false;
+            for (const Word& option : node->words) {
+                if (option.text == "-p") {
+                    posix_format = true;
+                } else if (option.text == "-j") {
+                    json = true;
+                } else {
+                    std::cerr << "time: " << option.text << ": invalid option" << std::endl;
+                    std::cerr << "time: usage: time [-p] [-j] pipeline" << std::endl;
+                    last_exit_status = 2;
+                    return;
+                }
+            }
+            
+            TimingScope scope;
+            begin_timing(scope);
             if (!node->children.empty()) {
-                execute_ast_node(node->children[0].get(), true);
+                execute_ast_node(node->children[0], in_background);
+            }
+            TimingResult result = end_timing(scope);
+            
+            std::cout << std::flush;
+            if (json) {
+                std::cerr << timing_json(result, last_exit_status) << std::endl;
+            } else {
+                const char* format = get_variable("TIMEFORMAT");
+                if (posix_format) {
+                    format = posix_time_format;
+                } else if (!format) {
+                    format = default_time_format;
+                }
+                if (*format) {
+                    std::cerr << format_timing(result, format) << std::endl;
+                }
             }
             break;
         }
         
-        case NodeType::SEQUENCE: {
-            for (auto& child : node->children) {
-                execute_ast_node(child.get(), in_background);
+        case NodeType::SUBSHELL: {
+            std::cout.flush();
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_subshell(node);
             }
+            int status = 0;
+            if (pid > 0) {
+                wait_child(pid, &status, 0);
+            }
+            last_exit_status = pid > 0 ? exit_status_from_wait(status) : 1;
+            pipe_status.assign(1, last_exit_status);
+            break;
+        }
+        
+        case NodeType::CASE_ITEM:
+            break;
+        
+        default:
+            run_program(compile_program(node));
             break;
+    }
+}
+
+// Runs a command substitution in the shell process when every stage is a
+// builtin without side effects, writing into an in-memory sink instead of forking.
+// Returns false when the command needs a subshell.
+bool capture_builtin_output(const std::string& input, std::string& output) {
+    ParseTree tree = parse_to_ast(input);
+    if (tree.error || !tree.root) {
+        last_exit_status = tree.error ? 2 : last_exit_status;
+        return true;
+    }
+    
+    Span<ASTNode*> stages{&tree.root, 1};
+    if (tree.root->type == NodeType::PIPELINE) {
+        stages = tree.root->children;
+    } else if (tree.root->type != NodeType::COMMAND) {
+        return false;
+    }
+    
+    std::vector<std::string> raw_args;
+    for (ASTNode* stage : stages) {
+        if (stage->type != NodeType::COMMAND || !stage->redirs.empty() || stage->words.empty()) {
+            return false;
+        }
+        
+        const Word& name = stage->words[0];
+        raw_args.clear();
+        for (size_t i = 1; i < stage->words.size; i++) {
+            raw_args.emplace_back(stage->words[i].text);
         }
+        if (name.needs_expansion || !is_side_effect_free_builtin(std::string(name.text), raw_args)) {
+            return false;
+        }
+        // $(cat) at the prompt reads the terminal from a forked child.
+        if (stage == stages[0] && isatty(STDIN_FILENO) && builtin_reads_stdin(std::string(name.text), raw_args)) {
+            return false;
+        }
+    }
+    
+    OutputSink err(STDERR_FILENO);
+    int status = 0;
+    int in = STDIN_FILENO;
+    
+    for (ASTNode* stage : stages) {
+        std::string command;
+        std::vector<std::string> args;
+        RedirectionConfig redir;
+        if (!expand_command(stage, command, args, redir)) continue;
+        
+        // Stages run one after another, each reading the previous one's
+        // output from an anonymous file.
+        if (stage != stages[0]) {
+            if (in != STDIN_FILENO) close(in);
+            in = make_heredoc(output);
+            if (in == -1) in = open("/dev/null", O_RDONLY | O_CLOEXEC);
+            lseek(in, 0, SEEK_SET);
+        }
+        output.clear();
+        OutputSink out(output);
+        status = run_builtin(command, args, in, out, err);
     }
+    if (in != STDIN_FILENO) close(in);
+    
+    last_exit_status = status;
+    return true;
 }
 
-void process_command(const std::string& input) {
-    auto ast = parse_to_ast(input);
-    execute_ast_node(ast.get(), false);
+void process_command(const std::string& input, bool read_more) {
+    TraceSpan span("command", input);
+    ParseTree tree = parse_to_ast(input, read_more);
+    if (tree.error) {
+        last_exit_status = 2;
+        return;
+    }
+    execute_ast_node(tree.root, false);
 }
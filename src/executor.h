@@ -5,10 +5,11 @@
 #include <string>
 #include <vector>
 
-void process_command(const std::string& input);
+void process_command(const std::string& input, bool read_more = false);
+bool capture_builtin_output(const std::string& input, std::string& output);
 void execute_ast_node(ASTNode* node, bool in_background = false);
 void execute_external(const std::string& command, const std::vector<std::string>& args, 
                       const RedirectionConfig& redir, int input_fd = -1, int output_fd = -1,
-                      bool in_background = false, pid_t pgid = 0);
+                      bool in_background = false, pid_t pgid = 0, char* const* envp = nullptr);
 
 #endif // EXECUTOR_H
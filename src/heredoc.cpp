@@ -1,26 +1,98 @@
 #include "heredoc.h"
+#include "script_input.h"
+#include "trace.h"
 #include <readline/readline.h>
-#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-void read_heredoc(RedirectionConfig& redir) {
-    if (!redir.use_heredoc || redir.heredoc_delimiter.empty()) return;
-    
-    std::string content;
+static const size_t heredoc_chunk_size = 64 * 1024;
+
+static bool write_all(int fd, std::string_view data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+static int create_heredoc_file() {
+    int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    }
+    return fd;
+}
+
+// Streams the body into an anonymous file and seals it, so it can be handed
+// to any number of readers without copying it again. Returns -1 on failure.
+int read_heredoc(const std::string& delimiter) {
+    TraceSpan span("heredoc", delimiter);
+    int fd = create_heredoc_file();
+    std::string chunk;
     std::string line;
+    bool ok = fd != -1;
     
     while (true) {
-        char* input = readline("> ");
-        if (!input) break;
-        
-        line = input;
-        free(input);
+        if (script_input) {
+            if (!script_input->read_line(line)) break;
+        } else {
+            char* input = readline("> ");
+            if (!input) break;
+            
+            line = input;
+            free(input);
+        }
         
-        if (line == redir.heredoc_delimiter) {
+        if (line == delimiter) {
             break;
         }
         
-        content += line + "\n";
+        chunk.append(line);
+        chunk.push_back('\n');
+        if (chunk.size() >= heredoc_chunk_size) {
+            ok = ok && write_all(fd, chunk);
+            chunk.clear();
+        }
+    }
+    
+    ok = ok && write_all(fd, chunk);
+    if (!ok) {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+// Same as read_heredoc() for a body that is already in memory.
+int make_heredoc(std::string_view body) {
+    int fd = create_heredoc_file();
+    if (fd == -1) return -1;
+    if (!write_all(fd, body)) {
+        close(fd);
+        return -1;
     }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+// Returns a new read-only descriptor for the heredoc with its own offset at
+// the start of the body, leaving the original untouched for the next run.
+int open_heredoc(int heredoc_fd) {
+    if (heredoc_fd == -1) return -1;
+    
+    char path[32];
+    std::snprintf(path, sizeof(path), "/proc/self/fd/%d", heredoc_fd);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) return fd;
     
-    redir.heredoc_content = content;
+    fd = fcntl(heredoc_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd != -1) lseek(fd, 0, SEEK_SET);
+    return fd;
 }
@@ -1,8 +1,11 @@
 #ifndef HEREDOC_H
 #define HEREDOC_H
 
-#include "parser.h"
+#include <string>
+#include <string_view>
 
-void read_heredoc(RedirectionConfig& redir);
+int read_heredoc(const std::string& delimiter);
+int make_heredoc(std::string_view body);
+int open_heredoc(int heredoc_fd);
 
 #endif // HEREDOC_H
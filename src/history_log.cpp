@@ -0,0 +1,204 @@
+#include "history_log.h"
+#include "trace.h"
+#include <readline/history.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+
+struct HistoryLog {
+    int log_fd = -1;
+    int index_fd = -1;
+    const char* log_map = nullptr;
+    size_t log_mapped = 0;
+    const uint64_t* index_map = nullptr;
+    size_t index_mapped = 0;       // bytes
+    size_t merged = 0;             // entries already handed to readline
+};
+
+static HistoryLog history;
+
+static bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+static off_t file_size(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+static void remap(const char*& map, size_t& mapped, int fd) {
+    size_t size = file_size(fd);
+    if (size == mapped) return;
+    
+    if (map) munmap(const_cast<char*>(map), mapped);
+    map = nullptr;
+    mapped = 0;
+    if (size == 0) return;
+    
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) return;
+    map = static_cast<const char*>(addr);
+    mapped = size;
+}
+
+static void remap_all() {
+    remap(history.log_map, history.log_mapped, history.log_fd);
+    const char* index_bytes = reinterpret_cast<const char*>(history.index_map);
+    remap(index_bytes, history.index_mapped, history.index_fd);
+    history.index_map = reinterpret_cast<const uint64_t*>(index_bytes);
+}
+
+// Brings the index in line with the log. Entries appended by something that
+// does not maintain the index (an older shell, `echo >> file`) are indexed
+// here; an index that does not match the log is rebuilt. Caller holds the lock.
+static void sync_index() {
+    off_t log_size = file_size(history.log_fd);
+    off_t index_size = file_size(history.index_fd);
+    index_size -= index_size % sizeof(uint64_t);
+    
+    uint64_t indexed_end = 0;
+    if (index_size > 0) {
+        pread(history.index_fd, &indexed_end, sizeof(indexed_end), index_size - sizeof(uint64_t));
+    }
+    
+    char last = '\n';
+    if (indexed_end > 0 && indexed_end <= static_cast<uint64_t>(log_size)) {
+        pread(history.log_fd, &last, 1, indexed_end - 1);
+    }
+    if (indexed_end > static_cast<uint64_t>(log_size) || last != '\n' ||
+        file_size(history.index_fd) != index_size) {
+        ftruncate(history.index_fd, 0);
+        indexed_end = 0;
+        history.merged = 0;
+        clear_history();
+        history_base = 1;
+    }
+    if (indexed_end == static_cast<uint64_t>(log_size)) return;
+    
+    // A line left unterminated by a crashed writer would swallow the next one.
+    pread(history.log_fd, &last, 1, log_size - 1);
+    if (last != '\n') {
+        write_all(history.log_fd, "\n", 1);
+        log_size++;
+    }
+    
+    std::vector<uint64_t> ends;
+    std::vector<char> buffer(1 << 16);
+    uint64_t offset = indexed_end;
+    while (offset < static_cast<uint64_t>(log_size)) {
+        ssize_t n = pread(history.log_fd, buffer.data(), buffer.size(), offset);
+        if (n <= 0) break;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i] == '\n') ends.push_back(offset + i + 1);
+        }
+        offset += n;
+    }
+    write_all(history.index_fd, reinterpret_cast<const char*>(ends.data()),
+              ends.size() * sizeof(uint64_t));
+}
+
+bool open_history_log(const std::string& path) {
+    close_history_log();
+    
+    history.log_fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history.log_fd == -1) return false;
+    
+    std::string index_path = path + ".idx";
+    history.index_fd = open(index_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history.index_fd == -1) {
+        close(history.log_fd);
+        history.log_fd = -1;
+        return false;
+    }
+    
+    flock(history.log_fd, LOCK_EX);
+    sync_index();
+    flock(history.log_fd, LOCK_UN);
+    remap_all();
+    return true;
+}
+
+void close_history_log() {
+    if (history.log_map) munmap(const_cast<char*>(history.log_map), history.log_mapped);
+    if (history.index_map) munmap(const_cast<uint64_t*>(history.index_map), history.index_mapped);
+    if (history.log_fd != -1) close(history.log_fd);
+    if (history.index_fd != -1) close(history.index_fd);
+    history = HistoryLog();
+}
+
+bool history_log_is_open() {
+    return history.log_fd != -1;
+}
+
+size_t history_log_size() {
+    return history.index_mapped / sizeof(uint64_t);
+}
+
+std::string_view history_log_entry(size_t index) {
+    if (index >= history_log_size()) return {};
+    
+    uint64_t start = index > 0 ? history.index_map[index - 1] : 0;
+    uint64_t end = history.index_map[index];
+    if (end > history.log_mapped || start >= end) return {};
+    return std::string_view(history.log_map + start, end - start - 1);
+}
+
+// Hands entries written since the last call, by this or any other shell,
+// to readline so they show up on the up arrow.
+void history_log_merge() {
+    if (!history_log_is_open()) return;
+    remap_all();
+    
+    size_t count = history_log_size();
+    for (size_t i = history.merged; i < count; i++) {
+        std::string entry(history_log_entry(i));
+        add_history(entry.c_str());
+    }
+    history.merged = count;
+}
+
+void history_log_load_tail(size_t count) {
+    if (!history_log_is_open()) return;
+    remap_all();
+    
+    size_t size = history_log_size();
+    history.merged = size > count ? size - count : 0;
+    history_base = static_cast<int>(history.merged) + 1;
+    history_log_merge();
+}
+
+void history_log_append(const std::string& line) {
+    if (!history_log_is_open()) {
+        add_history(line.c_str());
+        return;
+    }
+    TraceSpan span("history_append");
+    
+    std::string record = line;
+    record.push_back('\n');
+    
+    flock(history.log_fd, LOCK_EX);
+    sync_index();
+    uint64_t end = file_size(history.log_fd) + record.size();
+    if (write_all(history.log_fd, record.data(), record.size())) {
+        write_all(history.index_fd, reinterpret_cast<const char*>(&end), sizeof(end));
+    }
+    flock(history.log_fd, LOCK_UN);
+    
+    history_log_merge();
+}
@@ -0,0 +1,24 @@
+#ifndef HISTORY_LOG_H
+#define HISTORY_LOG_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// Shared on-disk history: an append-only log of newline-terminated entries
+// plus a sidecar index ("<log>.idx") of 64-bit end offsets, one per entry.
+// Writers append under flock(); readers map both files and find entry i in
+// O(1). Several shells can use the same log at once.
+
+bool open_history_log(const std::string& path);
+void close_history_log();
+bool history_log_is_open();
+
+void history_log_append(const std::string& line);
+void history_log_merge();
+void history_log_load_tail(size_t count);
+
+size_t history_log_size();
+std::string_view history_log_entry(size_t index);
+
+#endif // HISTORY_LOG_H
@@ -0,0 +1,172 @@
+#include "history_search.h"
+#include "history_log.h"
+#include "trace.h"
+#include <readline/history.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+struct DistinctEntry {
+    uint32_t offset;               // into corpus
+    uint32_t length;
+    uint32_t last;                 // log index of the newest occurrence
+    uint32_t count;
+};
+
+// Distinct commands are stored back to back in `corpus`, each followed by
+// '\n', so short patterns can be found with one memmem() over the lot.
+static std::string corpus;
+static std::vector<DistinctEntry> distinct;
+static std::unordered_map<std::string, uint32_t> distinct_of_text;
+static std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+static size_t indexed = 0;
+static int indexed_base = 0;
+
+static inline uint32_t trigram(const char* p) {
+    return static_cast<uint8_t>(p[0]) << 16 | static_cast<uint8_t>(p[1]) << 8 | static_cast<uint8_t>(p[2]);
+}
+
+static std::string_view distinct_text(const DistinctEntry& entry) {
+    return std::string_view(corpus.data() + entry.offset, entry.length);
+}
+
+void reset_history_search() {
+    corpus.clear();
+    distinct.clear();
+    distinct_of_text.clear();
+    postings.clear();
+    indexed = 0;
+}
+
+static void index_entry(std::string_view text, size_t index) {
+    auto found = distinct_of_text.find(std::string(text));
+    if (found != distinct_of_text.end()) {
+        DistinctEntry& entry = distinct[found->second];
+        entry.last = static_cast<uint32_t>(index);
+        entry.count++;
+        return;
+    }
+    
+    uint32_t id = static_cast<uint32_t>(distinct.size());
+    distinct.push_back({static_cast<uint32_t>(corpus.size()), static_cast<uint32_t>(text.size()),
+                        static_cast<uint32_t>(index), 1});
+    distinct_of_text.emplace(std::string(text), id);
+    corpus.append(text.data(), text.size());
+    corpus.push_back('\n');
+    
+    std::vector<uint32_t> grams;
+    for (size_t i = 0; i + 3 <= text.size(); i++) {
+        grams.push_back(trigram(text.data() + i));
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    for (uint32_t gram : grams) {
+        postings[gram].push_back(id);
+    }
+}
+
+// Without a log the index follows readline's list, which loses its oldest
+// entries once stifled; start over whenever that happens.
+static void sync_index() {
+    if (history_log_is_open()) {
+        size_t size = history_log_size();
+        if (size < indexed) reset_history_search();
+        for (; indexed < size; indexed++) {
+            index_entry(history_log_entry(indexed), indexed);
+        }
+        return;
+    }
+    
+    HISTORY_STATE* state = history_get_history_state();
+    size_t length = state->length;
+    free(state);
+    if (history_base != indexed_base || length < indexed) {
+        reset_history_search();
+        indexed_base = history_base;
+    }
+    for (; indexed < length; indexed++) {
+        HIST_ENTRY* entry = history_get(history_base + static_cast<int>(indexed));
+        if (entry) index_entry(entry->line, indexed);
+    }
+}
+
+static void trigram_candidates(const std::string& pattern, std::vector<uint32_t>& matches) {
+    std::vector<const std::vector<uint32_t>*> lists;
+    for (size_t i = 0; i + 3 <= pattern.size(); i++) {
+        auto found = postings.find(trigram(pattern.data() + i));
+        if (found == postings.end()) return;
+        lists.push_back(&found->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](auto* a, auto* b) { return a->size() < b->size(); });
+    
+    // Walk the shortest list and check the rest by binary search; a trigram
+    // hit is only a candidate until the whole pattern is found.
+    for (uint32_t id : *lists[0]) {
+        bool in_all = true;
+        for (size_t l = 1; l < lists.size() && in_all; l++) {
+            in_all = std::binary_search(lists[l]->begin(), lists[l]->end(), id);
+        }
+        if (in_all && distinct_text(distinct[id]).find(pattern) != std::string_view::npos) {
+            matches.push_back(id);
+        }
+    }
+}
+
+static void scan_candidates(const std::string& pattern, std::vector<uint32_t>& matches) {
+    const char* begin = corpus.data();
+    const char* end = begin + corpus.size();
+    const char* cursor = begin;
+    
+    while (cursor < end) {
+        const void* hit = memmem(cursor, end - cursor, pattern.data(), pattern.size());
+        if (!hit) break;
+        uint32_t offset = static_cast<uint32_t>(static_cast<const char*>(hit) - begin);
+        auto entry = std::upper_bound(distinct.begin(), distinct.end(), offset,
+                                      [](uint32_t value, const DistinctEntry& e) { return value < e.offset; });
+        --entry;
+        matches.push_back(static_cast<uint32_t>(entry - distinct.begin()));
+        cursor = begin + entry->offset + entry->length + 1;
+    }
+}
+
+std::vector<HistoryMatch> search_history(const std::string& pattern, size_t limit) {
+    TraceSpan span("history_search");
+    sync_index();
+    
+    std::vector<uint32_t> matches;
+    if (pattern.empty()) {
+        for (uint32_t id = 0; id < distinct.size(); id++) matches.push_back(id);
+    } else if (pattern.size() < 3) {
+        scan_candidates(pattern, matches);
+    } else {
+        trigram_candidates(pattern, matches);
+    }
+    
+    // Recency dominates; frequency lets an old favourite beat a one-off
+    // that is only slightly newer.
+    double newest = static_cast<double>(indexed);
+    auto score = [&](uint32_t id) {
+        const DistinctEntry& entry = distinct[id];
+        double age = newest - entry.last;
+        return (1.0 + std::log2(static_cast<double>(entry.count))) / (1.0 + age / 64.0);
+    };
+    size_t keep = std::min(limit, matches.size());
+    std::vector<std::pair<double, uint32_t>> ranked;
+    ranked.reserve(matches.size());
+    for (uint32_t id : matches) ranked.emplace_back(score(id), id);
+    std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(),
+                      [](const auto& a, const auto& b) {
+                          return a.first != b.first ? a.first > b.first : a.second > b.second;
+                      });
+    
+    std::vector<HistoryMatch> results;
+    for (size_t i = 0; i < keep; i++) {
+        const DistinctEntry& entry = distinct[ranked[i].second];
+        size_t number = entry.last + (history_log_is_open() ? 1 : indexed_base);
+        results.push_back({std::string(distinct_text(entry)), number, entry.count});
+    }
+    return results;
+}
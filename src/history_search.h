@@ -0,0 +1,21 @@
+#ifndef HISTORY_SEARCH_H
+#define HISTORY_SEARCH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Substring search over the whole history log. Identical commands are
+// indexed once, with trigram postings over the distinct texts; the index
+// catches up with new log entries on each query.
+
+struct HistoryMatch {
+    std::string text;
+    size_t number;                 // history number of the newest occurrence
+    size_t count;                  // how many times the command was entered
+};
+
+std::vector<HistoryMatch> search_history(const std::string& pattern, size_t limit);
+void reset_history_search();
+
+#endif // HISTORY_SEARCH_H
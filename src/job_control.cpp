@@ -1,10 +1,39 @@
 #include "job_control.h"
+#include "child_wait.h"
 #include <algorithm>
+#include <deque>
+#include <iostream>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
 
-std::vector<Job> jobs;
+std::unordered_map<int, Job> jobs;
 int next_job_id = 1;
+pid_t last_background_pid = 0;
 
-void add_job(pid_t pgid, const std::string& command, const std::vector<pid_t>& pids, bool background) {
+static std::unordered_map<pid_t, int> job_of_pid;
+static int current_job_id = -1;
+static int sigchld_fd = -1;
+
+struct JobNotice {
+    int job_id;
+    const char* state;
+};
+
+static std::vector<JobNotice> pending_notices;
+
+// Background jobs that finished and have not been collected by `wait`. Old
+// entries are dropped past the limit, as bash does with its saved statuses.
+struct FinishedJob {
+    int job_id;
+    std::vector<pid_t> members;
+    std::vector<int> statuses;
+};
+
+static const size_t finished_job_limit = 1024;
+static std::deque<FinishedJob> finished_jobs;
+
+Job& add_job(pid_t pgid, const std::string& command, const std::vector<pid_t>& pids, bool background) {
     Job job;
     job.job_id = next_job_id++;
     job.pgid = pgid;
@@ -12,20 +41,180 @@ void add_job(pid_t pgid, const std::string& command, const std::vector<pid_t>& p
     job.stopped = false;
     job.background = background;
     job.pids = pids;
-    jobs.push_back(job);
+    job.members = pids;
+    job.statuses.assign(pids.size(), 0);
+    
+    for (pid_t pid : pids) {
+        job_of_pid[pid] = job.job_id;
+    }
+    current_job_id = job.job_id;
+    return jobs.emplace(job.job_id, std::move(job)).first->second;
 }
 
 Job* find_job(int job_id) {
-    auto it = std::find_if(jobs.begin(), jobs.end(),
-        [job_id](const Job& j) { return j.job_id == job_id; });
+    auto it = jobs.find(job_id);
+    return it != jobs.end() ? &it->second : nullptr;
+}
+
+Job* find_job_by_pid(pid_t pid) {
+    auto it = job_of_pid.find(pid);
+    return it != job_of_pid.end() ? find_job(it->second) : nullptr;
+}
+
+Job* current_job() {
+    return find_job(current_job_id);
+}
+
+void remove_job(int job_id) {
+    auto it = jobs.find(job_id);
+    if (it == jobs.end()) return;
+    
+    for (pid_t pid : it->second.pids) {
+        job_of_pid.erase(pid);
+    }
+    jobs.erase(it);
+    
+    if (job_id == current_job_id) {
+        current_job_id = -1;
+        for (const auto& entry : jobs) {
+            current_job_id = std::max(current_job_id, entry.first);
+        }
+    }
+    if (jobs.empty()) {
+        next_job_id = 1;
+    }
+}
+
+std::vector<const Job*> sorted_jobs() {
+    std::vector<const Job*> list;
+    list.reserve(jobs.size());
+    for (const auto& entry : jobs) {
+        list.push_back(&entry.second);
+    }
+    std::sort(list.begin(), list.end(),
+        [](const Job* a, const Job* b) { return a->job_id < b->job_id; });
+    return list;
+}
+
+// SIGCHLD stays blocked and is read from a signalfd, so children are only
+// reaped from the main loop and never from inside a signal handler.
+void init_child_reaper() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int child_signal_fd() {
+    return sigchld_fd;
+}
+
+void update_job_status(pid_t pid, int status) {
+    Job* job = find_job_by_pid(pid);
+    if (!job) return;
+    
+    if (WIFSTOPPED(status)) {
+        job->stopped = true;
+        current_job_id = job->job_id;
+        if (!job->background) {
+            pending_notices.push_back({job->job_id, "Stopped   "});
+        }
+    } else if (WIFCONTINUED(status)) {
+        job->stopped = false;
+    } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        job_of_pid.erase(pid);
+        job->pids.erase(std::find(job->pids.begin(), job->pids.end(), pid));
+        auto member = std::find(job->members.begin(), job->members.end(), pid);
+        if (member != job->members.end()) {
+            job->statuses[member - job->members.begin()] = exit_status_from_wait(status);
+        }
+        if (job->pids.empty() && job->background) {
+            pending_notices.push_back({job->job_id, "Done       "});
+            if (finished_jobs.size() == finished_job_limit) finished_jobs.pop_front();
+            finished_jobs.push_back({job->job_id, job->members, job->statuses});
+        }
+    }
+}
+
+void service_child_signals() {
+    if (sigchld_fd != -1) {
+        signalfd_siginfo info;
+        while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {
+        }
+    }
+    
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
+        update_job_status(pid, status);
+    }
+}
+
+// Waits for a job brought to the foreground until it finishes or stops.
+// Returns its exit status: that of the pipeline, or 128+signal if it stopped.
+int wait_for_job(Job& job) {
+    ChildWaiter waiter(true);
+    for (pid_t pid : job.pids) {
+        waiter.add(pid);
+    }
     
-    if (it != jobs.end()) {
-        return &(*it);
+    int stop_status = 0;
+    while (waiter.size() > 0 && !job.stopped) {
+        pid_t pid;
+        int status;
+        waiter.next(pid, status);
+        if (WIFSTOPPED(status)) stop_status = status;
+        update_job_status(pid, status);
+    }
+    return job.stopped ? exit_status_from_wait(stop_status) : job_status(job);
+}
+
+int job_status(const Job& job) {
+    return pipeline_status(job.statuses);
+}
+
+// Takes the oldest finished job matching job_id, or having pid as a member;
+// with neither (-1), the oldest of all. The status is the job's, or that of
+// the member asked for.
+bool take_finished_job(int job_id, pid_t pid, int& status) {
+    for (auto it = finished_jobs.begin(); it != finished_jobs.end(); ++it) {
+        auto member = std::find(it->members.begin(), it->members.end(), pid);
+        if (job_id != -1 && it->job_id != job_id) continue;
+        if (pid != -1 && member == it->members.end()) continue;
+        
+        status = pid != -1 ? it->statuses[member - it->members.begin()] : pipeline_status(it->statuses);
+        finished_jobs.erase(it);
+        return true;
     }
-    return nullptr;
+    return false;
+}
+
+void forget_finished_jobs() {
+    finished_jobs.clear();
 }
 
-void remove_completed_jobs() {
-    jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
-        [](const Job& j) { return j.pids.empty(); }), jobs.end());
+int exit_status_from_wait(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+void flush_job_notifications(bool print) {
+    for (const JobNotice& notice : pending_notices) {
+        Job* job = find_job(notice.job_id);
+        if (!job) continue;
+        
+        if (print) {
+            // A stop notice follows the ^Z echoed on the command's line.
+            if (job->stopped) std::cerr << '\n';
+            std::cerr << "[" << job->job_id << "]+ " << notice.state << job->command << std::endl;
+        }
+        if (job->pids.empty()) {
+            remove_job(job->job_id);
+        }
+    }
+    pending_notices.clear();
 }
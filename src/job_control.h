@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
 #include <unistd.h>
 
 struct Job {
@@ -11,14 +12,31 @@ struct Job {
     std::string command;
     bool stopped;
     bool background;
-    std::vector<pid_t> pids;
+    std::vector<pid_t> pids;       // processes not yet reaped
+    std::vector<pid_t> members;    // one per pipeline stage, -1 for stages run by the shell
+    std::vector<int> statuses;     // exit status per stage, filled in as members finish
 };
 
-extern std::vector<Job> jobs;
+extern std::unordered_map<int, Job> jobs;
 extern int next_job_id;
+extern pid_t last_background_pid;  // $!
 
-void add_job(pid_t pgid, const std::string& command, const std::vector<pid_t>& pids, bool background);
+Job& add_job(pid_t pgid, const std::string& command, const std::vector<pid_t>& pids, bool background);
 Job* find_job(int job_id);
-void remove_completed_jobs();
+Job* find_job_by_pid(pid_t pid);
+Job* current_job();
+void remove_job(int job_id);
+std::vector<const Job*> sorted_jobs();
+
+void init_child_reaper();
+int child_signal_fd();
+void service_child_signals();
+void update_job_status(pid_t pid, int status);
+int wait_for_job(Job& job);
+int job_status(const Job& job);
+bool take_finished_job(int job_id, pid_t pid, int& status);
+void forget_finished_jobs();
+int exit_status_from_wait(int status);
+void flush_job_notifications(bool print);
 
 #endif // JOB_CONTROL_H
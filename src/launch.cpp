@@ -0,0 +1,241 @@
+#include "launch.h"
+#include "heredoc.h"
+#include "trace.h"
+#include "variables.h"
+#include <spawn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+static const int job_control_signals[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+
+void reset_child_signals() {
+    for (int sig : job_control_signals) {
+        signal(sig, SIG_DFL);
+    }
+}
+
+struct RedirectFds {
+    int in = -1;
+    int out = -1;
+    int err = -1;
+    
+    ~RedirectFds() {
+        if (in != -1) close(in);
+        if (out != -1) close(out);
+        if (err != -1) close(err);
+    }
+};
+
+// Redirection targets are opened in the parent so a missing input file is
+// reported as such instead of looking like a failed exec.
+static bool open_redirections(const RedirectionConfig* redir, RedirectFds& fds) {
+    if (!redir) return true;
+    
+    if (redir->use_heredoc) {
+        fds.in = open_heredoc(redir->heredoc_fd);
+        if (fds.in == -1) {
+            std::cerr << "heredoc: " << strerror(errno) << std::endl;
+            return false;
+        }
+    } else if (!redir->stdin_file.empty()) {
+        fds.in = open(redir->stdin_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fds.in == -1) {
+            std::cerr << redir->stdin_file << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    
+    if (!redir->stdout_file.empty()) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (redir->stdout_append ? O_APPEND : O_TRUNC);
+        fds.out = open(redir->stdout_file.c_str(), flags, 0644);
+        if (fds.out == -1) {
+            std::cerr << redir->stdout_file << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    
+    if (!redir->stderr_file.empty()) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (redir->stderr_append ? O_APPEND : O_TRUNC);
+        fds.err = open(redir->stderr_file.c_str(), flags, 0644);
+        if (fds.err == -1) {
+            std::cerr << redir->stderr_file << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Points stdin/stdout/stderr of a forked shell at the redirection targets.
+bool redirect_standard_fds(const RedirectionConfig& redir) {
+    RedirectFds fds;
+    if (!open_redirections(&redir, fds)) return false;
+    if (fds.in != -1) dup2(fds.in, STDIN_FILENO);
+    if (fds.out != -1) dup2(fds.out, STDOUT_FILENO);
+    if (fds.err != -1) dup2(fds.err, STDERR_FILENO);
+    return true;
+}
+
+// Without addtcsetpgrp the child has to take the terminal itself.
+#ifdef HAVE_SPAWN_TCSETPGRP
+static bool needs_fork(const LaunchSpec&) {
+    return false;
+}
+#else
+static bool needs_fork(const LaunchSpec& spec) {
+    return spec.foreground && spec.pgid != -1;
+}
+#endif
+
+pid_t launch_process(const LaunchSpec& spec, int& err) {
+    bool fork_path = needs_fork(spec);
+    TraceSpan span(fork_path ? "fork_exec" : "posix_spawn", spec.path);
+    pid_t pid = fork_path ? fork_exec_process(spec, err) : spawn_process(spec, err);
+    if (pid > 0) span.set_track(pid);
+    return pid;
+}
+
+pid_t spawn_process(const LaunchSpec& spec, int& err) {
+    RedirectFds fds;
+    if (!open_redirections(spec.redir, fds)) {
+        err = 0;
+        return -1;
+    }
+    
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
+    
+    if (spec.pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setpgroup(&attr, spec.pgid);
+        
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        for (int sig : job_control_signals) {
+            sigaddset(&defaults, sig);
+        }
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        
+#ifdef HAVE_SPAWN_TCSETPGRP
+        if (spec.foreground) {
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    
+    int in = fds.in != -1 ? fds.in : spec.input_fd;
+    int out = fds.out != -1 ? fds.out : spec.output_fd;
+    if (in != -1) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    if (out != -1) posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    int error = fds.err != -1 ? fds.err : spec.error_fd;
+    if (error != -1) posix_spawn_file_actions_adddup2(&actions, error, STDERR_FILENO);
+    
+    pid_t pid = -1;
+    char* const* envp = spec.envp ? spec.envp : exec_environment();
+    err = posix_spawn(&pid, spec.path.c_str(), &actions, &attr, spec.argv.data(), envp);
+    
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    
+    return err == 0 ? pid : -1;
+}
+
+// Fallback for launches posix_spawn cannot describe (terminal handoff on
+// libcs without posix_spawn_file_actions_addtcsetpgrp_np). The child reports a failed exec by writing errno
+// to a close-on-exec pipe; a successful exec closes it and we read EOF.
+pid_t fork_exec_process(const LaunchSpec& spec, int& err) {
+    RedirectFds fds;
+    if (!open_redirections(spec.redir, fds)) {
+        err = 0;
+        return -1;
+    }
+    
+    int errpipe[2];
+    if (pipe2(errpipe, O_CLOEXEC) == -1) {
+        err = errno;
+        return -1;
+    }
+    
+    char* const* envp = spec.envp ? spec.envp : exec_environment();
+    pid_t pid = fork();
+    
+    if (pid == 0) {
+        close(errpipe[0]);
+        
+        if (spec.pgid != -1) {
+            setpgid(0, spec.pgid);
+            if (spec.foreground) {
+                tcsetpgrp(STDIN_FILENO, getpgrp());
+            }
+            reset_child_signals();
+        }
+        
+        if (fds.in != -1) {
+            dup2(fds.in, STDIN_FILENO);
+        } else if (spec.input_fd != -1) {
+            dup2(spec.input_fd, STDIN_FILENO);
+        }
+        
+        if (fds.out != -1) {
+            dup2(fds.out, STDOUT_FILENO);
+        } else if (spec.output_fd != -1) {
+            dup2(spec.output_fd, STDOUT_FILENO);
+        }
+        
+        if (fds.err != -1) {
+            dup2(fds.err, STDERR_FILENO);
+        } else if (spec.error_fd != -1) {
+            dup2(spec.error_fd, STDERR_FILENO);
+        }
+        
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, nullptr);
+        
+        execve(spec.path.c_str(), spec.argv.data(), envp);
+        int exec_errno = errno;
+        write(errpipe[1], &exec_errno, sizeof(exec_errno));
+        _exit(127);
+    }
+    
+    close(errpipe[1]);
+    
+    if (pid < 0) {
+        err = errno;
+        close(errpipe[0]);
+        return -1;
+    }
+    
+    int exec_errno = 0;
+    ssize_t n;
+    do {
+        n = read(errpipe[0], &exec_errno, sizeof(exec_errno));
+    } while (n == -1 && errno == EINTR);
+    close(errpipe[0]);
+    
+    if (n == sizeof(exec_errno)) {
+        waitpid(pid, nullptr, 0);
+        err = exec_errno;
+        return -1;
+    }
+    
+    err = 0;
+    return pid;
+}
@@ -0,0 +1,27 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include "parser.h"
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+struct LaunchSpec {
+    std::string path;
+    std::vector<char*> argv;          // null-terminated
+    const RedirectionConfig* redir = nullptr;
+    char* const* envp = nullptr;      // nullptr: the shell's exported variables
+    int input_fd = -1;                // pipe end to use as stdin when no redirection applies
+    int output_fd = -1;               // pipe end to use as stdout when no redirection applies
+    int error_fd = -1;                // stderr when no redirection applies
+    pid_t pgid = -1;                  // -1 leaves the process group alone, 0 starts a new one
+    bool foreground = false;          // hand the terminal to the child's process group
+};
+
+pid_t launch_process(const LaunchSpec& spec, int& err);
+pid_t spawn_process(const LaunchSpec& spec, int& err);
+pid_t fork_exec_process(const LaunchSpec& spec, int& err);
+void reset_child_signals();
+bool redirect_standard_fds(const RedirectionConfig& redir);
+
+#endif // LAUNCH_H
@@ -0,0 +1,150 @@
+#include "loadable.h"
+#include "builtins.h"
+#include "shell_builtin.h"
+#include "variables.h"
+#include <dlfcn.h>
+#include <map>
+
+struct LoadedBuiltin {
+    void* handle;
+    const shell_builtin* spec;
+    std::string path;
+    builtin_func hidden;           // static builtin of the same name, restored by unload
+};
+
+static std::map<std::string, LoadedBuiltin> loaded;
+
+struct IoContext {
+    OutputSink& out;
+    OutputSink& err;
+};
+
+static int write_out(void* context, const char* data, size_t length) {
+    OutputSink& out = static_cast<IoContext*>(context)->out;
+    out.write(data, length);
+    return out.failed() ? -1 : 0;
+}
+
+// Diagnostics go out at once, after the output written before them.
+static int write_err(void* context, const char* data, size_t length) {
+    IoContext* io = static_cast<IoContext*>(context);
+    io->out.flush();
+    io->err.write(data, length);
+    io->err.flush();
+    return io->err.failed() ? -1 : 0;
+}
+
+static const char* variable_value(void*, const char* name) {
+    return get_variable(name);
+}
+
+static char* const* environment(void*) {
+    return exec_environment();
+}
+
+bool load_builtin(const std::string& path, const std::string& name, std::string& error) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        error = std::string("cannot open shared object ") + dlerror();
+        return false;
+    }
+    
+    std::string symbol = name + "_builtin";
+    auto spec = static_cast<const shell_builtin*>(dlsym(handle, symbol.c_str()));
+    if (!spec) {
+        error = "cannot find " + symbol + " in shared object " + path;
+    } else if (spec->abi_version != SHELL_BUILTIN_ABI_VERSION) {
+        error = name + ": builtin ABI version " + std::to_string(spec->abi_version) +
+                ", this shell supports " + std::to_string(SHELL_BUILTIN_ABI_VERSION);
+    } else if (!spec->run) {
+        error = name + ": no run function";
+    } else if (spec->load && spec->load(name.c_str()) != 0) {
+        error = name + ": load function failed";
+    } else {
+        error.clear();
+    }
+    if (!error.empty()) {
+        dlclose(handle);
+        return false;
+    }
+    
+    // Reloading a name drops the previous library but keeps what it hid.
+    builtin_func hidden = nullptr;
+    auto previous = loaded.find(name);
+    if (previous != loaded.end()) {
+        hidden = previous->second.hidden;
+        if (previous->second.spec->unload) previous->second.spec->unload(name.c_str());
+        dlclose(previous->second.handle);
+    } else if (is_builtin(name)) {
+        hidden = builtins[name];
+    }
+    
+    loaded[name] = LoadedBuiltin{handle, spec, path, hidden};
+    builtins[name] = nullptr;
+    return true;
+}
+
+bool unload_builtin(const std::string& name, std::string& error) {
+    auto it = loaded.find(name);
+    if (it == loaded.end()) {
+        error = name + ": not dynamically loaded";
+        return false;
+    }
+    
+    if (it->second.spec->unload) it->second.spec->unload(name.c_str());
+    dlclose(it->second.handle);
+    if (it->second.hidden) {
+        builtins[name] = it->second.hidden;
+    } else {
+        builtins.erase(name);
+    }
+    loaded.erase(it);
+    return true;
+}
+
+bool is_pure_loaded_builtin(const std::string& name) {
+    auto it = loaded.find(name);
+    return it != loaded.end() && (it->second.spec->flags & SHELL_BUILTIN_PURE);
+}
+
+int run_loaded_builtin(const std::string& name, const std::vector<std::string>& args, int in,
+                       OutputSink& out, OutputSink& err) {
+    auto it = loaded.find(name);
+    if (it == loaded.end()) {
+        err << name << ": builtin not loaded" << '\n';
+        return 1;
+    }
+    
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 2);
+    argv.push_back(const_cast<char*>(name.c_str()));
+    for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    
+    // Whatever is already buffered must precede anything written to the fds.
+    out.flush();
+    err.flush();
+    
+    IoContext context{out, err};
+    shell_builtin_io io;
+    io.abi_version = SHELL_BUILTIN_ABI_VERSION;
+    io.in_fd = in;
+    io.out_fd = out.fd();
+    io.err_fd = err.fd();
+    io.context = &context;
+    io.write_out = write_out;
+    io.write_err = write_err;
+    io.get_variable = variable_value;
+    io.environment = environment;
+    return it->second.spec->run(static_cast<int>(argv.size() - 1), argv.data(), &io);
+}
+
+std::vector<LoadedBuiltinInfo> loaded_builtins() {
+    std::vector<LoadedBuiltinInfo> result;
+    for (const auto& entry : loaded) {
+        const shell_builtin* spec = entry.second.spec;
+        result.push_back({entry.first, entry.second.path, spec->usage ? spec->usage : entry.first,
+                          spec->description ? spec->description : ""});
+    }
+    return result;
+}
@@ -0,0 +1,26 @@
+#ifndef LOADABLE_H
+#define LOADABLE_H
+
+#include "output.h"
+#include <string>
+#include <vector>
+
+// Builtins loaded from shared objects with `enable -f` (see shell_builtin.h).
+// A loaded builtin sits in the `builtins` map with a null function, so
+// type, completion and dispatch find it like any other; loading over a
+// static builtin hides it until `enable -d`.
+struct LoadedBuiltinInfo {
+    std::string name;
+    std::string path;
+    std::string usage;
+    std::string description;
+};
+
+bool load_builtin(const std::string& path, const std::string& name, std::string& error);
+bool unload_builtin(const std::string& name, std::string& error);
+bool is_pure_loaded_builtin(const std::string& name);
+int run_loaded_builtin(const std::string& name, const std::vector<std::string>& args, int in,
+                       OutputSink& out, OutputSink& err);
+std::vector<LoadedBuiltinInfo> loaded_builtins();
+
+#endif // LOADABLE_H
@@ -1,9 +1,49 @@
 #include "shell.h"
 #include "builtins.h"
+#include "script_input.h"
+#include "trace.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
-int main() {
-    init_shell();
+int main(int argc, char* argv[]) {
+    init_tracing();
+    
+    if (argc > 2 && std::strcmp(argv[1], "-c") == 0) {
+        init_shell(false);
+        init_builtins();
+        ScriptReader reader{std::string(argv[2])};
+        return run_script(reader, false);
+    }
+    
+    if (argc > 1 && std::strcmp(argv[1], "-c") == 0) {
+        std::cerr << argv[0] << ": -c: option requires an argument" << std::endl;
+        return 2;
+    }
+    
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            std::cerr << argv[0] << ": " << argv[1] << ": " << std::strerror(errno) << std::endl;
+            return 127;
+        }
+        init_shell(false);
+        init_builtins();
+        ScriptReader reader(fd);
+        return run_script(reader, false);
+    }
+    
+    if (!isatty(STDIN_FILENO)) {
+        init_shell(false);
+        init_builtins();
+        ScriptReader reader(STDIN_FILENO);
+        return run_script(reader, true);
+    }
+    
+    init_shell(true);
     init_builtins();
     run_shell();
-    return 0;
+    return last_exit_status;
 }
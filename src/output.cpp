@@ -0,0 +1,116 @@
+#include "output.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <charconv>
+#include <iostream>
+
+OutputSink::OutputSink(int fd, bool owns_fd)
+    : fd_(fd), owns_fd_(owns_fd), target_(nullptr), failed_(false) {}
+
+OutputSink::OutputSink(std::string& target)
+    : fd_(-1), owns_fd_(false), target_(&target), failed_(false) {}
+
+OutputSink::~OutputSink() {
+    flush();
+    if (owns_fd_ && fd_ != -1) {
+        close(fd_);
+    }
+}
+
+std::unique_ptr<OutputSink> OutputSink::open_file(const std::string& path, bool append) {
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    int fd = open(path.c_str(), flags, 0644);
+    if (fd == -1) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    return std::make_unique<OutputSink>(fd, true);
+}
+
+void OutputSink::write(const char* data, size_t length) {
+    if (target_) {
+        target_->append(data, length);
+        return;
+    }
+    
+    while (length > 0) {
+        if (blocks_.empty() || blocks_.back().size() == BLOCK_SIZE) {
+            if (blocks_.size() == MAX_BLOCKS) {
+                flush();
+            }
+            blocks_.emplace_back();
+        }
+        
+        std::string& block = blocks_.back();
+        size_t n = std::min(length, BLOCK_SIZE - block.size());
+        block.append(data, n);
+        data += n;
+        length -= n;
+    }
+}
+
+bool OutputSink::flush() {
+    if (target_ || blocks_.empty()) return !failed_;
+    
+    std::vector<struct iovec> iov(blocks_.size());
+    for (size_t i = 0; i < blocks_.size(); i++) {
+        iov[i].iov_base = &blocks_[i][0];
+        iov[i].iov_len = blocks_[i].size();
+    }
+    
+    size_t first = 0;
+    while (first < iov.size() && !failed_) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t n = writev(fd_, &iov[first], count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            failed_ = true;
+            break;
+        }
+        
+        // Skip fully written blocks and advance into a partially written one.
+        while (first < iov.size() && static_cast<size_t>(n) >= iov[first].iov_len) {
+            n -= iov[first].iov_len;
+            first++;
+        }
+        if (first < iov.size()) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + n;
+            iov[first].iov_len -= n;
+        }
+    }
+    
+    blocks_.clear();
+    return !failed_;
+}
+
+OutputSink& OutputSink::operator<<(std::string_view text) {
+    write(text.data(), text.size());
+    return *this;
+}
+
+OutputSink& OutputSink::operator<<(char c) {
+    write(&c, 1);
+    return *this;
+}
+
+OutputSink& OutputSink::operator<<(int value) {
+    return *this << static_cast<long>(value);
+}
+
+OutputSink& OutputSink::operator<<(long value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    write(buffer, result.ptr - buffer);
+    return *this;
+}
+
+OutputSink& OutputSink::operator<<(unsigned long value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    write(buffer, result.ptr - buffer);
+    return *this;
+}
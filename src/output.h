@@ -0,0 +1,47 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+// Buffered writer used by builtins. Output is collected in fixed-size
+// blocks and handed to the kernel with a single writev() when flushed,
+// either to a file descriptor or, for command substitution, to a string.
+class OutputSink {
+public:
+    explicit OutputSink(int fd, bool owns_fd = false);
+    explicit OutputSink(std::string& target);
+    ~OutputSink();
+    
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+    
+    static std::unique_ptr<OutputSink> open_file(const std::string& path, bool append);
+    
+    void write(const char* data, size_t length);
+    bool flush();
+    int fd() const { return fd_; }
+    bool failed() const { return failed_; }
+    
+    OutputSink& operator<<(std::string_view text);
+    OutputSink& operator<<(const std::string& text) { return *this << std::string_view(text); }
+    OutputSink& operator<<(const char* text) { return *this << std::string_view(text); }
+    OutputSink& operator<<(char c);
+    OutputSink& operator<<(int value);
+    OutputSink& operator<<(long value);
+    OutputSink& operator<<(unsigned long value);
+    
+private:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+    static const size_t MAX_BLOCKS = 16;
+    
+    int fd_;
+    bool owns_fd_;
+    std::string* target_;
+    std::vector<std::string> blocks_;
+    bool failed_;
+};
+
+#endif // OUTPUT_H
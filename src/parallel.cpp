@@ -0,0 +1,334 @@
+#include "parallel.h"
+#include "command_hash.h"
+#include "job_control.h"
+#include "launch.h"
+#include "shell.h"
+#include "timing.h"
+#include <deque>
+#include <unordered_map>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Output a -k task may hold before its pipe stops being read; the task then
+// blocks until it reaches the head of the queue.
+static const size_t task_buffer_limit = 1 << 20;
+
+struct Task {
+    size_t index;
+    std::string text;
+    pid_t pid = -1;
+    int out_fd = -1;
+    std::string buffer;
+    bool exited = false;
+    int status = 0;
+};
+
+static void expand_template(const std::vector<std::string>& command, const std::string& item,
+                            std::vector<std::string>& argv) {
+    argv.clear();
+    bool substituted = false;
+    for (const auto& word : command) {
+        std::string arg;
+        size_t start = 0;
+        size_t pos;
+        while ((pos = word.find("{}", start)) != std::string::npos) {
+            arg.append(word, start, pos - start);
+            arg += item;
+            start = pos + 2;
+            substituted = true;
+        }
+        arg.append(word, start, std::string::npos);
+        argv.push_back(std::move(arg));
+    }
+    if (!substituted) {
+        argv.push_back(item);
+    }
+}
+
+class Scheduler {
+public:
+    Scheduler(const ParallelOptions& options, const std::vector<std::string>& items,
+              OutputSink& out, OutputSink& err)
+        : options_(options), items_(items), out_(out), err_(err) {}
+    
+    int run();
+
+private:
+    bool launch_next();
+    void finish(Task& task, int status);
+    void collect_output();
+    void reap(int flags);
+    void suspend(pid_t pid, int status);
+    void emit_finished();
+    
+    const ParallelOptions& options_;
+    const std::vector<std::string>& items_;
+    OutputSink& out_;
+    OutputSink& err_;
+    std::string path_;
+    size_t next_ = 0;
+    size_t running_ = 0;
+    size_t failed_ = 0;
+    bool interrupted_ = false;
+    bool stopped_ = false;
+    bool foreground_ = false;                      // the tasks' group holds the terminal
+    pid_t pgid_ = 0;                               // shared by the running tasks, 0 for none
+    std::deque<Task> pending_;                     // launched, output not yet emitted
+    std::unordered_map<pid_t, size_t> running_tasks_;  // pid -> task index
+};
+
+bool Scheduler::launch_next() {
+    Task task;
+    task.index = next_;
+    
+    std::vector<std::string> words;
+    expand_template(options_.command, items_[next_++], words);
+    
+    LaunchSpec spec;
+    spec.path = path_;
+    for (auto& word : words) {
+        if (!task.text.empty()) task.text += ' ';
+        task.text += word;
+        spec.argv.push_back(const_cast<char*>(word.c_str()));
+    }
+    spec.argv.push_back(nullptr);
+    spec.input_fd = options_.input_fd;
+    spec.output_fd = out_.fd();
+    // Tasks get a group of their own, like any foreground job, so Ctrl-C
+    // and Ctrl-Z reach every running one and not the shell.
+    if (shell_is_interactive) {
+        spec.pgid = pgid_;
+        spec.foreground = foreground_;
+    }
+    
+    int pipefd[2] = {-1, -1};
+    if (options_.keep_order) {
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            err_ << "parallel: " << strerror(errno) << '\n';
+            return false;
+        }
+        spec.output_fd = pipefd[1];
+    }
+    
+    int launch_err = 0;
+    task.pid = launch_process(spec, launch_err);
+    if (pipefd[1] != -1) close(pipefd[1]);
+    
+    if (task.pid < 0) {
+        if (pipefd[0] != -1) close(pipefd[0]);
+        err_ << "parallel: " << path_ << ": " << strerror(launch_err) << '\n';
+        return false;
+    }
+    
+    if (shell_is_interactive) {
+        if (pgid_ == 0) pgid_ = task.pid;
+        setpgid(task.pid, pgid_);
+    }
+    
+    task.out_fd = pipefd[0];
+    running_tasks_[task.pid] = task.index;
+    running_++;
+    pending_.push_back(std::move(task));
+    return true;
+}
+
+void Scheduler::finish(Task& task, int status) {
+    task.exited = true;
+    task.status = exit_status_from_wait(status);
+    // Once every member is reaped the group is gone; the next task starts another.
+    if (--running_ == 0) pgid_ = 0;
+    
+    if (task.status != 0) {
+        failed_++;
+        if (!options_.keep_order) {
+            err_ << "parallel: [" << task.index + 1 << "] " << task.text
+                 << ": exit " << task.status << '\n';
+            err_.flush();
+        }
+    }
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) {
+        interrupted_ = true;
+    }
+}
+
+// Reaps finished tasks. Other children of the shell (background jobs) are
+// handed to job control rather than being lost.
+void Scheduler::reap(int flags) {
+    int status;
+    pid_t pid;
+    while ((pid = wait_child(-1, &status, flags | WUNTRACED)) > 0) {
+        auto it = running_tasks_.find(pid);
+        if (it == running_tasks_.end()) {
+            update_job_status(pid, status);
+            continue;
+        }
+        if (WIFSTOPPED(status)) {
+            suspend(pid, status);
+            return;
+        }
+        
+        size_t offset = it->second - pending_.front().index;
+        running_tasks_.erase(it);
+        finish(pending_[offset], status);
+        if (flags == 0) break;
+    }
+}
+
+// Ctrl-Z stopped the tasks' group. The shell cannot suspend a builtin, so
+// the running tasks become a stopped job for fg and bg, and no more are
+// launched. Output still buffered for -k is written out; the rest of theirs
+// is lost.
+void Scheduler::suspend(pid_t pid, int status) {
+    std::vector<pid_t> pids;
+    std::string text;
+    for (Task& task : pending_) {
+        if (!task.exited) {
+            pids.push_back(task.pid);
+            if (!text.empty()) text += " & ";
+            text += task.text;
+        }
+        if (!task.buffer.empty()) {
+            out_.write(task.buffer.data(), task.buffer.size());
+            task.buffer.clear();
+        }
+        if (task.out_fd != -1) close(task.out_fd);
+    }
+    out_.flush();
+    
+    add_job(pgid_, text, pids, false);
+    update_job_status(pid, status);
+    // The rest of the group stops too; only exits change the job.
+    for (pid_t member : pids) {
+        int member_status;
+        if (member != pid && wait_child(member, &member_status, WUNTRACED) > 0 && !WIFSTOPPED(member_status)) {
+            update_job_status(member, member_status);
+        }
+    }
+    
+    size_t skipped = items_.size() - next_;
+    if (skipped > 0) {
+        err_ << "parallel: stopped; " << skipped << " items not started" << '\n';
+        err_.flush();
+    }
+    pending_.clear();
+    running_tasks_.clear();
+    running_ = 0;
+    stopped_ = true;
+}
+
+// Reads whatever the -k tasks have written. The head task is streamed;
+// later tasks are buffered up to task_buffer_limit.
+void Scheduler::collect_output() {
+    std::vector<struct pollfd> fds;
+    std::vector<Task*> owners;
+    for (Task& task : pending_) {
+        if (task.out_fd == -1) continue;
+        if (&task != &pending_.front() && task.buffer.size() >= task_buffer_limit) continue;
+        fds.push_back({task.out_fd, POLLIN, 0});
+        owners.push_back(&task);
+    }
+    
+    if (fds.empty()) {
+        reap(0);
+        return;
+    }
+    
+    if (poll(fds.data(), fds.size(), -1) == -1) return;
+    
+    char chunk[65536];
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (!fds[i].revents) continue;
+        Task& task = *owners[i];
+        
+        ssize_t n = read(task.out_fd, chunk, sizeof(chunk));
+        if (n > 0) {
+            if (&task == &pending_.front()) {
+                out_.write(chunk, n);
+                out_.flush();
+            } else {
+                task.buffer.append(chunk, n);
+            }
+        } else if (n == 0 || errno != EINTR) {
+            close(task.out_fd);
+            task.out_fd = -1;
+        }
+    }
+    reap(WNOHANG);
+}
+
+void Scheduler::emit_finished() {
+    while (!pending_.empty()) {
+        Task& head = pending_.front();
+        if (!head.buffer.empty()) {
+            out_.write(head.buffer.data(), head.buffer.size());
+            head.buffer.clear();
+            out_.flush();
+        }
+        if (!head.exited || head.out_fd != -1) break;
+        
+        if (options_.keep_order && head.status != 0) {
+            err_ << "parallel: [" << head.index + 1 << "] " << head.text
+                 << ": exit " << head.status << '\n';
+            err_.flush();
+        }
+        pending_.pop_front();
+    }
+}
+
+int Scheduler::run() {
+    path_ = hash_lookup(options_.command[0]);
+    if (path_.empty()) {
+        err_ << "parallel: " << options_.command[0] << ": command not found" << '\n';
+        return 127;
+    }
+    
+    // Children write straight to our fd, so anything buffered goes first.
+    out_.flush();
+    foreground_ = shell_is_interactive && tcgetpgrp(STDIN_FILENO) == shell_pgid;
+    
+    // With -k, finished tasks wait in memory for their turn; cap how far
+    // ahead of the head task the scheduler may run.
+    size_t window = options_.keep_order ? options_.slots * 2 : SIZE_MAX;
+    
+    while (true) {
+        while (!interrupted_ && !stopped_ && next_ < items_.size() && running_ < options_.slots &&
+               pending_.size() < window) {
+            if (!launch_next()) {
+                interrupted_ = true;
+                failed_++;
+            }
+        }
+        
+        if (pending_.empty()) break;
+        
+        if (options_.keep_order) {
+            collect_output();
+        } else {
+            reap(0);
+        }
+        emit_finished();
+    }
+    
+    if (foreground_) tcsetpgrp(STDIN_FILENO, shell_pgid);
+    if (stopped_) return 128 + SIGTSTP;
+    return failed_ > 101 ? 101 : static_cast<int>(failed_);
+}
+
+int run_parallel(const ParallelOptions& options, const std::vector<std::string>& items,
+                 OutputSink& out, OutputSink& err) {
+    if (items.empty()) return 0;
+    
+    ParallelOptions effective = options;
+    // A string sink has no fd for children to write to.
+    if (out.fd() == -1) {
+        effective.keep_order = true;
+    }
+    
+    Scheduler scheduler(effective, items, out, err);
+    return scheduler.run();
+}
@@ -0,0 +1,18 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "output.h"
+#include <string>
+#include <vector>
+
+struct ParallelOptions {
+    std::vector<std::string> command;  // may contain {} placeholders
+    size_t slots = 1;
+    bool keep_order = false;
+    int input_fd = -1;                 // stdin for every task, -1 to inherit
+};
+
+int run_parallel(const ParallelOptions& options, const std::vector<std::string>& items,
+                 OutputSink& out, OutputSink& err);
+
+#endif // PARALLEL_H
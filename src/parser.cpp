@@ -2,55 +2,267 @@
 #include "executor.h"
 #include "heredoc.h"
 #include "utils.h"
+#include "timing.h"
+#include "trace.h"
+#include "variables.h"
+#include "script_input.h"
+#include "arithmetic.h"
+#include "job_control.h"
+#include "shell.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <readline/readline.h>
 
-std::string execute_for_output(const std::string& cmd);
+void* Arena::allocate(size_t size, size_t align) {
+    size_t pad = (-reinterpret_cast<uintptr_t>(cursor_)) & (align - 1);
+    
+    if (!cursor_ || pad + size > remaining_) {
+        size_t block_size = std::max(next_block_size_, size + align);
+        blocks_.emplace_back(new char[block_size]);
+        cursor_ = blocks_.back().get();
+        remaining_ = block_size;
+        next_block_size_ = std::min<size_t>(next_block_size_ * 2, 1 << 20);
+        pad = (-reinterpret_cast<uintptr_t>(cursor_)) & (align - 1);
+    }
+    
+    void* result = cursor_ + pad;
+    cursor_ += pad + size;
+    remaining_ -= pad + size;
+    return result;
+}
 
-std::string expand_command_substitution(const std::string& input) {
-    std::string result;
+std::string_view Arena::store(std::string_view text) {
+    char* copy = make_array<char>(text.size() + 1);
+    if (!text.empty()) {
+        std::memcpy(copy, text.data(), text.size());
+    }
+    copy[text.size()] = '\0';
+    return std::string_view(copy, text.size());
+}
+
+static bool is_word_break(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '|' || c == '&' || c == ';' || c == '<' || c == '>' ||
+           c == '(' || c == ')';
+}
+
+// Backslash keeps its special meaning inside double quotes only before these.
+static bool is_dquote_escapable(char c) {
+    return c == '\\' || c == '"' || c == '$' || c == '`';
+}
+
+// Characters that can follow '$' to start a parameter expansion.
+static bool is_parameter_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '{' || c == '?' || c == '$' ||
+           c == '!';
+}
+
+// Returns the index of the ')' closing a "$(" whose body starts at `start`.
+size_t find_substitution_end(std::string_view text, size_t start) {
+    int depth = 1;
     bool in_single_quote = false;
     bool in_double_quote = false;
     
-    for (size_t i = 0; i < input.length(); i++) {
-        if (input[i] == '\'' && !in_double_quote) {
-            in_single_quote = !in_single_quote;
-            result += input[i];
-        } else if (input[i] == '"' && !in_single_quote) {
+    for (size_t i = start; i < text.size(); i++) {
+        char c = text[i];
+        
+        if (in_single_quote) {
+            if (c == '\'') in_single_quote = false;
+        } else if (c == '\\') {
+            i++;
+        } else if (c == '\'' && !in_double_quote) {
+            in_single_quote = true;
+        } else if (c == '"') {
             in_double_quote = !in_double_quote;
-            result += input[i];
-        } else if (input[i] == '$' && i + 1 < input.length() && input[i + 1] == '(' && !in_single_quote) {
-            size_t start = i + 2;
-            int depth = 1;
-            size_t end = start;
-            
-            while (end < input.length() && depth > 0) {
-                if (input[end] == '(') depth++;
-                else if (input[end] == ')') depth--;
-                if (depth > 0) end++;
-            }
-            
-            if (depth == 0) {
-                std::string cmd = input.substr(start, end - start);
-                std::string output = execute_for_output(cmd);
-                result += output;
-                i = end;
+        } else if (in_double_quote) {
+            continue;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return i;
+        }
+    }
+    
+    return std::string_view::npos;
+}
+
+// Quote removal into `out`, which must hold at least raw.size() chars.
+static size_t unquote_into(std::string_view raw, char* out) {
+    size_t n = 0;
+    bool in_single_quote = false;
+    bool in_double_quote = false;
+    
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
+        
+        if (in_single_quote) {
+            if (c == '\'') {
+                in_single_quote = false;
             } else {
-                result += input[i];
+                out[n++] = c;
+            }
+        } else if (c == '\\' && i + 1 < raw.size()) {
+            char next = raw[++i];
+            if (in_double_quote && !is_dquote_escapable(next)) {
+                out[n++] = '\\';
             }
+            out[n++] = next;
+        } else if (c == '\'' && !in_double_quote) {
+            in_single_quote = true;
+        } else if (c == '"') {
+            in_double_quote = !in_double_quote;
         } else {
-            result += input[i];
+            out[n++] = c;
         }
     }
     
-    return result;
+    return n;
+}
+
+Word Lexer::scan_word(bool& quoted) {
+    size_t start = pos_;
+    bool needs_unquote = false;
+    bool needs_expansion = false;
+    bool in_single_quote = false;
+    bool in_double_quote = false;
+    
+    while (pos_ < input_.size()) {
+        char c = input_[pos_];
+        
+        if (in_single_quote) {
+            if (c == '\'') in_single_quote = false;
+            pos_++;
+        } else if (c == '\\') {
+            needs_unquote = true;
+            pos_ = std::min(pos_ + 2, input_.size());
+        } else if (c == '\'' && !in_double_quote) {
+            in_single_quote = true;
+            needs_unquote = true;
+            pos_++;
+        } else if (c == '"') {
+            in_double_quote = !in_double_quote;
+            needs_unquote = true;
+            pos_++;
+        } else if (c == '$' && pos_ + 1 < input_.size() && input_[pos_ + 1] == '(') {
+            size_t end = find_substitution_end(input_, pos_ + 2);
+            needs_expansion = true;
+            pos_ = end == std::string_view::npos ? input_.size() : end + 1;
+        } else if (c == '$' && pos_ + 1 < input_.size() && is_parameter_start(input_[pos_ + 1])) {
+            needs_expansion = true;
+            pos_++;
+        } else if (!in_double_quote && is_word_break(c)) {
+            break;
+        } else {
+            pos_++;
+        }
+    }
+    
+    std::string_view raw = input_.substr(start, pos_ - start);
+    quoted = needs_unquote;
+    open_quote_ = in_single_quote ? '\'' : in_double_quote ? '"' : 0;
+    
+    if (needs_expansion || !needs_unquote) {
+        return {raw, needs_expansion};
+    }
+    
+    char* cooked = arena_.make_array<char>(raw.size());
+    size_t length = unquote_into(raw, cooked);
+    return {std::string_view(cooked, length), false};
+}
+
+Token Lexer::next() {
+    open_quote_ = 0;
+    while (pos_ < input_.size() && (input_[pos_] == ' ' || input_[pos_] == '\t')) {
+        pos_++;
+    }
+    
+    if (pos_ < input_.size() && input_[pos_] == '#') {
+        while (pos_ < input_.size() && input_[pos_] != '\n') {
+            pos_++;
+        }
+    }
+    
+    if (pos_ >= input_.size()) {
+        return {TokenType::END, RedirKind::INPUT, {"newline", false}};
+    }
+    
+    size_t start = pos_;
+    char c = input_[pos_];
+    char next = pos_ + 1 < input_.size() ? input_[pos_ + 1] : '\0';
+    auto op = [&](TokenType type, RedirKind kind, size_t length) {
+        pos_ += length;
+        return Token{type, kind, {input_.substr(start, length), false}};
+    };
+    
+    if (c == '\n') {
+        pos_++;
+        return {TokenType::LINEBREAK, RedirKind::INPUT, {"newline", false}};
+    }
+    if (c == '|') {
+        if (next == '|') return op(TokenType::OR_IF, RedirKind::INPUT, 2);
+        return op(TokenType::PIPE, RedirKind::INPUT, 1);
+    }
+    if (c == '&') {
+        if (next == '&') return op(TokenType::AND_IF, RedirKind::INPUT, 2);
+        return op(TokenType::AMPERSAND, RedirKind::INPUT, 1);
+    }
+    if (c == ';') {
+        if (next == ';') return op(TokenType::DSEMI, RedirKind::INPUT, 2);
+        return op(TokenType::SEMI, RedirKind::INPUT, 1);
+    }
+    if (c == '(') return op(TokenType::LPAREN, RedirKind::INPUT, 1);
+    if (c == ')') return op(TokenType::RPAREN, RedirKind::INPUT, 1);
+    
+    if (c == '<') {
+        if (next == '<') return op(TokenType::REDIRECT, RedirKind::HEREDOC, 2);
+        return op(TokenType::REDIRECT, RedirKind::INPUT, 1);
+    }
+    
+    if (c == '>') {
+        if (next == '>') return op(TokenType::REDIRECT, RedirKind::APPEND, 2);
+        return op(TokenType::REDIRECT, RedirKind::OUTPUT, 1);
+    }
+    
+    if ((c == '1' || c == '2') && next == '>') {
+        bool append = pos_ + 2 < input_.size() && input_[pos_ + 2] == '>';
+        if (c == '1') {
+            return append ? op(TokenType::REDIRECT, RedirKind::APPEND, 3)
+                          : op(TokenType::REDIRECT, RedirKind::OUTPUT, 2);
+        }
+        return append ? op(TokenType::REDIRECT, RedirKind::ERROR_APPEND, 3)
+                      : op(TokenType::REDIRECT, RedirKind::ERROR, 2);
+    }
+    
+    bool quoted = false;
+    Token token{TokenType::WORD, RedirKind::INPUT, scan_word(quoted)};
+    token.quoted = quoted;
+    token.raw = input_.substr(start, pos_ - start);
+    token.assignment = assignment_name_length(input_.substr(start, pos_ - start)) > 0;
+    return token;
+}
+
+static void strip_trailing_newlines(std::string& output) {
+    while (!output.empty() && output.back() == '\n') {
+        output.pop_back();
+    }
 }
 
 std::string execute_for_output(const std::string& cmd) {
+    TraceSpan span("substitution", cmd);
+    std::string output;
+    if (capture_builtin_output(cmd, output)) {
+        last_substitution_status = last_exit_status;
+        strip_trailing_newlines(output);
+        return output;
+    }
+    
     int pipefd[2];
     if (pipe(pipefd) == -1) return "";
     
     pid_t pid = fork();
+    if (pid > 0) span.set_track(pid);
     if (pid == 0) {
         close(pipefd[0]);
         dup2(pipefd[1], STDOUT_FILENO);
@@ -60,258 +272,773 @@ std::string execute_for_output(const std::string& cmd) {
         exit(0);
     } else if (pid > 0) {
         close(pipefd[1]);
-        std::string output;
         char buffer[4096];
         ssize_t n;
         while ((n = read(pipefd[0], buffer, sizeof(buffer))) > 0) {
             output.append(buffer, n);
         }
         close(pipefd[0]);
-        waitpid(pid, nullptr, 0);
+        int status = 0;
+        wait_child(pid, &status, 0);
+        last_exit_status = last_substitution_status = exit_status_from_wait(status);
         
-        if (!output.empty() && output.back() == '\n') {
-            output.pop_back();
-        }
+        strip_trailing_newlines(output);
         return output;
     }
+    close(pipefd[0]);
+    close(pipefd[1]);
     return "";
 }
 
-std::vector<std::string> parse_arguments(const std::string& input) {
-    std::string expanded = expand_command_substitution(input);
+// Expands a word at execution time: quote removal, parameter expansion,
+// command substitution and, for unquoted expansions, splitting the result
+// into separate fields (not done for assignments, where split is false).
+// With `pattern`, quoted glob characters come out backslash-escaped.
+static void expand_word_into(const Word& word, std::vector<std::string>& out, bool split, bool pattern) {
+    if (!word.needs_expansion) {
+        out.emplace_back(word.text);
+        return;
+    }
     
-    std::vector<std::string> args;
+    std::string_view raw = word.text;
     std::string current;
-    bool in_single_quote = false;
+    bool has_field = false;
     bool in_double_quote = false;
-    bool escaped = false;
     
-    for (size_t i = 0; i < expanded.length(); i++) {
-        char c = expanded[i];
-        
-        if (escaped) {
-            current += c;
-            escaped = false;
-            continue;
+    auto append_quoted = [&](char c) {
+        if (pattern && (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')) current += '\\';
+        current += c;
+    };
+    
+    auto append_expansion = [&](const std::string& value) {
+        if (in_double_quote && pattern) {
+            for (char vc : value) {
+                append_quoted(vc);
+            }
+            return;
         }
-        
-        if (c == '\\' && !in_single_quote) {
-            escaped = true;
-            continue;
+        if (in_double_quote || !split) {
+            current += value;
+            return;
         }
-        
-        if (c == '\'' && !in_double_quote) {
-            in_single_quote = !in_single_quote;
-            continue;
+        for (char vc : value) {
+            if (vc == ' ' || vc == '\t' || vc == '\n') {
+                if (has_field || !current.empty()) {
+                    out.push_back(std::move(current));
+                    current.clear();
+                    has_field = false;
+                }
+            } else {
+                current += vc;
+            }
         }
+    };
+    
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
         
-        if (c == '"' && !in_single_quote) {
+        if (c == '\'' && !in_double_quote) {
+            size_t end = raw.find('\'', i + 1);
+            if (end == std::string_view::npos) end = raw.size();
+            for (size_t j = i + 1; j < end; j++) {
+                append_quoted(raw[j]);
+            }
+            has_field = true;
+            i = end;
+        } else if (c == '"') {
             in_double_quote = !in_double_quote;
-            continue;
-        }
-        
-        if ((c == ' ' || c == '\t') && !in_single_quote && !in_double_quote) {
-            if (!current.empty()) {
-                args.push_back(current);
-                current.clear();
+            has_field = true;
+        } else if (c == '\\' && i + 1 < raw.size()) {
+            char next = raw[++i];
+            if (in_double_quote && !is_dquote_escapable(next)) {
+                append_quoted('\\');
+            }
+            append_quoted(next);
+        } else if (c == '$' && i + 1 < raw.size() && raw[i + 1] == '(') {
+            size_t end = find_substitution_end(raw, i + 2);
+            if (end == std::string_view::npos) end = raw.size();
+            // $((expression)) unless the inner parentheses close early, as in $((cmd) | cmd).
+            if (end < raw.size() && end > i + 3 && raw[i + 2] == '(' && raw[end - 1] == ')') {
+                append_expansion(expand_arithmetic(raw.substr(i + 3, end - i - 4)));
+            } else {
+                append_expansion(execute_for_output(std::string(raw.substr(i + 2, end - i - 2))));
+            }
+            i = end;
+        } else if (c == '$') {
+            std::string value;
+            if (expand_parameter(raw, i, value)) {
+                append_expansion(value);
+            } else {
+                current += c;
             }
+        } else if (in_double_quote) {
+            append_quoted(c);
         } else {
             current += c;
         }
     }
     
-    if (!current.empty()) {
-        args.push_back(current);
+    if (has_field || !current.empty()) {
+        out.push_back(std::move(current));
     }
-    
-    return args;
 }
 
-std::pair<std::vector<std::string>, RedirectionConfig> parse_redirection(const std::vector<std::string>& parts) {
-    std::vector<std::string> filtered;
-    RedirectionConfig redir;
+void expand_word(const Word& word, std::vector<std::string>& out, bool split) {
+    expand_word_into(word, out, split, false);
+}
+
+// A `case` pattern for fnmatch(): quoted parts match literally, unquoted
+// expansions keep their glob characters.
+std::string expand_pattern(const Word& word) {
+    std::vector<std::string> fields;
+    expand_word_into(word, fields, false, true);
+    return fields.empty() ? std::string() : std::move(fields[0]);
+}
+
+static bool expand_words(const ASTNode* node, std::string& command, std::vector<std::string>& args,
+                         RedirectionConfig& redir, std::vector<std::string>* assignments) {
+    if (assignments) {
+        // Left to right, each value seeing the assignments before it; the
+        // command's own words do not see them.
+        assignments->clear();
+        size_t mark = pending_assignment_mark();
+        for (const Word& word : node->assigns) {
+            expand_word(word, *assignments, false);
+            push_pending_assignment(assignments->back());
+        }
+        drop_pending_assignments(mark);
+    }
     
-    for (size_t i = 0; i < parts.size(); i++) {
-        std::string token = parts[i];
-        std::string next_token = (i + 1 < parts.size()) ? parts[i + 1] : "";
-        
-        if (token == "<<") {
+    args.clear();
+    for (const Word& word : node->words) {
+        expand_word(word, args);
+    }
+    
+    command.clear();
+    if (!args.empty()) {
+        command = std::move(args.front());
+        args.erase(args.begin());
+    }
+    
+    std::vector<std::string> target;
+    for (const Redirect& r : node->redirs) {
+        if (r.kind == RedirKind::HEREDOC) {
             redir.use_heredoc = true;
-            redir.heredoc_delimiter = next_token;
-            i++;
+            redir.heredoc_delimiter = std::string(r.target.text);
+            redir.heredoc_fd = r.heredoc_fd;
             continue;
         }
         
-        if (token == "<") {
-            redir.stdin_file = next_token;
-            i++;
-            continue;
+        target.clear();
+        expand_word(r.target, target);
+        if (target.size() != 1) {
+            std::cerr << r.target.text << ": ambiguous redirect" << std::endl;
+            return false;
         }
         
-        if (token == ">" || token == "1>") {
-            redir.stdout_file = next_token;
-            redir.stdout_append = false;
-            i++;
-        } else if (token == ">>" || token == "1>>") {
-            redir.stdout_file = next_token;
-            redir.stdout_append = true;
-            i++;
-        } else if (token == "2>") {
-            redir.stderr_file = next_token;
-            redir.stderr_append = false;
-            i++;
-        } else if (token == "2>>") {
-            redir.stderr_file = next_token;
-            redir.stderr_append = true;
-            i++;
-        } else if (token.substr(0, 2) == "<<") {
-            if (token.length() > 2) {
-                redir.use_heredoc = true;
-                redir.heredoc_delimiter = token.substr(2);
-            }
-        } else if (token.substr(0, 2) == "2>>" || token.substr(0, 3) == "1>>") {
-            size_t op_len = (token[0] == '2') ? 3 : 3;
-            if (token.length() > op_len) {
-                std::string filename = token.substr(op_len);
-                if (token[0] == '2') {
-                    redir.stderr_file = filename;
-                    redir.stderr_append = true;
-                } else {
-                    redir.stdout_file = filename;
-                    redir.stdout_append = true;
-                }
-            }
-        } else if (token.substr(0, 2) == "2>" || token.substr(0, 2) == "1>" || token.substr(0, 2) == ">>") {
-            size_t op_len = 2;
-            if (token.length() > op_len) {
-                std::string filename = token.substr(op_len);
-                if (token[0] == '2') {
-                    redir.stderr_file = filename;
-                    redir.stderr_append = false;
-                } else if (token[0] == '1') {
-                    redir.stdout_file = filename;
-                    redir.stdout_append = false;
-                } else {
-                    redir.stdout_file = filename;
-                    redir.stdout_append = true;
-                }
-            }
-        } else if (token.substr(0, 1) == ">") {
-            if (token.length() > 1) {
-                std::string filename = token.substr(1);
-                redir.stdout_file = filename;
-                redir.stdout_append = false;
-            }
-        } else {
-            filtered.push_back(token);
+        switch (r.kind) {
+            case RedirKind::INPUT:
+                redir.stdin_file = std::move(target[0]);
+                break;
+            case RedirKind::OUTPUT:
+            case RedirKind::APPEND:
+                redir.stdout_file = std::move(target[0]);
+                redir.stdout_append = r.kind == RedirKind::APPEND;
+                break;
+            case RedirKind::ERROR:
+            case RedirKind::ERROR_APPEND:
+                redir.stderr_file = std::move(target[0]);
+                redir.stderr_append = r.kind == RedirKind::ERROR_APPEND;
+                break;
+            case RedirKind::HEREDOC:
+                break;
         }
     }
     
-    return {filtered, redir};
+    return true;
 }
 
-std::vector<std::string> parse_pipeline(const std::string& input) {
-    std::vector<std::string> commands;
-    std::string current;
-    bool in_single_quote = false;
-    bool in_double_quote = false;
-    bool escaped = false;
+bool expand_command(const ASTNode* node, std::string& command, std::vector<std::string>& args,
+                    RedirectionConfig& redir, std::vector<std::string>* assignments) {
+    // Substitutions run commands of their own, which must not clear a
+    // failure their caller has already seen.
+    bool outer_failed = expansion_failed;
+    expansion_failed = false;
+    bool expanded = expand_words(node, command, args, redir, assignments);
+    if (expansion_failed) expanded = false;
+    expansion_failed = outer_failed;
+    return expanded;
+}
+
+template <typename T>
+static Span<T> copy_to_arena(Arena& arena, const std::vector<T>& items) {
+    Span<T> span;
+    if (items.empty()) return span;
+    span.data = arena.make_array<T>(items.size());
+    span.size = items.size();
+    std::copy(items.begin(), items.end(), span.data);
+    return span;
+}
+
+ParseTree::~ParseTree() {
+    for (int fd : heredoc_fds) {
+        close(fd);
+    }
+}
+
+// Reserved words only count unquoted and in command position.
+static bool is_reserved(const Token& token, std::string_view word) {
+    return token.type == TokenType::WORD && !token.quoted && !token.word.needs_expansion &&
+           token.word.text == word;
+}
+
+static bool closes_compound_list(const Token& token) {
+    if (token.type == TokenType::DSEMI || token.type == TokenType::RPAREN) return true;
+    if (token.type != TokenType::WORD || token.quoted || token.word.needs_expansion) return false;
+    std::string_view word = token.word.text;
+    return word == "then" || word == "elif" || word == "else" || word == "fi" || word == "do" ||
+           word == "done" || word == "esac" || word == "}";
+}
+
+// Recursive descent over the POSIX list grammar. Nodes of unfinished lists
+// and pipelines wait on a scratch stack shared by every level (parsing never
+// re-enters itself; substitutions are parsed when they run) and are copied
+// into the arena once their construct is complete.
+class Parser {
+public:
+    Parser(ParseTree& tree, std::string_view input, bool read_more)
+        : arena_(tree.arena), heredoc_fds_(tree.heredoc_fds), lexer_(input, tree.arena),
+          read_more_(read_more) {
+        advance();
+    }
     
-    for (char c : input) {
-        if (escaped) {
-            current += c;
-            escaped = false;
-            continue;
+    ASTNode* parse_program();
+    bool failed() const { return failed_; }
+
+private:
+    void advance();
+    bool read_line(std::string& line);
+    bool read_continuation();
+    void skip_newlines(bool incomplete);
+    bool expect(std::string_view word);
+    ASTNode* error();
+    ASTNode* make_node(NodeType type);
+    Span<ASTNode*> pop_children(size_t base);
+    Span<ASTNode*> children_of(ASTNode* child);
+    
+    ASTNode* parse_list(bool nested);
+    ASTNode* parse_body();
+    ASTNode* parse_and_or();
+    ASTNode* parse_pipeline();
+    ASTNode* parse_command();
+    ASTNode* parse_simple_command();
+    bool parse_redirect();
+    ASTNode* parse_redirected(ASTNode* compound);
+    ASTNode* parse_if();
+    ASTNode* parse_loop();
+    ASTNode* parse_for();
+    ASTNode* parse_case();
+    
+    static std::vector<ASTNode*> nodes_;
+    static std::vector<Word> words_;
+    static std::vector<Word> assigns_;
+    static std::vector<Redirect> redirs_;
+    
+    Arena& arena_;
+    std::vector<int>& heredoc_fds_;
+    Lexer lexer_;
+    Token token_;
+    bool read_more_;
+    bool at_eof_ = false;
+    bool failed_ = false;
+};
+
+std::vector<ASTNode*> Parser::nodes_;
+std::vector<Word> Parser::words_;
+std::vector<Word> Parser::assigns_;
+std::vector<Redirect> Parser::redirs_;
+
+// Reads the next line from the script, or with a "> " prompt, the way
+// heredoc bodies are read.
+bool Parser::read_line(std::string& line) {
+    if (!read_more_ || at_eof_) return false;
+    
+    if (script_input) {
+        at_eof_ = !script_input->read_line(line);
+    } else {
+        char* input = readline("> ");
+        at_eof_ = !input;
+        if (input) {
+            line = input;
+            free(input);
+        }
+    }
+    return !at_eof_;
+}
+
+// A word with an open quote takes in the following lines until it closes.
+void Parser::advance() {
+    token_ = lexer_.next();
+    
+    std::string line;
+    while (char quote = lexer_.open_quote()) {
+        if (!read_line(line)) {
+            std::cerr << "unexpected EOF while looking for matching `" << quote << "'" << std::endl;
+            at_eof_ = true;
+            token_ = {TokenType::END, RedirKind::INPUT, {"newline", false}};
+            error();
+            return;
         }
+        lexer_.feed(arena_.store(std::string(token_.raw) + "\n" + line));
+        token_ = lexer_.next();
+    }
+}
+
+// The input ran out in the middle of a command: carry on with its next line.
+bool Parser::read_continuation() {
+    if (token_.type != TokenType::END) return false;
+    
+    std::string line;
+    if (!read_line(line)) return false;
+    
+    lexer_.feed(arena_.store(line));
+    advance();
+    return true;
+}
+
+// Skips newlines. Where the command is still incomplete, the end of the
+// input counts as one and parsing carries on with the next line.
+void Parser::skip_newlines(bool incomplete) {
+    while (true) {
+        if (token_.type == TokenType::LINEBREAK) {
+            advance();
+        } else if (!incomplete || !read_continuation()) {
+            return;
+        }
+    }
+}
+
+bool Parser::expect(std::string_view word) {
+    if (!is_reserved(token_, word)) {
+        error();
+        return false;
+    }
+    advance();
+    return true;
+}
+
+ASTNode* Parser::error() {
+    if (!failed_) {
+        if (token_.type == TokenType::END && at_eof_) {
+            std::cerr << "syntax error: unexpected end of file" << std::endl;
+        } else {
+            std::cerr << "syntax error near unexpected token `" << token_.word.text << "'" << std::endl;
+        }
+    }
+    failed_ = true;
+    return nullptr;
+}
+
+ASTNode* Parser::make_node(NodeType type) {
+    ASTNode* node = arena_.make<ASTNode>();
+    node->type = type;
+    return node;
+}
+
+Span<ASTNode*> Parser::pop_children(size_t base) {
+    Span<ASTNode*> span;
+    span.size = nodes_.size() - base;
+    if (span.size > 0) {
+        span.data = arena_.make_array<ASTNode*>(span.size);
+        std::copy(nodes_.begin() + base, nodes_.end(), span.data);
+    }
+    nodes_.resize(base);
+    return span;
+}
+
+Span<ASTNode*> Parser::children_of(ASTNode* child) {
+    Span<ASTNode*> span;
+    span.data = arena_.make_array<ASTNode*>(1);
+    span.data[0] = child;
+    span.size = 1;
+    return span;
+}
+
+ASTNode* Parser::parse_program() {
+    ASTNode* root = parse_list(false);
+    if (!failed_ && token_.type != TokenType::END) {
+        return error();
+    }
+    return failed_ ? nullptr : root;
+}
+
+// list: and_or ((';' | '&' | newline) and_or)*. A nested list is the body
+// of a compound command: it runs on across lines and stops at the word
+// closing it, which the caller checks.
+ASTNode* Parser::parse_list(bool nested) {
+    size_t base = nodes_.size();
+    
+    while (true) {
+        skip_newlines(nested);
+        if (token_.type == TokenType::END || (nested && closes_compound_list(token_))) break;
         
-        if (c == '\\') {
-            escaped = true;
-            current += c;
-            continue;
+        ASTNode* item = parse_and_or();
+        if (!item) {
+            nodes_.resize(base);
+            return nullptr;
         }
         
-        if (c == '\'' && !in_double_quote) {
-            in_single_quote = !in_single_quote;
-            current += c;
-        } else if (c == '"' && !in_single_quote) {
-            in_double_quote = !in_double_quote;
-            current += c;
-        } else if (c == '|' && !in_single_quote && !in_double_quote) {
-            commands.push_back(trim(current));
-            current.clear();
+        bool separated = true;
+        if (token_.type == TokenType::AMPERSAND) {
+            ASTNode* background = make_node(NodeType::BACKGROUND);
+            background->children = children_of(item);
+            item = background;
+            advance();
+        } else if (token_.type == TokenType::SEMI) {
+            advance();
         } else {
-            current += c;
+            separated = token_.type == TokenType::LINEBREAK || token_.type == TokenType::END;
         }
+        nodes_.push_back(item);
+        if (!separated) break;
     }
     
-    if (!current.empty()) {
-        commands.push_back(trim(current));
+    if (nodes_.size() == base) return nullptr;
+    if (nodes_.size() == base + 1) {
+        ASTNode* only = nodes_.back();
+        nodes_.pop_back();
+        return only;
     }
-    
-    return commands;
+    ASTNode* sequence = make_node(NodeType::SEQUENCE);
+    sequence->children = pop_children(base);
+    return sequence;
 }
 
-std::unique_ptr<ASTNode> parse_to_ast(const std::string& input) {
-    std::string cmd = trim(input);
-    bool is_background = false;
+// The non-empty list of an if, loop or group.
+ASTNode* Parser::parse_body() {
+    ASTNode* body = parse_list(true);
+    if (!body && !failed_) return error();
+    return body;
+}
+
+ASTNode* Parser::parse_and_or() {
+    ASTNode* left = parse_pipeline();
     
-    if (!cmd.empty() && cmd.back() == '&') {
-        is_background = true;
-        cmd = trim(cmd.substr(0, cmd.length() - 1));
+    while (left && (token_.type == TokenType::AND_IF || token_.type == TokenType::OR_IF)) {
+        NodeType type = token_.type == TokenType::AND_IF ? NodeType::AND : NodeType::OR;
+        advance();
+        skip_newlines(true);
+        ASTNode* right = parse_pipeline();
+        if (!right) return nullptr;
+        
+        ASTNode* node = make_node(type);
+        size_t base = nodes_.size();
+        nodes_.push_back(left);
+        nodes_.push_back(right);
+        node->children = pop_children(base);
+        left = node;
     }
+    return left;
+}
+
+// pipeline: ['!'] ['time' [-p] [-j]] command ('|' command)*
+ASTNode* Parser::parse_pipeline() {
+    bool negate = is_reserved(token_, "!");
+    if (negate) advance();
     
-    auto pipeline_parts = parse_pipeline(cmd);
+    ASTNode* timed_node = nullptr;
+    if (is_reserved(token_, "time")) {
+        timed_node = make_node(NodeType::TIMED);
+        words_.clear();
+        advance();
+        while (token_.type == TokenType::WORD && token_.word.text.size() > 1 && token_.word.text[0] == '-') {
+            words_.push_back(token_.word);
+            advance();
+        }
+        timed_node->words = copy_to_arena(arena_, words_);
+    }
     
-    if (pipeline_parts.size() > 1) {
-        auto pipeline_node = std::make_unique<ASTNode>(NodeType::PIPELINE);
-        
-        for (const auto& part : pipeline_parts) {
-            auto parts = parse_arguments(part);
-            auto [filtered, redir] = parse_redirection(parts);
-            
-            if (redir.use_heredoc) {
-                read_heredoc(redir);
-            }
-            
-            if (!filtered.empty()) {
-                auto cmd_node = std::make_unique<ASTNode>(NodeType::COMMAND);
-                cmd_node->command = filtered[0];
-                cmd_node->args = std::vector<std::string>(filtered.begin() + 1, filtered.end());
-                cmd_node->redir = redir;
-                pipeline_node->children.push_back(std::move(cmd_node));
+    ASTNode* root = nullptr;
+    bool bare_time = timed_node && (token_.type == TokenType::END || token_.type == TokenType::LINEBREAK ||
+                                    token_.type == TokenType::SEMI);
+    if (!bare_time) {
+        size_t base = nodes_.size();
+        while (true) {
+            ASTNode* stage = parse_command();
+            if (!stage) {
+                nodes_.resize(base);
+                return nullptr;
             }
+            nodes_.push_back(stage);
+            if (token_.type != TokenType::PIPE) break;
+            advance();
+            skip_newlines(true);
         }
         
-        if (is_background) {
-            auto bg_node = std::make_unique<ASTNode>(NodeType::BACKGROUND);
-            bg_node->children.push_back(std::move(pipeline_node));
-            return bg_node;
+        if (nodes_.size() == base + 1) {
+            root = nodes_.back();
+            nodes_.pop_back();
+        } else {
+            root = make_node(NodeType::PIPELINE);
+            root->children = pop_children(base);
         }
+    }
+    
+    if (timed_node) {
+        if (root) timed_node->children = children_of(root);
+        root = timed_node;
+    }
+    if (negate) {
+        ASTNode* not_node = make_node(NodeType::NOT);
+        not_node->children = children_of(root);
+        root = not_node;
+    }
+    return root;
+}
+
+ASTNode* Parser::parse_command() {
+    if (token_.type == TokenType::LPAREN) {
+        advance();
+        ASTNode* body = parse_body();
+        if (!body) return nullptr;
+        if (token_.type != TokenType::RPAREN) return error();
+        advance();
         
-        return pipeline_node;
-    } else {
-        auto parts = parse_arguments(cmd);
-        auto [filtered, redir] = parse_redirection(parts);
-        
-        if (redir.use_heredoc) {
-            read_heredoc(redir);
+        ASTNode* subshell = make_node(NodeType::SUBSHELL);
+        subshell->children = children_of(body);
+        return parse_redirected(subshell);
+    }
+    
+    if (token_.type == TokenType::WORD && !token_.quoted && !token_.word.needs_expansion) {
+        std::string_view word = token_.word.text;
+        if (word == "if") return parse_redirected(parse_if());
+        if (word == "while" || word == "until") return parse_redirected(parse_loop());
+        if (word == "for") return parse_redirected(parse_for());
+        if (word == "case") return parse_redirected(parse_case());
+        if (word == "{") {
+            advance();
+            ASTNode* body = parse_body();
+            if (!body || !expect("}")) return nullptr;
+            return parse_redirected(body);
+        }
+        if (closes_compound_list(token_)) return error();
+    }
+    
+    return parse_simple_command();
+}
+
+// Reads the target of the redirection operator at the cursor into redirs_.
+bool Parser::parse_redirect() {
+    RedirKind kind = token_.redir;
+    advance();
+    if (token_.type != TokenType::WORD) {
+        error();
+        return false;
+    }
+    
+    Redirect r{kind, token_.word, -1};
+    if (r.kind == RedirKind::HEREDOC) {
+        r.heredoc_fd = read_heredoc(std::string(token_.word.text));
+        if (r.heredoc_fd != -1) heredoc_fds_.push_back(r.heredoc_fd);
+    }
+    redirs_.push_back(r);
+    advance();
+    return true;
+}
+
+// Redirections after a compound command apply to all of it. The shell's own
+// descriptors are never moved, so such a command runs as a subshell with
+// its redirections, and assignments inside it do not outlive it.
+ASTNode* Parser::parse_redirected(ASTNode* compound) {
+    if (!compound || token_.type != TokenType::REDIRECT) return compound;
+    
+    redirs_.clear();
+    while (token_.type == TokenType::REDIRECT) {
+        if (!parse_redirect()) return nullptr;
+    }
+    
+    ASTNode* subshell = compound;
+    if (compound->type != NodeType::SUBSHELL || !compound->redirs.empty()) {
+        subshell = make_node(NodeType::SUBSHELL);
+        subshell->children = children_of(compound);
+    }
+    subshell->redirs = copy_to_arena(arena_, redirs_);
+    return subshell;
+}
+
+ASTNode* Parser::parse_simple_command() {
+    words_.clear();
+    assigns_.clear();
+    redirs_.clear();
+    
+    while (token_.type == TokenType::WORD || token_.type == TokenType::REDIRECT) {
+        if (token_.type == TokenType::WORD && token_.assignment && words_.empty()) {
+            assigns_.push_back(token_.word);
+        } else if (token_.type == TokenType::WORD) {
+            words_.push_back(token_.word);
+        } else {
+            if (!parse_redirect()) return nullptr;
+            continue;
         }
+        advance();
+    }
+    
+    if (words_.empty() && assigns_.empty() && redirs_.empty()) {
+        return error();
+    }
+    
+    ASTNode* cmd_node = make_node(NodeType::COMMAND);
+    cmd_node->words = copy_to_arena(arena_, words_);
+    cmd_node->assigns = copy_to_arena(arena_, assigns_);
+    cmd_node->redirs = copy_to_arena(arena_, redirs_);
+    return cmd_node;
+}
+
+// if list then list [elif list then list]... [else list] fi
+ASTNode* Parser::parse_if() {
+    size_t base = nodes_.size();
+    advance();
+    
+    while (true) {
+        ASTNode* condition = parse_body();
+        if (!condition || !expect("then")) break;
+        ASTNode* body = parse_body();
+        if (!body) break;
+        nodes_.push_back(condition);
+        nodes_.push_back(body);
         
-        if (!filtered.empty()) {
-            auto cmd_node = std::make_unique<ASTNode>(NodeType::COMMAND);
-            cmd_node->command = filtered[0];
-            cmd_node->args = std::vector<std::string>(filtered.begin() + 1, filtered.end());
-            cmd_node->redir = redir;
-            
-            if (is_background) {
-                auto bg_node = std::make_unique<ASTNode>(NodeType::BACKGROUND);
-                bg_node->children.push_back(std::move(cmd_node));
-                return bg_node;
+        if (!is_reserved(token_, "elif")) break;
+        advance();
+    }
+    
+    if (!failed_ && is_reserved(token_, "else")) {
+        advance();
+        if (ASTNode* body = parse_body()) nodes_.push_back(body);
+    }
+    if (failed_ || !expect("fi")) {
+        nodes_.resize(base);
+        return nullptr;
+    }
+    
+    ASTNode* node = make_node(NodeType::IF);
+    node->children = pop_children(base);
+    return node;
+}
+
+// while list do list done, until list do list done
+ASTNode* Parser::parse_loop() {
+    ASTNode* node = make_node(token_.word.text == "while" ? NodeType::WHILE : NodeType::UNTIL);
+    advance();
+    
+    ASTNode* condition = parse_body();
+    if (!condition || !expect("do")) return nullptr;
+    ASTNode* body = parse_body();
+    if (!body || !expect("done")) return nullptr;
+    
+    size_t base = nodes_.size();
+    nodes_.push_back(condition);
+    nodes_.push_back(body);
+    node->children = pop_children(base);
+    return node;
+}
+
+// for name [in word...] (';' | newline) do list done
+ASTNode* Parser::parse_for() {
+    ASTNode* node = make_node(NodeType::FOR);
+    advance();
+    if (token_.type != TokenType::WORD || token_.quoted || token_.word.needs_expansion ||
+        !is_valid_name(token_.word.text)) {
+        return error();
+    }
+    
+    words_.clear();
+    words_.push_back(token_.word);
+    advance();
+    if (token_.type == TokenType::SEMI) {
+        advance();
+    } else {
+        skip_newlines(true);
+        if (is_reserved(token_, "in")) {
+            advance();
+            while (token_.type == TokenType::WORD) {
+                words_.push_back(token_.word);
+                advance();
+            }
+            if (token_.type == TokenType::SEMI) {
+                advance();
+            } else if (token_.type != TokenType::LINEBREAK && token_.type != TokenType::END) {
+                return error();
             }
-            
-            return cmd_node;
         }
     }
+    node->words = copy_to_arena(arena_, words_);
     
-    return nullptr;
+    skip_newlines(true);
+    if (!expect("do")) return nullptr;
+    ASTNode* body = parse_body();
+    if (!body || !expect("done")) return nullptr;
+    node->children = children_of(body);
+    return node;
+}
+
+// case word in [(] pattern [| pattern]... ) [list] ;; ... esac
+ASTNode* Parser::parse_case() {
+    ASTNode* node = make_node(NodeType::CASE);
+    advance();
+    if (token_.type != TokenType::WORD) return error();
+    node->words = copy_to_arena(arena_, std::vector<Word>{token_.word});
+    advance();
+    skip_newlines(true);
+    if (!expect("in")) return nullptr;
+    
+    size_t base = nodes_.size();
+    while (true) {
+        skip_newlines(true);
+        if (is_reserved(token_, "esac")) break;
+        if (token_.type == TokenType::LPAREN) advance();
+        
+        words_.clear();
+        while (token_.type == TokenType::WORD) {
+            // Quoted patterns keep their source text, so matching can tell
+            // quoted metacharacters from live ones.
+            words_.push_back(token_.quoted ? Word{token_.raw, true} : token_.word);
+            advance();
+            if (token_.type != TokenType::PIPE) break;
+            advance();
+        }
+        if (words_.empty() || token_.type != TokenType::RPAREN) {
+            error();
+            break;
+        }
+        advance();
+        
+        ASTNode* item = make_node(NodeType::CASE_ITEM);
+        item->words = copy_to_arena(arena_, words_);
+        ASTNode* body = parse_list(true);
+        if (failed_) break;
+        if (body) item->children = children_of(body);
+        nodes_.push_back(item);
+        
+        if (token_.type != TokenType::DSEMI) break;
+        advance();
+    }
+    
+    if (failed_ || !expect("esac")) {
+        nodes_.resize(base);
+        return nullptr;
+    }
+    node->children = pop_children(base);
+    return node;
+}
+
+// With read_more set, a command left incomplete at the end of `input`
+// (an open loop, a trailing `&&` or `|`) continues on the following lines
+// of the script, or of the terminal.
+ParseTree parse_to_ast(const std::string& input, bool read_more) {
+    TraceSpan span("parse", input);
+    ParseTree tree;
+    Parser parser(tree, tree.arena.store(input), read_more);
+    tree.root = parser.parse_program();
+    tree.error = parser.failed();
+    return tree;
 }
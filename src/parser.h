@@ -2,42 +2,183 @@
 #define PARSER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 
 struct RedirectionConfig {
     std::string stdout_file;
     std::string stderr_file;
     std::string stdin_file;
     std::string heredoc_delimiter;
-    std::string heredoc_content;
     bool stdout_append = false;
     bool stderr_append = false;
     bool use_heredoc = false;
     int stdin_pipe = -1;
+    int heredoc_fd = -1;           // sealed body, owned by the ParseTree
+};
+
+// Bump allocator that owns everything produced by one parse: the copy of the
+// input line, cooked words and the AST nodes. Only trivially destructible
+// objects live here; the whole arena is released at once.
+class Arena {
+public:
+    Arena() = default;
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    
+    void* allocate(size_t size, size_t align);
+    std::string_view store(std::string_view text);
+    
+    template <typename T>
+    T* make_array(size_t count) {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+    
+    template <typename T>
+    T* make() {
+        return new (allocate(sizeof(T), alignof(T))) T();
+    }
+
+private:
+    std::vector<std::unique_ptr<char[]>> blocks_;
+    char* cursor_ = nullptr;
+    size_t remaining_ = 0;
+    size_t next_block_size_ = 4096;
+};
+
+template <typename T>
+struct Span {
+    T* data = nullptr;
+    size_t size = 0;
+    
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+    T& operator[](size_t i) const { return data[i]; }
+};
+
+// A word is either final text (a view into the arena, quotes already removed)
+// or, when it contains an expansion ($NAME, $(...)), the raw source text
+// that is expanded each time the command runs.
+struct Word {
+    std::string_view text;
+    bool needs_expansion;
+};
+
+enum class RedirKind : uint8_t {
+    INPUT,
+    OUTPUT,
+    APPEND,
+    ERROR,
+    ERROR_APPEND,
+    HEREDOC
+};
+
+struct Redirect {
+    RedirKind kind;
+    Word target;                   // file name, or the delimiter for HEREDOC
+    int heredoc_fd;
 };
 
 enum class NodeType {
     COMMAND,
     PIPELINE,
     BACKGROUND,
-    SEQUENCE
+    SEQUENCE,
+    TIMED,
+    AND,                           // children: left, right
+    OR,
+    NOT,                           // `! pipeline`
+    IF,                            // children: condition, body pairs, then an optional else body
+    WHILE,                         // children: condition, body
+    UNTIL,
+    FOR,                           // words: variable name, then the words to iterate over; children: body
+    CASE,                          // words: the case word; children: CASE_ITEMs
+    CASE_ITEM,                     // words: patterns; children: body, if any
+    SUBSHELL                       // `( list )`
 };
 
 struct ASTNode {
     NodeType type;
-    std::string command;
-    std::vector<std::string> args;
-    RedirectionConfig redir;
-    std::vector<std::unique_ptr<ASTNode>> children;
+    Span<Word> words;              // COMMAND: command name followed by its arguments; TIMED: options
+    Span<Word> assigns;            // COMMAND: leading NAME=value words
+    Span<Redirect> redirs;
+    Span<ASTNode*> children;
+};
+
+// Version of the node layout above. Cached script images (source_cache.cpp)
+// are keyed on it: bump it when a node's meaning changes without its size
+// or field offsets changing, e.g. when NodeType values are reordered.
+constexpr uint32_t AST_FORMAT_VERSION = 2;
+
+struct ParseTree {
+    Arena arena;
+    ASTNode* root = nullptr;
+    bool error = false;
+    std::vector<int> heredoc_fds;
+    
+    ParseTree() = default;
+    ParseTree(ParseTree&&) = default;
+    ~ParseTree();
+};
+
+enum class TokenType : uint8_t {
+    WORD,
+    PIPE,
+    AMPERSAND,
+    AND_IF,                        // &&
+    OR_IF,                         // ||
+    SEMI,
+    DSEMI,                         // ;; ending a case item
+    LPAREN,
+    RPAREN,
+    LINEBREAK,                     // newline
+    REDIRECT,
+    END,
+    ERROR
+};
+
+struct Token {
+    TokenType type;
+    RedirKind redir;
+    Word word;
+    bool assignment = false;       // WORD of the form NAME=value, NAME unquoted
+    bool quoted = false;           // WORD with quotes or backslashes; never a reserved word
+    std::string_view raw = {};     // WORD: its source text, quotes included
+};
+
+// Single-pass tokenizer. Words that need no unquoting are views straight
+// into the input; the rest are cooked into the arena.
+class Lexer {
+public:
+    Lexer(std::string_view input, Arena& arena) : input_(input), pos_(0), arena_(arena) {}
+    Token next();
+    void feed(std::string_view input) { input_ = input; pos_ = 0; }
+    // The quote left open by the last word, which then runs to the end of
+    // the input; 0 if there is none.
+    char open_quote() const { return open_quote_; }
+
+private:
+    Word scan_word(bool& quoted);
     
-    ASTNode(NodeType t) : type(t) {}
+    std::string_view input_;
+    size_t pos_;
+    Arena& arena_;
+    char open_quote_ = 0;
 };
 
-std::string expand_command_substitution(const std::string& input);
-std::vector<std::string> parse_arguments(const std::string& input);
-std::pair<std::vector<std::string>, RedirectionConfig> parse_redirection(const std::vector<std::string>& parts);
-std::vector<std::string> parse_pipeline(const std::string& input);
-std::unique_ptr<ASTNode> parse_to_ast(const std::string& input);
+size_t find_substitution_end(std::string_view text, size_t start);
+std::string execute_for_output(const std::string& cmd);
+void expand_word(const Word& word, std::vector<std::string>& out, bool split = true);
+std::string expand_pattern(const Word& word);
+bool expand_command(const ASTNode* node, std::string& command, std::vector<std::string>& args,
+                    RedirectionConfig& redir, std::vector<std::string>* assignments = nullptr);
+ParseTree parse_to_ast(const std::string& input, bool read_more = false);
 
 #endif // PARSER_H
@@ -0,0 +1,73 @@
+#include "path_index.h"
+#include "utils.h"
+#include <unordered_map>
+#include <algorithm>
+#include <sys/stat.h>
+
+struct IndexedDir {
+    struct timespec mtime;
+    bool present;
+    std::vector<std::string> names;
+};
+
+// Per-directory scans are kept across PATH changes so switching PATH back
+// and forth does not rescan directories we have already seen.
+static std::unordered_map<std::string, IndexedDir> indexed_dirs;
+static std::vector<std::string> index_path;
+static std::vector<std::string> merged_names;
+
+static bool same_mtime(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+void refresh_executable_index() {
+    const auto& directories = path_directories();
+    bool changed = directories != index_path;
+    
+    for (const auto& dir : directories) {
+        struct stat sb;
+        bool present = stat(dir.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+        
+        auto it = indexed_dirs.find(dir);
+        if (it != indexed_dirs.end()) {
+            IndexedDir& cached = it->second;
+            if (cached.present == present && (!present || same_mtime(cached.mtime, sb.st_mtim))) {
+                continue;
+            }
+        }
+        
+        IndexedDir& entry = indexed_dirs[dir];
+        entry.present = present;
+        entry.names.clear();
+        if (present) {
+            entry.mtime = sb.st_mtim;
+            list_executables_in_dir(dir, entry.names);
+        }
+        changed = true;
+    }
+    
+    if (!changed) return;
+    
+    index_path = directories;
+    merged_names.clear();
+    for (const auto& dir : directories) {
+        const auto& names = indexed_dirs[dir].names;
+        merged_names.insert(merged_names.end(), names.begin(), names.end());
+    }
+    std::sort(merged_names.begin(), merged_names.end());
+    merged_names.erase(std::unique(merged_names.begin(), merged_names.end()), merged_names.end());
+}
+
+void find_executables_with_prefix(const std::string& prefix, std::vector<std::string>& out) {
+    refresh_executable_index();
+    
+    auto it = std::lower_bound(merged_names.begin(), merged_names.end(), prefix);
+    for (; it != merged_names.end() && it->compare(0, prefix.length(), prefix) == 0; ++it) {
+        out.push_back(*it);
+    }
+}
+
+const std::vector<std::string>& indexed_executables() {
+    refresh_executable_index();
+    return merged_names;
+}
@@ -0,0 +1,11 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <string>
+#include <vector>
+
+void refresh_executable_index();
+void find_executables_with_prefix(const std::string& prefix, std::vector<std::string>& out);
+const std::vector<std::string>& indexed_executables();
+
+#endif // PATH_INDEX_H
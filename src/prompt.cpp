@@ -0,0 +1,325 @@
+#include "prompt.h"
+#include "job_control.h"
+#include "trace.h"
+#include "variables.h"
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// A segment whose value is expensive. scope() picks the cache slot (empty
+// hides the segment), inputs() names the files whose mtime and size make a
+// cached value stale, and compute() runs on the worker.
+struct PromptSegment {
+    const char* name;
+    std::string (*scope)(const std::string& cwd);
+    std::vector<std::string> (*inputs)(const std::string& scope);
+    std::string (*compute)(const std::string& scope);
+    bool refresh_after_command;    // commands can change it without touching the inputs
+};
+
+struct CachedValue {
+    std::string value;
+    std::string stamp;
+    uint64_t generation = 0;
+    bool pending = false;
+};
+
+struct SegmentJob {
+    const PromptSegment* segment;
+    std::string key;
+    std::string scope;
+    std::string stamp;
+    uint64_t generation;
+};
+
+// Never destroyed: the worker may still be running when the shell exits.
+struct PromptWorker {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<SegmentJob> queue;
+    std::unordered_map<std::string, CachedValue> cache;
+    int event_fd = -1;
+};
+
+static PromptWorker* worker = nullptr;
+static uint64_t command_generation = 1;
+static int last_status = 0;
+static double last_duration = 0;
+
+static std::string git_dir_of(const std::string& root) {
+    std::string dot_git = root + "/.git";
+    struct stat st;
+    if (stat(dot_git.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        return dot_git;
+    }
+    
+    // Worktrees and submodules have a .git file pointing elsewhere.
+    std::ifstream file(dot_git);
+    std::string line;
+    if (!std::getline(file, line) || line.compare(0, 8, "gitdir: ") != 0) {
+        return "";
+    }
+    std::string dir = line.substr(8);
+    return !dir.empty() && dir[0] == '/' ? dir : root + "/" + dir;
+}
+
+static std::string git_scope(const std::string& cwd) {
+    std::string dir = cwd;
+    while (!dir.empty()) {
+        struct stat st;
+        if (lstat((dir + "/.git").c_str(), &st) == 0) {
+            return dir;
+        }
+        size_t slash = dir.find_last_of('/');
+        if (slash == std::string::npos) break;
+        dir.resize(slash);
+    }
+    return "";
+}
+
+static std::vector<std::string> git_inputs(const std::string& root) {
+    std::string git_dir = git_dir_of(root);
+    return {git_dir + "/HEAD", git_dir + "/index"};
+}
+
+static uint32_t read_be32(const unsigned char* p) {
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+// Compares the stat data recorded in the index (version 2 or 3) with the
+// work tree, the same first check git status makes. Returns -1 when the
+// index cannot be read this way.
+static int git_worktree_dirty(const std::string& root, const std::string& git_dir) {
+    int fd = open((git_dir + "/index").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;    // fresh repository
+    
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+    void* map = size >= 12 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    
+    const unsigned char* data = static_cast<const unsigned char*>(map);
+    uint32_t version = read_be32(data + 4);
+    uint32_t count = read_be32(data + 8);
+    int dirty = (memcmp(data, "DIRC", 4) != 0 || version < 2 || version > 3) ? -1 : 0;
+    
+    size_t offset = 12;
+    std::string path = root + "/";
+    for (uint32_t i = 0; i < count && dirty == 0; i++) {
+        if (offset + 62 > size) {
+            dirty = -1;
+            break;
+        }
+        const unsigned char* entry = data + offset;
+        uint32_t mtime_sec = read_be32(entry + 8);
+        uint32_t mtime_nsec = read_be32(entry + 12);
+        uint32_t mode = read_be32(entry + 24);
+        uint32_t file_size = read_be32(entry + 36);
+        uint16_t flags = uint16_t(entry[60]) << 8 | entry[61];
+        size_t header = flags & 0x4000 ? 64 : 62;    // extended flags follow
+        if (offset + header > size) {
+            dirty = -1;
+            break;
+        }
+        bool skip_worktree = header == 64 && (entry[62] & 0x40);
+        
+        const char* name = reinterpret_cast<const char*>(entry + header);
+        size_t name_length = strnlen(name, size - offset - header);
+        if (offset + header + name_length == size) {    // name not terminated
+            dirty = -1;
+            break;
+        }
+        offset += (header + name_length + 8) & ~size_t(7);
+        
+        if (skip_worktree || (mode & 0170000) == 0160000) continue;    // sparse or submodule
+        path.resize(root.size() + 1);
+        path.append(name, name_length);
+        struct stat file;
+        if (lstat(path.c_str(), &file) != 0 ||
+            uint32_t(file.st_size) != file_size ||
+            uint32_t(file.st_mtim.tv_sec) != mtime_sec ||
+            uint32_t(file.st_mtim.tv_nsec) != mtime_nsec) {
+            dirty = 1;
+        }
+    }
+    munmap(map, size);
+    return dirty;
+}
+
+static std::string git_compute(const std::string& root) {
+    TraceSpan span("prompt_git", root);
+    std::string git_dir = git_dir_of(root);
+    std::ifstream head(git_dir + "/HEAD");
+    std::string line;
+    if (!std::getline(head, line)) return "";
+    
+    std::string branch;
+    if (line.compare(0, 16, "ref: refs/heads/") == 0) {
+        branch = line.substr(16);
+    } else {
+        branch = line.substr(0, 7);    // detached: abbreviated commit
+    }
+    
+    int dirty = git_worktree_dirty(root, git_dir);
+    return dirty == 1 ? branch + "*" : branch;
+}
+
+static const PromptSegment slow_segments[] = {
+    {"git", git_scope, git_inputs, git_compute, true},
+};
+
+static void worker_loop() {
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, nullptr);
+    
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    while (true) {
+        worker->ready.wait(lock, [] { return !worker->queue.empty(); });
+        SegmentJob job = std::move(worker->queue.front());
+        worker->queue.pop_front();
+        
+        lock.unlock();
+        std::string value = job.segment->compute(job.scope);
+        lock.lock();
+        
+        CachedValue& cached = worker->cache[job.key];
+        bool changed = cached.value != value;
+        cached.value = std::move(value);
+        cached.stamp = std::move(job.stamp);
+        cached.generation = job.generation;
+        cached.pending = false;
+        if (changed) {
+            uint64_t one = 1;
+            (void)!write(worker->event_fd, &one, sizeof(one));
+        }
+    }
+}
+
+static void start_worker() {
+    worker = new PromptWorker();
+    worker->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    std::thread(worker_loop).detach();
+}
+
+static std::string input_stamp(const std::vector<std::string>& inputs) {
+    std::string stamp;
+    for (const std::string& input : inputs) {
+        struct stat st;
+        if (stat(input.c_str(), &st) == 0) {
+            stamp += std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) +
+                     ":" + std::to_string(st.st_size);
+        }
+        stamp += ';';
+    }
+    return stamp;
+}
+
+// Returns the cached value at once and queues a recompute if it is stale.
+static std::string segment_value(const PromptSegment& segment, const std::string& cwd) {
+    std::string scope = segment.scope(cwd);
+    if (scope.empty()) return "";
+    if (!worker) start_worker();
+    
+    std::string stamp = input_stamp(segment.inputs(scope));
+    std::string key = std::string(segment.name) + '\0' + scope;
+    
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    CachedValue& cached = worker->cache[key];
+    bool stale = cached.stamp != stamp ||
+                 (segment.refresh_after_command && cached.generation != command_generation);
+    if (stale && !cached.pending) {
+        cached.pending = true;
+        worker->queue.push_back({&segment, key, scope, stamp, command_generation});
+        worker->ready.notify_one();
+    }
+    return cached.value;
+}
+
+int prompt_update_fd() {
+    return worker ? worker->event_fd : -1;
+}
+
+bool service_prompt_updates() {
+    uint64_t count;
+    return worker && read(worker->event_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+void note_command_finished(int status, double seconds) {
+    last_status = status;
+    last_duration = seconds;
+    command_generation++;
+}
+
+static std::string format_duration(double seconds) {
+    char buffer[32];
+    if (seconds < 60) {
+        snprintf(buffer, sizeof(buffer), "%.1fs", seconds);
+    } else {
+        int whole = static_cast<int>(seconds);
+        snprintf(buffer, sizeof(buffer), "%dm%02ds", whole / 60, whole % 60);
+    }
+    return buffer;
+}
+
+// Escape sequences are wrapped in \001...\002 so readline leaves them out
+// of the prompt width.
+static std::string colored(const char* color, const std::string& text) {
+    return std::string("\001") + color + "\002" + text + "\001\033[0m\002";
+}
+
+std::string get_prompt() {
+    service_prompt_updates();
+    
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        return "$ ";
+    }
+    
+    std::string path = cwd;
+    const char* home = get_variable("HOME");
+    if (home && path.find(home) == 0) {
+        path = "~" + path.substr(strlen(home));
+    }
+    
+    const char* user = get_variable("USER");
+    if (!user) user = get_variable("LOGNAME");
+    
+    std::string prompt;
+    if (user) {
+        prompt = colored("\033[32m", user) + ":";
+    }
+    prompt += colored("\033[34m", path);
+    
+    for (const PromptSegment& segment : slow_segments) {
+        std::string value = segment_value(segment, cwd);
+        if (!value.empty()) {
+            prompt += " " + colored("\033[35m", "(" + value + ")");
+        }
+    }
+    if (last_duration >= 1.0) {
+        prompt += " " + colored("\033[33m", format_duration(last_duration));
+    }
+    if (last_status != 0) {
+        prompt += " " + colored("\033[31m", "[" + std::to_string(last_status) + "]");
+    }
+    if (!jobs.empty()) {
+        prompt += " " + colored("\033[36m", "jobs:" + std::to_string(jobs.size()));
+    }
+    return prompt + "$ ";
+}
@@ -0,0 +1,18 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#include <string>
+
+// Prompt rendering. Cheap segments (user, cwd, exit status, duration, jobs)
+// are built inline; slow ones such as the VCS state are cached and
+// recomputed on a worker thread, and the prompt shows the last known value
+// until the new one arrives.
+
+std::string get_prompt();
+void note_command_finished(int status, double seconds);
+
+// Readable when a slow segment changed after the prompt was drawn.
+int prompt_update_fd();
+bool service_prompt_updates();
+
+#endif // PROMPT_H
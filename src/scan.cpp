@@ -0,0 +1,344 @@
+#include "scan.h"
+#include "shell.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+static const size_t READ_BLOCK = 128 * 1024;
+
+struct Kernels {
+    ScanKernel kind;
+    size_t (*newlines)(const char* data, size_t size);
+    size_t (*words)(const char* data, size_t size, bool& in_word);
+    const char* (*find)(const char* begin, const char* end, const char* needle, size_t length);
+};
+
+static bool is_blank(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t count_newlines_scalar(const char* data, size_t size) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i++) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
+
+// Other control characters neither start nor end a word, as in wc(1).
+// Bytes above 0x7f count as word characters, which is right for UTF-8 text.
+static bool is_word_byte(unsigned char c) {
+    return c > ' ' && c != 0x7f;
+}
+
+static size_t count_words_scalar(const char* data, size_t size, bool& in_word) {
+    size_t count = 0;
+    bool word = in_word;
+    for (size_t i = 0; i < size; i++) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (is_blank(c)) {
+            word = false;
+        } else if (is_word_byte(c)) {
+            count += !word;
+            word = true;
+        }
+    }
+    in_word = word;
+    return count;
+}
+
+static const char* find_scalar(const char* begin, const char* end, const char* needle, size_t length) {
+    return static_cast<const char*>(memmem(begin, end - begin, needle, length));
+}
+
+#if defined(__x86_64__)
+// SSE2 is part of x86-64, so these need no target attribute.
+static size_t count_newlines_sse2(const char* data, size_t size) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    
+    while (i + 16 <= size) {
+        // Byte counters overflow after 255 blocks; fold them into 64-bit sums before that.
+        size_t blocks = std::min<size_t>((size - i) / 16, 255);
+        __m128i counters = _mm_setzero_si128();
+        for (size_t b = 0; b < blocks; b++, i += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(chunk, newline));
+        }
+        __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+        count += _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+    }
+    return count + count_newlines_scalar(data + i, size - i);
+}
+
+// Blocks holding control characters other than blanks are rare in text and
+// go to the scalar loop, which handles their carry-over state.
+static size_t count_words_sse2(const char* data, size_t size, bool& in_word) {
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t count = 0;
+    size_t i = 0;
+    
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i offset = _mm_sub_epi8(chunk, tab);
+        uint32_t blank = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(offset, range), offset),
+                                                        _mm_cmpeq_epi8(chunk, space)));
+        uint32_t control = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, space), chunk),
+                                                          _mm_cmpeq_epi8(chunk, _mm_set1_epi8(0x7f))));
+        if (control & ~blank) {
+            count += count_words_scalar(data + i, 16, in_word);
+            continue;
+        }
+        uint32_t starts = ~blank & ((blank << 1) | !in_word) & 0xffff;
+        count += __builtin_popcount(starts);
+        in_word = !(blank >> 15);
+    }
+    return count + count_words_scalar(data + i, size - i, in_word);
+}
+
+// Compares the first and last byte of the needle against 16 positions at
+// once and checks the middle only where both match.
+static const char* find_sse2(const char* begin, const char* end, const char* needle, size_t length) {
+    if (length < 2) return find_scalar(begin, end, needle, length);
+    
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    const char* p = begin;
+    
+    for (; end - p >= static_cast<ptrdiff_t>(length + 15); p += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + length - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first),
+                                                        _mm_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(p + bit + 1, needle + 1, length - 2) == 0) return p + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(p, end, needle, length);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char* data, size_t size) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    
+    while (i + 64 <= size) {
+        size_t blocks = std::min<size_t>((size - i) / 64, 255);
+        __m256i counters_a = _mm256_setzero_si256();
+        __m256i counters_b = _mm256_setzero_si256();
+        for (size_t b = 0; b < blocks; b++, i += 64) {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+            counters_a = _mm256_sub_epi8(counters_a, _mm256_cmpeq_epi8(a, newline));
+            counters_b = _mm256_sub_epi8(counters_b, _mm256_cmpeq_epi8(c, newline));
+        }
+        __m256i sums = _mm256_add_epi64(_mm256_sad_epu8(counters_a, _mm256_setzero_si256()),
+                                        _mm256_sad_epu8(counters_b, _mm256_setzero_si256()));
+        count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+                 _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+    }
+    return count + count_newlines_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_words_avx2(const char* data, size_t size, bool& in_word) {
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i range = _mm256_set1_epi8('\r' - '\t');
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t count = 0;
+    size_t i = 0;
+    
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i offset = _mm256_sub_epi8(chunk, tab);
+        uint32_t blank = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(offset, range), offset),
+                            _mm256_cmpeq_epi8(chunk, space)));
+        uint32_t control = _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(chunk, space), chunk),
+                            _mm256_cmpeq_epi8(chunk, del)));
+        if (control & ~blank) {
+            count += count_words_scalar(data + i, 32, in_word);
+            continue;
+        }
+        uint32_t starts = ~blank & ((blank << 1) | !in_word);
+        count += __builtin_popcount(starts);
+        in_word = !(blank >> 31);
+    }
+    return count + count_words_sse2(data + i, size - i, in_word);
+}
+
+__attribute__((target("avx2,bmi")))
+static const char* find_avx2(const char* begin, const char* end, const char* needle, size_t length) {
+    if (length < 2) return find_scalar(begin, end, needle, length);
+    
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    const char* p = begin;
+    
+    for (; end - p >= static_cast<ptrdiff_t>(length + 31); p += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + length - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first),
+                                                              _mm256_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(p + bit + 1, needle + 1, length - 2) == 0) return p + bit;
+            mask &= mask - 1;
+        }
+    }
+    return find_sse2(p, end, needle, length);
+}
+#endif
+
+static const Kernels scalar_kernels = {ScanKernel::SCALAR, count_newlines_scalar, count_words_scalar, find_scalar};
+#if defined(__x86_64__)
+static const Kernels sse2_kernels = {ScanKernel::SSE2, count_newlines_sse2, count_words_sse2, find_sse2};
+static const Kernels avx2_kernels = {ScanKernel::AVX2, count_newlines_avx2, count_words_avx2, find_avx2};
+#endif
+
+static const Kernels* kernels_for(ScanKernel kernel) {
+#if defined(__x86_64__)
+    if (kernel == ScanKernel::AVX2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") &&
+        __builtin_cpu_supports("bmi")) {
+        return &avx2_kernels;
+    }
+    if (kernel == ScanKernel::SSE2) return &sse2_kernels;
+#endif
+    if (kernel == ScanKernel::SCALAR) return &scalar_kernels;
+    return nullptr;
+}
+
+static const Kernels* best_kernels() {
+    for (ScanKernel kernel : {ScanKernel::AVX2, ScanKernel::SSE2}) {
+        if (const Kernels* k = kernels_for(kernel)) return k;
+    }
+    return &scalar_kernels;
+}
+
+static std::atomic<const Kernels*> active_kernels{nullptr};
+
+static const Kernels& kernels() {
+    const Kernels* k = active_kernels.load(std::memory_order_relaxed);
+    if (!k) {
+        k = best_kernels();
+        active_kernels.store(k, std::memory_order_relaxed);
+    }
+    return *k;
+}
+
+ScanKernel active_scan_kernel() {
+    return kernels().kind;
+}
+
+bool set_scan_kernel(ScanKernel kernel) {
+    const Kernels* k = kernels_for(kernel);
+    if (!k) return false;
+    active_kernels.store(k, std::memory_order_relaxed);
+    return true;
+}
+
+const char* scan_kernel_name(ScanKernel kernel) {
+    switch (kernel) {
+        case ScanKernel::AVX2: return "avx2";
+        case ScanKernel::SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+size_t count_newlines(const char* data, size_t size) {
+    return kernels().newlines(data, size);
+}
+
+size_t count_words(const char* data, size_t size, bool& in_word) {
+    return kernels().words(data, size, in_word);
+}
+
+const char* find_fixed(const char* begin, const char* end, std::string_view needle) {
+    if (needle.empty()) return begin;
+    if (static_cast<size_t>(end - begin) < needle.size()) return nullptr;
+    return kernels().find(begin, end, needle.data(), needle.size());
+}
+
+int scan_fd(int fd, bool whole_lines, const ScanBlockFn& fn) {
+    struct stat st;
+    off_t offset = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        offset = lseek(fd, 0, SEEK_CUR);
+    }
+    
+    // Regular files are mapped whole so the kernels see one contiguous
+    // buffer; the file offset is moved past what was consumed, as read()
+    // would have done. Empty and procfs-style files take the read path.
+    if (offset >= 0 && st.st_size > offset) {
+        static const off_t page = sysconf(_SC_PAGESIZE);
+        off_t base = offset & ~(page - 1);
+        size_t length = st.st_size - base;
+        void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, base);
+        if (map != MAP_FAILED) {
+            madvise(map, length, MADV_SEQUENTIAL);
+            fn(static_cast<const char*>(map) + (offset - base), st.st_size - offset);
+            munmap(map, length);
+            lseek(fd, st.st_size, SEEK_SET);
+            return 0;
+        }
+    }
+    
+    size_t capacity = READ_BLOCK;
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    size_t used = 0;
+    
+    while (true) {
+        if (used == capacity) {
+            // A single line longer than the buffer.
+            std::unique_ptr<char[]> larger(new char[capacity * 2]);
+            memcpy(larger.get(), buffer.get(), used);
+            buffer = std::move(larger);
+            capacity *= 2;
+        }
+        
+        // Ctrl-C reached the shell; worker threads never see the signal.
+        if (interrupt_pending) {
+            errno = EINTR;
+            return -1;
+        }
+        ssize_t n = read(fd, buffer.get() + used, capacity - used);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            if (used > 0) fn(buffer.get(), used);
+            return 0;
+        }
+        
+        size_t end = used + n;
+        size_t ready = end;
+        if (whole_lines) {
+            const char* newline = static_cast<const char*>(memrchr(buffer.get() + used, '\n', n));
+            used = end;
+            if (!newline) continue;
+            ready = newline - buffer.get() + 1;
+        }
+        
+        if (!fn(buffer.get(), ready)) return 0;
+        memmove(buffer.get(), buffer.get() + ready, end - ready);
+        used = end - ready;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+// Kernels behind the wc and grep builtins. The widest one the CPU supports
+// is picked on first use; the others stay selectable for benchmarks.
+enum class ScanKernel {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+ScanKernel active_scan_kernel();
+bool set_scan_kernel(ScanKernel kernel);       // false if the CPU lacks it
+const char* scan_kernel_name(ScanKernel kernel);
+
+size_t count_newlines(const char* data, size_t size);
+// Words are runs of printable bytes between blanks, as wc(1) counts them;
+// `in_word` carries the state from the end of the previous block.
+size_t count_words(const char* data, size_t size, bool& in_word);
+// First occurrence of needle in [begin, end), or nullptr.
+const char* find_fixed(const char* begin, const char* end, std::string_view needle);
+
+// Feeds the rest of fd to fn: regular files as one mmap, anything else in
+// 128 KiB blocks. With whole_lines each block ends after a newline, except
+// possibly the last. fn returns false to stop early. Returns 0, or -1 with
+// errno set.
+using ScanBlockFn = std::function<bool(const char* data, size_t size)>;
+int scan_fd(int fd, bool whole_lines, const ScanBlockFn& fn);
+
+#endif // SCAN_H
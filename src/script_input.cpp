@@ -0,0 +1,84 @@
+#include "script_input.h"
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+static const size_t READ_BLOCK_SIZE = 64 * 1024;
+
+ScriptReader* script_input = nullptr;
+
+ScriptReader::ScriptReader(int fd)
+    : fd_(fd), owns_fd_(fd != STDIN_FILENO), eof_(false), pos_(0) {}
+
+ScriptReader::ScriptReader(std::string text)
+    : fd_(-1), owns_fd_(false), eof_(true), buffer_(std::move(text)), pos_(0) {}
+
+ScriptReader::~ScriptReader() {
+    if (owns_fd_ && fd_ != -1) {
+        close(fd_);
+    }
+}
+
+bool ScriptReader::fill() {
+    if (eof_) return false;
+    
+    if (pos_ > 0) {
+        buffer_.erase(0, pos_);
+        pos_ = 0;
+    }
+    
+    size_t old_size = buffer_.size();
+    buffer_.resize(old_size + READ_BLOCK_SIZE);
+    
+    ssize_t n;
+    do {
+        n = read(fd_, &buffer_[old_size], READ_BLOCK_SIZE);
+    } while (n == -1 && errno == EINTR);
+    
+    buffer_.resize(old_size + (n > 0 ? n : 0));
+    if (n <= 0) {
+        eof_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool ScriptReader::read_line(std::string& line) {
+    size_t scanned = pos_;
+    
+    while (true) {
+        const char* start = buffer_.data() + scanned;
+        const void* nl = memchr(start, '\n', buffer_.size() - scanned);
+        if (nl) {
+            size_t end = static_cast<const char*>(nl) - buffer_.data();
+            line.assign(buffer_, pos_, end - pos_);
+            pos_ = end + 1;
+            return true;
+        }
+        
+        size_t unread = buffer_.size() - pos_;
+        if (!fill()) break;
+        scanned = pos_ + unread;
+    }
+    
+    if (pos_ < buffer_.size()) {
+        line.assign(buffer_, pos_, std::string::npos);
+        pos_ = buffer_.size();
+        return true;
+    }
+    return false;
+}
+
+// Commands run from a script read by the shell on stdin share that fd with
+// us. Give back whatever we read ahead so they see the bytes that follow the
+// current line. Only possible when the fd is seekable.
+void ScriptReader::sync() {
+    if (fd_ == -1 || pos_ == buffer_.size()) return;
+    
+    off_t unread = static_cast<off_t>(buffer_.size() - pos_);
+    if (lseek(fd_, -unread, SEEK_CUR) != -1) {
+        buffer_.clear();
+        pos_ = 0;
+        eof_ = false;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SCRIPT_INPUT_H
+#define SCRIPT_INPUT_H
+
+#include <string>
+
+// Line reader for non-interactive input (-c strings, script files, piped stdin).
+// Reads in large blocks instead of going through readline.
+class ScriptReader {
+public:
+    explicit ScriptReader(int fd);
+    explicit ScriptReader(std::string text);
+    ~ScriptReader();
+    
+    bool read_line(std::string& line);
+    void sync();
+    
+private:
+    bool fill();
+    
+    int fd_;
+    bool owns_fd_;
+    bool eof_;
+    std::string buffer_;
+    size_t pos_;
+};
+
+// Active non-interactive input; nullptr when reading from readline.
+extern ScriptReader* script_input;
+
+#endif // SCRIPT_INPUT_H
@@ -3,53 +3,38 @@
 #include "executor.h"
 #include "utils.h"
 #include "job_control.h"
+#include "script_input.h"
+#include "history_log.h"
+#include "history_search.h"
+#include "prompt.h"
+#include "variables.h"
+#include "trace.h"
 #include <iostream>
 #include <signal.h>
+#include <poll.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <vector>
+#include <chrono>
 
 pid_t shell_pgid;
 struct termios shell_tmodes;
 bool shell_is_interactive;
+int last_exit_status = 0;
+int last_substitution_status = -1;
+bool expansion_failed = false;
+std::vector<int> pipe_status{0};
+bool pipe_status_published = false;
+bool option_pipefail = false;
+volatile sig_atomic_t interrupt_pending = 0;
 
 // Signal handlers
-void sigchld_handler(int sig) {
-    (void)sig;
-    int status;
-    pid_t pid;
-    
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        for (auto& job : jobs) {
-            auto it = std::find(job.pids.begin(), job.pids.end(), pid);
-            if (it != job.pids.end()) {
-                if (WIFSTOPPED(status)) {
-                    job.stopped = true;
-                    if (!job.background) {
-                        std::cerr << "\n[" << job.job_id << "]+ Stopped   " 
-                                  << job.command << std::endl;
-                    }
-                } else if (WIFCONTINUED(status)) {
-                    job.stopped = false;
-                } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                    job.pids.erase(it);
-                    if (job.pids.empty() && job.background) {
-                        std::cerr << "\n[" << job.job_id << "]+ Done       " 
-                                  << job.command << std::endl;
-                    }
-                }
-            }
-        }
-    }
-    
-    // Remove completed jobs
-    jobs.erase(std::remove_if(jobs.begin(), jobs.end(),
-        [](const Job& j) { return j.pids.empty(); }), jobs.end());
-}
-
 void sigint_handler(int sig) {
     (void)sig;
+    interrupt_pending = 1;
     std::cout << std::endl;
     rl_on_new_line();
     rl_redisplay();
@@ -59,8 +44,10 @@ void sigtstp_handler(int sig) {
     (void)sig;
 }
 
-void init_shell() {
-    shell_is_interactive = isatty(STDIN_FILENO);
+void init_shell(bool interactive) {
+    shell_is_interactive = interactive;
+    init_variables();
+    init_child_reaper();
     
     if (shell_is_interactive) {
         shell_pgid = getpid();
@@ -74,39 +61,12 @@ void init_shell() {
         
         signal(SIGINT, sigint_handler);
         signal(SIGTSTP, sigtstp_handler);
-        signal(SIGCHLD, sigchld_handler);
         signal(SIGQUIT, SIG_IGN);
         signal(SIGTTOU, SIG_IGN);
         signal(SIGTTIN, SIG_IGN);
     }
 }
 
-std::string get_prompt() {
-    char cwd[4096];
-    if (!getcwd(cwd, sizeof(cwd))) {
-        return "$ ";
-    }
-    
-    std::string path = cwd;
-    const char* home = std::getenv("HOME");
-    if (home && path.find(home) == 0) {
-        path = "~" + path.substr(strlen(home));
-    }
-    
-    const char* user = std::getenv("USER");
-    if (!user) user = std::getenv("LOGNAME");
-    
-    const char* GREEN = "\033[32m";
-    const char* BLUE = "\033[34m";
-    const char* RESET = "\033[0m";
-    
-    if (user) {
-        return std::string(GREEN) + user + RESET + ":" + BLUE + path + RESET + "$ ";
-    } else {
-        return BLUE + path + RESET + "$ ";
-    }
-}
-
 void print_welcome_message() {
     const char* CYAN = "\033[36m";
     const char* GREEN = "\033[32m";
@@ -120,7 +80,7 @@ void print_welcome_message() {
     std::cout << "║                                                ║\n";
     std::cout << "╚════════════════════════════════════════════════╝" << RESET << "\n\n";
     
-    const char* user = std::getenv("USER");
+    const char* user = get_variable("USER");
     if (user) {
         std::cout << GREEN << "👤 User: " << RESET << user << std::endl;
     }
@@ -153,24 +113,97 @@ void print_welcome_message() {
     std::cout << "\n" << std::string(50, '-') << "\n\n";
 }
 
+// Waits for a key while servicing SIGCHLD, so background jobs are reaped
+// as they finish instead of piling up as zombies until the next command,
+// and redraws the prompt when a slow prompt segment comes in.
+static int shell_getc(FILE* stream) {
+    int sigfd = child_signal_fd();
+    while (sigfd != -1) {
+        struct pollfd fds[3] = {{fileno(stream), POLLIN, 0}, {sigfd, POLLIN, 0},
+                                {prompt_update_fd(), POLLIN, 0}};
+        if (poll(fds, 3, -1) == -1) break;  // a signal for readline to handle
+        if (fds[1].revents & POLLIN) service_child_signals();
+        if ((fds[2].revents & POLLIN) && service_prompt_updates()) {
+            rl_set_prompt(get_prompt().c_str());
+            rl_forced_update_display();
+        }
+        if (fds[0].revents) break;
+    }
+    return rl_getc(stream);
+}
+
+// Ctrl-R: incremental search backed by the history index instead of
+// readline's linear walk. Ctrl-R again steps to the next-best match.
+static int reverse_search(int, int) {
+    std::string saved_line = rl_line_buffer;
+    int saved_point = rl_point;
+    std::string pattern;
+    std::vector<HistoryMatch> matches;
+    size_t choice = 0;
+    std::string prompt = rl_prompt ? rl_prompt : "";
+    
+    while (true) {
+        bool failing = !pattern.empty() && matches.empty();
+        std::string status = std::string("(") + (failing ? "failing " : "") + "reverse-i-search)`" + pattern + "': ";
+        rl_set_prompt(status.c_str());
+        if (!matches.empty()) {
+            const std::string& line = matches[choice].text;
+            rl_replace_line(line.c_str(), 0);
+            rl_point = static_cast<int>(line.find(pattern));
+        }
+        rl_redisplay();
+        
+        int c = rl_read_key();
+        if (c == 18) {                          // Ctrl-R
+            if (choice + 1 < matches.size()) choice++;
+            continue;
+        }
+        if (c == 7) {                           // Ctrl-G
+            rl_replace_line(saved_line.c_str(), 0);
+            rl_point = saved_point;
+            break;
+        }
+        if (c == 127 || c == 8) {
+            if (!pattern.empty()) pattern.pop_back();
+        } else if (c >= 32 && c < 127) {
+            pattern.push_back(static_cast<char>(c));
+        } else {
+            if (c != 27) rl_execute_next(c);    // Enter and friends act on the match
+            break;
+        }
+        matches = pattern.empty() ? std::vector<HistoryMatch>() : search_history(pattern, 64);
+        choice = 0;
+    }
+    rl_set_prompt(prompt.c_str());
+    rl_redisplay();
+    return 0;
+}
+
 void setup_readline(std::string& history_file) {
     extern char** command_completion(const char*, int, int);
     rl_attempted_completion_function = command_completion;
+    rl_getc_function = shell_getc;
+    rl_bind_keyseq("\\C-r", reverse_search);
     
-    const char* histfile_env = std::getenv("HISTFILE");
+    const char* histfile_env = get_variable("HISTFILE");
     if (histfile_env) {
         history_file = histfile_env;
     } else {
-        const char* home = std::getenv("HOME");
+        const char* home = get_variable("HOME");
         history_file = std::string(home ? home : ".") + "/.shell_history";
     }
     
-    stifle_history(500);
-    read_history(history_file.c_str());
-}
-
-void save_history(const std::string& history_file) {
-    write_history(history_file.c_str());
+    int history_size = 1000;
+    if (const char* size_env = get_variable("HISTSIZE")) {
+        history_size = std::max(1, std::atoi(size_env));
+    }
+    stifle_history(history_size);
+    
+    if (open_history_log(history_file)) {
+        history_log_load_tail(history_size);
+    } else {
+        read_history(history_file.c_str());
+    }
 }
 
 void run_shell() {
@@ -179,6 +212,10 @@ void run_shell() {
     print_welcome_message();
     
     while (true) {
+        service_child_signals();
+        flush_job_notifications(true);
+        history_log_merge();
+        
         std::string prompt = get_prompt();
         char* line = readline(prompt.c_str());
         
@@ -190,12 +227,48 @@ void run_shell() {
         std::string input = trim(line);
         
         if (!input.empty()) {
-            add_history(input.c_str());
-            process_command(input);
+            history_log_append(input);
+            interrupt_pending = 0;
+            auto start = std::chrono::steady_clock::now();
+            process_command(input, true);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            note_command_finished(last_exit_status, elapsed.count());
         }
         
         free(line);
     }
     
-    save_history(history_file);
+    if (!history_log_is_open()) {
+        write_history(history_file.c_str());
+    }
+}
+
+int run_script(ScriptReader& reader, bool shares_stdin) {
+    script_input = &reader;
+    
+    std::string line;
+    while (reader.read_line(line)) {
+        std::string input = trim(line);
+        
+        if (input.empty() || input[0] == '#') continue;
+        
+        // Parse first: a compound command may continue on the next lines,
+        // and commands sharing stdin must start reading after all of them.
+        TraceSpan span("command", input);
+        ParseTree tree = parse_to_ast(input, true);
+        if (shares_stdin) {
+            reader.sync();
+        }
+        if (tree.error) {
+            last_exit_status = 2;
+        } else {
+            execute_ast_node(tree.root, false);
+        }
+        
+        service_child_signals();
+        flush_job_notifications(false);
+    }
+    
+    script_input = nullptr;
+    return last_exit_status;
 }
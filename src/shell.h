@@ -2,18 +2,28 @@
 #define SHELL_H
 
 #include <string>
+#include <vector>
 #include <termios.h>
+#include <csignal>
 #include <unistd.h>
 
 extern pid_t shell_pgid;
 extern struct termios shell_tmodes;
 extern bool shell_is_interactive;
+extern int last_exit_status;
+extern int last_substitution_status;    // of the last $(...), -1 if none ran since reset
+extern bool expansion_failed;           // an expansion reported an error; the command must not run
+extern std::vector<int> pipe_status;           // per-stage statuses of the last pipeline, for PIPESTATUS
+extern bool pipe_status_published;             // set by a builtin (fg) that filled pipe_status itself
+extern bool option_pipefail;
+extern volatile sig_atomic_t interrupt_pending;  // Ctrl-C while the shell itself was running a command
 
-void init_shell();
-std::string get_prompt();
+class ScriptReader;
+
+void init_shell(bool interactive);
 void print_welcome_message();
 void setup_readline(std::string& history_file);
-void save_history(const std::string& history_file);
 void run_shell();
+int run_script(ScriptReader& reader, bool shares_stdin);
 
 #endif // SHELL_H
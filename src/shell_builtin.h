@@ -0,0 +1,61 @@
+#ifndef SHELL_BUILTIN_H
+#define SHELL_BUILTIN_H
+
+/*
+ * C ABI for builtins loaded with `enable -f lib.so name`. The library
+ * exports one `const struct shell_builtin name_builtin` per builtin and is
+ * built with e.g. `cc -shared -fPIC -o lib.so lib.c`; it needs no symbols
+ * from the shell.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHELL_BUILTIN_ABI_VERSION 1
+
+/* Only writes output and reads variables: may run on a worker thread as a
+   pipeline stage or inside $(...) instead of in a forked subshell. */
+#define SHELL_BUILTIN_PURE 0x1
+
+struct shell_builtin_io {
+    int abi_version;
+    int in_fd;                     /* standard input, after redirections */
+    int out_fd;                    /* standard output after redirections, -1 inside $(...) */
+    int err_fd;
+    void* context;
+
+    /* Buffered writes to out/err; use these or the fds, not both. Return 0,
+       or -1 once the destination has failed. */
+    int (*write_out)(void* context, const char* data, size_t length);
+    int (*write_err)(void* context, const char* data, size_t length);
+
+    /* Shell variable, exported or not; NULL when unset. The string stays
+       valid until the variable changes. */
+    const char* (*get_variable)(void* context, const char* name);
+
+    /* NULL-terminated envp the shell passes to the commands it runs. */
+    char* const* (*environment)(void* context);
+};
+
+struct shell_builtin {
+    int abi_version;               /* SHELL_BUILTIN_ABI_VERSION */
+    unsigned flags;                /* SHELL_BUILTIN_* */
+    const char* usage;             /* synopsis for `help`, e.g. "jsonfield key [file]" */
+    const char* description;       /* one line for `help` */
+
+    /* argv[0] is the builtin's name; returns the exit status. */
+    int (*run)(int argc, char* const* argv, const struct shell_builtin_io* io);
+
+    /* Optional. A nonzero return from load refuses the builtin. */
+    int (*load)(const char* name);
+    void (*unload)(const char* name);
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHELL_BUILTIN_H */
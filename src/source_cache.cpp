@@ -0,0 +1,478 @@
+#include "source_cache.h"
+#include "heredoc.h"
+#include "script_input.h"
+#include "variables.h"
+#include "utils.h"
+#include "trace.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <cstddef>
+#include <initializer_list>
+
+static const char cache_magic[8] = {'S', 'H', 'A', 'S', 'T', '0', '0', '2'};
+
+static constexpr uint64_t fingerprint(std::initializer_list<uint64_t> values) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t value : values) {
+        hash = (hash ^ value) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// AST_FORMAT_VERSION plus the sizes and offsets of everything an image holds,
+// so a layout change in parser.h invalidates old images even if nobody bumps
+// the version. Identical for every build of the same source.
+static constexpr uint64_t ast_layout = fingerprint({
+    AST_FORMAT_VERSION, sizeof(void*),
+    sizeof(Word), offsetof(Word, needs_expansion),
+    sizeof(Redirect), offsetof(Redirect, target), offsetof(Redirect, heredoc_fd),
+    sizeof(ASTNode), offsetof(ASTNode, words), offsetof(ASTNode, assigns),
+    offsetof(ASTNode, redirs), offsetof(ASTNode, children),
+});
+
+struct CacheHeader {
+    char magic[8];
+    uint64_t layout;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_ino;
+    uint64_t image_size;
+    uint64_t path_offset;
+    uint64_t path_length;
+    uint64_t commands_offset;          // uint64_t per command, 0 for a syntax error
+    uint64_t command_count;
+    uint64_t heredocs_offset;          // HeredocEntry per heredoc body
+    uint64_t heredoc_count;
+};
+
+struct HeredocEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+static SourceCacheStats stats;
+
+const SourceCacheStats& source_cache_stats() {
+    return stats;
+}
+
+CompiledScript::~CompiledScript() {
+    for (int fd : heredoc_fds) {
+        if (fd != -1) close(fd);
+    }
+    if (mapped_image) munmap(mapped_image, mapped_size);
+}
+
+template <typename T>
+static T* offset_pointer(uint64_t offset) {
+    return reinterpret_cast<T*>(static_cast<uintptr_t>(offset));
+}
+
+// Serializes ASTs into an image where every pointer holds an offset from the
+// start of the image. Nodes are placed before anything they point to.
+class ImageWriter {
+public:
+    ImageWriter() : image_(sizeof(CacheHeader), '\0') {}
+    
+    uint64_t reserve(size_t size, size_t align) {
+        size_t offset = (image_.size() + align - 1) & ~(align - 1);
+        image_.resize(offset + size);
+        return offset;
+    }
+    
+    uint64_t text(std::string_view text) {
+        uint64_t offset = reserve(text.size() + 1, 1);
+        if (!text.empty()) std::memcpy(&image_[offset], text.data(), text.size());
+        return offset;
+    }
+    
+    template <typename T>
+    void put(uint64_t offset, const T& value) {
+        std::memcpy(&image_[offset], &value, sizeof(T));
+    }
+    
+    uint64_t node(const ASTNode* node, std::vector<int>& heredoc_fds) {
+        uint64_t offset = reserve(sizeof(ASTNode), alignof(ASTNode));
+        ASTNode copy;
+        copy.type = node->type;
+        copy.words = words(node->words);
+        copy.assigns = words(node->assigns);
+        
+        if (!node->redirs.empty()) {
+            uint64_t array = reserve(node->redirs.size * sizeof(Redirect), alignof(Redirect));
+            for (size_t i = 0; i < node->redirs.size; i++) {
+                Redirect r = node->redirs[i];
+                r.target = word(r.target);
+                if (r.heredoc_fd != -1) {
+                    heredoc_fds.push_back(r.heredoc_fd);
+                    r.heredoc_fd = static_cast<int>(heredoc_fds.size() - 1);
+                }
+                put(array + i * sizeof(Redirect), r);
+            }
+            copy.redirs = {offset_pointer<Redirect>(array), node->redirs.size};
+        }
+        
+        if (!node->children.empty()) {
+            uint64_t array = reserve(node->children.size * sizeof(ASTNode*), alignof(ASTNode*));
+            for (size_t i = 0; i < node->children.size; i++) {
+                put(array + i * sizeof(ASTNode*), offset_pointer<ASTNode>(this->node(node->children[i], heredoc_fds)));
+            }
+            copy.children = {offset_pointer<ASTNode*>(array), node->children.size};
+        }
+        
+        put(offset, copy);
+        return offset;
+    }
+    
+    std::string& image() { return image_; }
+
+private:
+    Word word(const Word& word) {
+        uint64_t offset = text(word.text);
+        return {std::string_view(offset_pointer<const char>(offset), word.text.size()), word.needs_expansion};
+    }
+    
+    Span<Word> words(Span<Word> words) {
+        if (words.empty()) return {};
+        uint64_t array = reserve(words.size * sizeof(Word), alignof(Word));
+        for (size_t i = 0; i < words.size; i++) {
+            put(array + i * sizeof(Word), word(words[i]));
+        }
+        return {offset_pointer<Word>(array), words.size};
+    }
+    
+    std::string image_;
+};
+
+// Turns the offsets of an image back into pointers, checking each against
+// the image bounds. Everything a node points to must lie after the node, so
+// a damaged image cannot form a cycle.
+class ImageLoader {
+public:
+    ImageLoader(char* base, size_t size, const std::vector<int>& heredoc_fds)
+        : base_(base), size_(size), heredoc_fds_(heredoc_fds) {}
+    
+    bool node(ASTNode*& pointer, uint64_t after) {
+        uint64_t offset = reinterpret_cast<uintptr_t>(pointer);
+        if (!fix(pointer, 1, after)) return false;
+        
+        ASTNode* n = pointer;
+        if (n->type > NodeType::SUBSHELL) return false;
+        if (!words(n->words, offset) || !words(n->assigns, offset)) return false;
+        
+        if (!fix(n->redirs.data, n->redirs.size, offset)) return false;
+        for (Redirect& r : n->redirs) {
+            if (!word(r.target)) return false;
+            if (r.heredoc_fd != -1) {
+                if (r.heredoc_fd < 0 || static_cast<size_t>(r.heredoc_fd) >= heredoc_fds_.size()) return false;
+                r.heredoc_fd = heredoc_fds_[r.heredoc_fd];
+            }
+        }
+        
+        if (!fix(n->children.data, n->children.size, offset)) return false;
+        for (ASTNode*& child : n->children) {
+            if (!node(child, offset)) return false;
+        }
+        return true;
+    }
+    
+    bool in_bounds(uint64_t offset, uint64_t length) const {
+        return offset >= sizeof(CacheHeader) && offset <= size_ && length <= size_ - offset;
+    }
+
+private:
+    template <typename T>
+    bool fix(T*& pointer, size_t count, uint64_t after) {
+        if (count == 0) {
+            pointer = nullptr;
+            return true;
+        }
+        uint64_t offset = reinterpret_cast<uintptr_t>(pointer);
+        if (offset <= after || offset % alignof(T) != 0 || count > size_ / sizeof(T) ||
+            !in_bounds(offset, count * sizeof(T))) {
+            return false;
+        }
+        pointer = reinterpret_cast<T*>(base_ + offset);
+        return true;
+    }
+    
+    bool word(Word& word) {
+        uint64_t offset = reinterpret_cast<uintptr_t>(word.text.data());
+        if (!in_bounds(offset, word.text.size() + 1)) return false;
+        word.text = std::string_view(base_ + offset, word.text.size());
+        return true;
+    }
+    
+    bool words(Span<Word>& words, uint64_t after) {
+        if (!fix(words.data, words.size, after)) return false;
+        for (Word& w : words) {
+            if (!word(w)) return false;
+        }
+        return true;
+    }
+    
+    char* base_;
+    size_t size_;
+    const std::vector<int>& heredoc_fds_;
+};
+
+std::string source_cache_dir() {
+    if (const Variable* dir = find_variable("SHELL_SOURCE_CACHE")) {
+        return dir->value;             // empty disables the cache
+    }
+    if (const char* xdg = get_variable("XDG_CACHE_HOME")) {
+        if (*xdg) return std::string(xdg) + "/shell/ast";
+    }
+    const char* home = get_variable("HOME");
+    return std::string(home ? home : "/tmp") + "/.cache/shell/ast";
+}
+
+static std::string cache_file_for(const std::string& dir, const std::string& path) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : path) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.ast", static_cast<unsigned long long>(hash));
+    return dir + name;
+}
+
+static void make_directories(const std::string& dir) {
+    for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+        mkdir(dir.substr(0, slash).c_str(), 0700);
+        if (slash == std::string::npos) break;
+    }
+}
+
+static void fill_key(CacheHeader& header, const std::string& path, const struct stat& st) {
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.layout = ast_layout;
+    header.source_size = st.st_size;
+    header.source_mtime_sec = st.st_mtim.tv_sec;
+    header.source_mtime_nsec = st.st_mtim.tv_nsec;
+    header.source_ino = st.st_ino;
+    header.path_length = path.size();
+}
+
+// Rebuilds the heredoc fds and pointers of a complete image.
+static bool load_image(char* base, size_t size, CompiledScript& script) {
+    CacheHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    ImageLoader loader(base, size, script.heredoc_fds);
+    
+    if (!loader.in_bounds(header.heredocs_offset, header.heredoc_count * sizeof(HeredocEntry)) ||
+        !loader.in_bounds(header.commands_offset, header.command_count * sizeof(uint64_t))) {
+        return false;
+    }
+    for (uint64_t i = 0; i < header.heredoc_count; i++) {
+        HeredocEntry entry;
+        std::memcpy(&entry, base + header.heredocs_offset + i * sizeof(entry), sizeof(entry));
+        if (!loader.in_bounds(entry.offset, entry.size)) return false;
+        script.heredoc_fds.push_back(make_heredoc(std::string_view(base + entry.offset, entry.size)));
+    }
+    
+    for (uint64_t i = 0; i < header.command_count; i++) {
+        uint64_t offset;
+        std::memcpy(&offset, base + header.commands_offset + i * sizeof(offset), sizeof(offset));
+        ASTNode* root = offset_pointer<ASTNode>(offset);
+        if (offset != 0 && !loader.node(root, sizeof(CacheHeader) - 1)) return false;
+        script.commands.push_back(offset != 0 ? root : nullptr);
+    }
+    return true;
+}
+
+// Maps the cache file for `path` if it was built from this exact file by
+// a shell with the same AST layout. Returns false on a miss, counting the reason.
+static bool load_cached(const std::string& cache_file, const std::string& path, const struct stat& st,
+                        CompiledScript& script) {
+    int fd = open(cache_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        stats.misses++;
+        return false;
+    }
+    
+    struct stat cache_st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &cache_st) == 0 && static_cast<size_t>(cache_st.st_size) >= sizeof(CacheHeader)) {
+        map = mmap(nullptr, cache_st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        stats.stale++;
+        return false;
+    }
+    
+    char* base = static_cast<char*>(map);
+    size_t size = cache_st.st_size;
+    CacheHeader expected = {};
+    fill_key(expected, path, st);
+    CacheHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    
+    bool valid = std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+                 header.layout == expected.layout &&
+                 header.source_size == expected.source_size &&
+                 header.source_mtime_sec == expected.source_mtime_sec &&
+                 header.source_mtime_nsec == expected.source_mtime_nsec &&
+                 header.source_ino == expected.source_ino &&
+                 header.image_size == size &&
+                 header.path_length == path.size() &&
+                 header.path_offset < size && path.size() <= size - header.path_offset &&
+                 path.compare(0, path.size(), base + header.path_offset, path.size()) == 0;
+    
+    script.mapped_image = base;
+    script.mapped_size = size;
+    if (!valid || !load_image(base, size, script)) {
+        for (int heredoc_fd : script.heredoc_fds) {
+            if (heredoc_fd != -1) close(heredoc_fd);
+        }
+        script.heredoc_fds.clear();
+        script.commands.clear();
+        munmap(base, size);
+        script.mapped_image = nullptr;
+        script.mapped_size = 0;
+        stats.stale++;
+        return false;
+    }
+    stats.hits++;
+    return true;
+}
+
+static bool write_cache(const std::string& dir, const std::string& cache_file, const std::string& image) {
+    make_directories(dir);
+    std::string temp = cache_file + ".tmp." + std::to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) return false;
+    
+    size_t written = 0;
+    while (written < image.size()) {
+        ssize_t n = write(fd, image.data() + written, image.size() - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    close(fd);
+    
+    // rename() keeps concurrent shells from ever mapping a half-written file.
+    if (written != image.size() || rename(temp.c_str(), cache_file.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+static std::string read_fd(int fd) {
+    struct stat st;
+    std::string body;
+    if (fstat(fd, &st) != 0) return body;
+    body.resize(st.st_size);
+    ssize_t n = pread(fd, &body[0], body.size(), 0);
+    body.resize(n > 0 ? n : 0);
+    return body;
+}
+
+// Parses every command of the file, reading heredoc bodies and the rest of
+// multi-line commands from the file itself, and serializes the result into
+// an image.
+static void build_image(int fd, const std::string& path, const struct stat& st, std::string& image,
+                        bool& has_errors) {
+    ScriptReader reader(fd);
+    ScriptReader* outer_input = script_input;
+    script_input = &reader;
+    
+    ImageWriter writer;
+    std::vector<int> heredoc_fds;
+    std::vector<uint64_t> commands;
+    std::vector<ParseTree> trees;
+    std::string line;
+    has_errors = false;
+    
+    while (reader.read_line(line)) {
+        std::string input = trim(line);
+        if (input.empty() || input[0] == '#') continue;
+        
+        ParseTree tree = parse_to_ast(input, true);
+        if (tree.error) {
+            has_errors = true;
+            commands.push_back(0);
+        } else if (tree.root) {
+            commands.push_back(writer.node(tree.root, heredoc_fds));
+        }
+        trees.push_back(std::move(tree));  // keeps heredoc fds open until copied
+    }
+    script_input = outer_input;
+    
+    CacheHeader header = {};
+    fill_key(header, path, st);
+    header.path_offset = writer.text(path);
+    header.command_count = commands.size();
+    header.commands_offset = writer.reserve(commands.size() * sizeof(uint64_t), alignof(uint64_t));
+    for (size_t i = 0; i < commands.size(); i++) {
+        writer.put(header.commands_offset + i * sizeof(uint64_t), commands[i]);
+    }
+    
+    std::vector<HeredocEntry> heredocs;
+    for (int heredoc_fd : heredoc_fds) {
+        std::string body = read_fd(heredoc_fd);
+        heredocs.push_back({writer.reserve(body.size(), 1), body.size()});
+        if (!body.empty()) std::memcpy(&writer.image()[heredocs.back().offset], body.data(), body.size());
+    }
+    header.heredoc_count = heredocs.size();
+    header.heredocs_offset = writer.reserve(heredocs.size() * sizeof(HeredocEntry), alignof(HeredocEntry));
+    for (size_t i = 0; i < heredocs.size(); i++) {
+        writer.put(header.heredocs_offset + i * sizeof(HeredocEntry), heredocs[i]);
+    }
+    
+    header.image_size = writer.image().size();
+    writer.put(0, header);
+    image = std::move(writer.image());
+}
+
+bool compile_script(const std::string& path, CompiledScript& script, std::string& error) {
+    TraceSpan span("source", path);
+    
+    char resolved[PATH_MAX];
+    std::string canonical = realpath(path.c_str(), resolved) ? resolved : path;
+    int fd = open(canonical.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        error = std::strerror(errno);
+        if (fd != -1) close(fd);
+        return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        error = "is a directory";
+        return false;
+    }
+    
+    std::string dir = source_cache_dir();
+    std::string cache_file = dir.empty() ? "" : cache_file_for(dir, canonical);
+    if (!dir.empty() && load_cached(cache_file, canonical, st, script)) {
+        close(fd);
+        return true;
+    }
+    
+    bool has_errors = false;
+    build_image(fd, canonical, st, script.built_image, has_errors);
+    if (!dir.empty()) {
+        if (!has_errors && write_cache(dir, cache_file, script.built_image)) {
+            stats.writes++;
+        } else {
+            stats.uncacheable++;
+        }
+    }
+    
+    if (!load_image(&script.built_image[0], script.built_image.size(), script)) {
+        error = "cannot load compiled script";
+        return false;
+    }
+    return true;
+}
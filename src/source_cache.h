@@ -0,0 +1,37 @@
+#ifndef SOURCE_CACHE_H
+#define SOURCE_CACHE_H
+
+#include "parser.h"
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// A sourced file compiled to one AST per complete command. All nodes, words and
+// heredoc bodies live in a single image, built from a fresh parse or mapped
+// from the on-disk cache, whose offsets are turned into pointers once loaded.
+struct CompiledScript {
+    std::vector<ASTNode*> commands;    // nullptr for a command with a syntax error
+    std::vector<int> heredoc_fds;
+    std::string built_image;           // image of a fresh parse
+    char* mapped_image = nullptr;      // image mapped from the cache
+    size_t mapped_size = 0;
+    
+    CompiledScript() = default;
+    CompiledScript(const CompiledScript&) = delete;
+    CompiledScript& operator=(const CompiledScript&) = delete;
+    ~CompiledScript();
+};
+
+struct SourceCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;                 // no cache file yet
+    size_t stale = 0;                  // cached for another version of the file or shell
+    size_t writes = 0;
+    size_t uncacheable = 0;            // syntax errors, or the cache could not be written
+};
+
+bool compile_script(const std::string& path, CompiledScript& script, std::string& error);
+std::string source_cache_dir();
+const SourceCacheStats& source_cache_stats();
+
+#endif // SOURCE_CACHE_H
@@ -0,0 +1,148 @@
+#include "timeout.h"
+#include "child_wait.h"
+#include "command_hash.h"
+#include "job_control.h"
+#include "launch.h"
+#include "shell.h"
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/wait.h>
+
+struct SignalName {
+    const char* name;
+    int number;
+};
+
+static const SignalName signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"ABRT", SIGABRT},
+    {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"SEGV", SIGSEGV}, {"USR2", SIGUSR2},
+    {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+    {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"XCPU", SIGXCPU}, {"WINCH", SIGWINCH},
+};
+
+// NAME, SIGNAME or a number; -1 if it names no signal.
+int parse_signal(const std::string& text) {
+    if (text.empty()) return -1;
+    if (text[0] >= '0' && text[0] <= '9') {
+        char* end;
+        long number = std::strtol(text.c_str(), &end, 10);
+        return *end == '\0' && number < NSIG ? static_cast<int>(number) : -1;
+    }
+    
+    const char* name = text.c_str();
+    if (strncasecmp(name, "SIG", 3) == 0) name += 3;
+    for (const SignalName& entry : signal_names) {
+        if (strcasecmp(name, entry.name) == 0) return entry.number;
+    }
+    return -1;
+}
+
+// A number of seconds with an optional s, m, h or d suffix.
+bool parse_duration(const std::string& text, double& seconds) {
+    char* end;
+    errno = 0;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || errno != 0 || !std::isfinite(value) || value < 0) return false;
+    
+    switch (*end) {
+        case '\0':
+        case 's': break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 60 * 60; break;
+        case 'd': value *= 24 * 60 * 60; break;
+        default: return false;
+    }
+    if (*end != '\0' && end[1] != '\0') return false;
+    seconds = value;
+    return true;
+}
+
+static WaitClock::time_point after(double seconds) {
+    if (seconds <= 0) return WaitClock::time_point::max();
+    auto delay = std::chrono::duration_cast<WaitClock::duration>(std::chrono::duration<double>(seconds));
+    return WaitClock::now() + delay;
+}
+
+int run_timeout(const TimeoutOptions& options, int in, OutputSink& out, OutputSink& err) {
+    const std::string& name = options.command[0];
+    LaunchSpec spec;
+    spec.path = hash_lookup(name);
+    if (spec.path.empty()) {
+        err << "timeout: failed to run command '" << name << "': No such file or directory" << '\n';
+        return 127;
+    }
+    
+    std::string text;
+    for (const auto& word : options.command) {
+        if (!text.empty()) text += ' ';
+        text += word;
+        spec.argv.push_back(const_cast<char*>(word.c_str()));
+    }
+    spec.argv.push_back(nullptr);
+    spec.input_fd = in;
+    spec.output_fd = out.fd();
+    spec.error_fd = err.fd();
+    // Its own group, so the signal reaches everything the command starts.
+    // The terminal goes with it only when the shell holds it, not when this
+    // runs as a stage of a pipeline.
+    spec.pgid = 0;
+    spec.foreground = shell_is_interactive && getpgrp() == shell_pgid;
+    
+    // The command writes straight to our fds, so anything buffered goes first.
+    out.flush();
+    err.flush();
+    
+    int launch_err = 0;
+    pid_t pid = launch_process(spec, launch_err);
+    if (pid < 0) {
+        if (launch_err == ENOENT) hash_remove(name);
+        err << "timeout: failed to run command '" << name << "': " << strerror(launch_err) << '\n';
+        return launch_err == ENOENT ? 127 : 126;
+    }
+    setpgid(pid, pid);
+    
+    ChildWaiter waiter(true);
+    waiter.add(pid);
+    WaitClock::time_point deadline = after(options.duration);
+    bool interruptible = true;
+    bool timed_out = false;
+    bool killed = false;
+    int status = 0;
+    
+    for (;;) {
+        pid_t reaped;
+        WaitEvent event = waiter.next(reaped, status, deadline, interruptible);
+        if (event == WaitEvent::CHILD) break;
+        
+        if (event == WaitEvent::INTERRUPT) {
+            // Ctrl-C reached the shell instead of the command's group.
+            kill(-pid, SIGINT);
+            interruptible = false;
+        } else if (!timed_out) {
+            timed_out = true;
+            killed = options.signal == SIGKILL;
+            kill(-pid, options.signal);
+            if (!killed) kill(-pid, SIGCONT);
+            deadline = after(options.kill_after);
+        } else {
+            killed = true;
+            kill(-pid, SIGKILL);
+            deadline = WaitClock::time_point::max();
+        }
+    }
+    
+    if (spec.foreground) {
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+    }
+    if (WIFSTOPPED(status)) {
+        // Stopped from the terminal: a job like any other, without the limit.
+        add_job(pid, text, {pid}, false);
+        update_job_status(pid, status);
+        return exit_status_from_wait(status);
+    }
+    if (timed_out) return killed ? 128 + SIGKILL : 124;
+    return exit_status_from_wait(status);
+}
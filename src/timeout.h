@@ -0,0 +1,24 @@
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+
+#include "output.h"
+#include <csignal>
+#include <string>
+#include <vector>
+
+struct TimeoutOptions {
+    std::vector<std::string> command;
+    double duration = 0;               // seconds, 0 for no limit
+    double kill_after = 0;             // seconds from the first signal to SIGKILL, 0 for never
+    int signal = SIGTERM;
+};
+
+// Runs the command in its own process group and signals the whole group
+// once the duration passes. Returns 124 on a timeout (137 if SIGKILL had to
+// be sent), otherwise the command's status, as coreutils timeout does.
+int run_timeout(const TimeoutOptions& options, int in, OutputSink& out, OutputSink& err);
+
+bool parse_duration(const std::string& text, double& seconds);
+int parse_signal(const std::string& text);
+
+#endif // TIMEOUT_H
@@ -0,0 +1,155 @@
+#include "timing.h"
+#include "trace.h"
+#include <sys/wait.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+const char* const default_time_format =
+    "\nreal\t%3lR\nuser\t%3lU\nsys\t%3lS\nrss\t%M KB\ncsw\t%w voluntary, %c involuntary\n"
+    "io\t%I in, %O out (blocks)";
+const char* const posix_time_format = "real %2R\nuser %2U\nsys %2S";
+
+static std::vector<TimingScope*> active_scopes;
+
+static double seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void add_usage(UsageTotals& totals, const struct rusage& ru) {
+    totals.user_sec += seconds(ru.ru_utime);
+    totals.sys_sec += seconds(ru.ru_stime);
+    totals.max_rss_kb = std::max(totals.max_rss_kb, ru.ru_maxrss);
+    totals.minor_faults += ru.ru_minflt;
+    totals.major_faults += ru.ru_majflt;
+    totals.block_in += ru.ru_inblock;
+    totals.block_out += ru.ru_oublock;
+    totals.voluntary_switches += ru.ru_nvcsw;
+    totals.involuntary_switches += ru.ru_nivcsw;
+}
+
+// waitpid() that also charges the reaped child's resource usage to every
+// `time` currently running.
+pid_t wait_child(pid_t pid, int* status, int options) {
+    TraceSpan span("wait");
+    struct rusage ru;
+    pid_t result = wait4(pid, status, options, &ru);
+    if (result > 0) span.set_track(result);
+    if (result > 0 && !active_scopes.empty() && (WIFEXITED(*status) || WIFSIGNALED(*status))) {
+        for (TimingScope* scope : active_scopes) {
+            add_usage(scope->children, ru);
+        }
+    }
+    return result;
+}
+
+void begin_timing(TimingScope& scope) {
+    scope.children = UsageTotals();
+    getrusage(RUSAGE_SELF, &scope.self_start);
+    scope.start = std::chrono::steady_clock::now();
+    active_scopes.push_back(&scope);
+}
+
+TimingResult end_timing(TimingScope& scope) {
+    TimingResult result;
+    result.real_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - scope.start).count();
+    active_scopes.erase(std::find(active_scopes.begin(), active_scopes.end(), &scope));
+    
+    struct rusage self_end;
+    getrusage(RUSAGE_SELF, &self_end);
+    const struct rusage& s = scope.self_start;
+    
+    UsageTotals& usage = result.usage;
+    usage = scope.children;
+    usage.user_sec += seconds(self_end.ru_utime) - seconds(s.ru_utime);
+    usage.sys_sec += seconds(self_end.ru_stime) - seconds(s.ru_stime);
+    usage.minor_faults += self_end.ru_minflt - s.ru_minflt;
+    usage.major_faults += self_end.ru_majflt - s.ru_majflt;
+    usage.block_in += self_end.ru_inblock - s.ru_inblock;
+    usage.block_out += self_end.ru_oublock - s.ru_oublock;
+    usage.voluntary_switches += self_end.ru_nvcsw - s.ru_nvcsw;
+    usage.involuntary_switches += self_end.ru_nivcsw - s.ru_nivcsw;
+    
+    // The shell's own peak RSS is not a per-command figure; it only stands in
+    // when nothing was run as a separate process.
+    if (usage.max_rss_kb == 0) {
+        usage.max_rss_kb = self_end.ru_maxrss;
+    }
+    return result;
+}
+
+static void append_seconds(std::string& out, double value, int precision, bool long_format) {
+    char buffer[64];
+    if (long_format) {
+        long minutes = static_cast<long>(value / 60);
+        std::snprintf(buffer, sizeof(buffer), "%ldm%.*fs", minutes, precision, value - minutes * 60);
+    } else {
+        std::snprintf(buffer, sizeof(buffer), "%.*f", precision, value);
+    }
+    out += buffer;
+}
+
+// TIMEFORMAT as in bash: %[p][l]R, %[p][l]U, %[p][l]S, %P and %%, plus
+// %M (max RSS in KB), %F (major faults), %w / %c (voluntary / involuntary
+// context switches) and %I / %O (blocks read / written).
+std::string format_timing(const TimingResult& result, const std::string& format) {
+    const UsageTotals& usage = result.usage;
+    std::string out;
+    
+    for (size_t i = 0; i < format.size(); i++) {
+        if (format[i] != '%' || i + 1 == format.size()) {
+            out += format[i];
+            continue;
+        }
+        
+        size_t j = i + 1;
+        int precision = 3;
+        bool long_format = false;
+        if (format[j] >= '0' && format[j] <= '9') {
+            precision = std::min(format[j] - '0', 6);
+            j++;
+        }
+        if (j < format.size() && format[j] == 'l') {
+            long_format = true;
+            j++;
+        }
+        if (j == format.size()) {
+            out.append(format, i, std::string::npos);
+            break;
+        }
+        
+        switch (format[j]) {
+            case 'R': append_seconds(out, result.real_sec, precision, long_format); break;
+            case 'U': append_seconds(out, usage.user_sec, precision, long_format); break;
+            case 'S': append_seconds(out, usage.sys_sec, precision, long_format); break;
+            case 'P': {
+                double cpu = result.real_sec > 0 ? (usage.user_sec + usage.sys_sec) / result.real_sec * 100 : 0;
+                append_seconds(out, cpu, 2, false);
+                break;
+            }
+            case 'M': out += std::to_string(usage.max_rss_kb); break;
+            case 'F': out += std::to_string(usage.major_faults); break;
+            case 'w': out += std::to_string(usage.voluntary_switches); break;
+            case 'c': out += std::to_string(usage.involuntary_switches); break;
+            case 'I': out += std::to_string(usage.block_in); break;
+            case 'O': out += std::to_string(usage.block_out); break;
+            case '%': out += '%'; break;
+            default: out.append(format, i, j - i + 1); break;
+        }
+        i = j;
+    }
+    return out;
+}
+
+std::string timing_json(const TimingResult& result, int status) {
+    const UsageTotals& usage = result.usage;
+    char buffer[512];
+    std::snprintf(buffer, sizeof(buffer),
+                  "{\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"max_rss_kb\":%ld,"
+                  "\"minor_faults\":%ld,\"major_faults\":%ld,\"block_in\":%ld,\"block_out\":%ld,"
+                  "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld,\"status\":%d}",
+                  result.real_sec, usage.user_sec, usage.sys_sec, usage.max_rss_kb,
+                  usage.minor_faults, usage.major_faults, usage.block_in, usage.block_out,
+                  usage.voluntary_switches, usage.involuntary_switches, status);
+    return buffer;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <string>
+#include <chrono>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+struct UsageTotals {
+    double user_sec = 0;
+    double sys_sec = 0;
+    long max_rss_kb = 0;
+    long minor_faults = 0;
+    long major_faults = 0;
+    long block_in = 0;
+    long block_out = 0;
+    long voluntary_switches = 0;
+    long involuntary_switches = 0;
+};
+
+struct TimingResult {
+    double real_sec = 0;
+    UsageTotals usage;
+};
+
+// One `time` in progress. Children waited for through wait_child() while the
+// scope is active are added to `children`; work done by the shell itself
+// (builtins, worker threads) is the RUSAGE_SELF delta.
+struct TimingScope {
+    std::chrono::steady_clock::time_point start;
+    struct rusage self_start;
+    UsageTotals children;
+};
+
+extern const char* const default_time_format;
+extern const char* const posix_time_format;
+
+pid_t wait_child(pid_t pid, int* status, int options);
+void begin_timing(TimingScope& scope);
+TimingResult end_timing(TimingScope& scope);
+std::string format_timing(const TimingResult& result, const std::string& format);
+std::string timing_json(const TimingResult& result, int status);
+
+#endif // TIMING_H
@@ -0,0 +1,126 @@
+#include "trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+
+std::atomic<bool> trace_active{false};
+
+// Oldest events are overwritten once the ring is full.
+static const size_t trace_capacity = 1 << 16;
+static const size_t trace_detail_size = 80;
+
+struct TraceEvent {
+    std::atomic<uint64_t> sequence;  // claim index + 1 once the event is complete
+    const char* name;
+    int64_t start_ns;
+    int64_t end_ns;
+    int track;
+    char detail[trace_detail_size];
+};
+
+static std::unique_ptr<TraceEvent[]> trace_ring;
+static std::atomic<uint64_t> trace_next{0};
+static std::string trace_path;
+static pid_t trace_owner = -1;
+static int64_t trace_epoch_ns = 0;
+
+void init_tracing() {
+    const char* path = std::getenv("SHELL_TRACE_FILE");
+    if (!path || !*path) return;
+    
+    trace_path = path;
+    trace_owner = getpid();
+    trace_epoch_ns = trace_clock_ns();
+    trace_ring.reset(new TraceEvent[trace_capacity]());
+    trace_active.store(true, std::memory_order_release);
+    std::atexit(flush_trace);
+}
+
+void record_trace_event(const char* name, int64_t start_ns, int64_t end_ns, int track,
+                        std::string_view detail) {
+    uint64_t index = trace_next.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent& event = trace_ring[index & (trace_capacity - 1)];
+    
+    event.sequence.store(0, std::memory_order_relaxed);
+    event.name = name;
+    event.start_ns = start_ns;
+    event.end_ns = end_ns;
+    event.track = track;
+    size_t length = std::min(detail.size(), trace_detail_size - 1);
+    std::memcpy(event.detail, detail.data(), length);
+    event.detail[length] = '\0';
+    event.sequence.store(index + 1, std::memory_order_release);
+}
+
+static void write_json_string(FILE* out, const char* text) {
+    std::fputc('"', out);
+    for (const char* p = text; *p; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            std::fputc('\\', out);
+            std::fputc(c, out);
+        } else if (c < 0x20) {
+            std::fprintf(out, "\\u%04x", c);
+        } else {
+            std::fputc(c, out);
+        }
+    }
+    std::fputc('"', out);
+}
+
+// Only the shell that enabled tracing writes the file; forked subshells
+// exiting through exit() would otherwise overwrite it.
+void flush_trace() {
+    if (!tracing_enabled() || getpid() != trace_owner) return;
+    trace_active.store(false, std::memory_order_release);
+    
+    std::vector<const TraceEvent*> events;
+    for (size_t i = 0; i < trace_capacity; i++) {
+        if (trace_ring[i].sequence.load(std::memory_order_acquire) != 0) {
+            events.push_back(&trace_ring[i]);
+        }
+    }
+    std::sort(events.begin(), events.end(), [](const TraceEvent* a, const TraceEvent* b) {
+        return a->sequence.load(std::memory_order_relaxed) < b->sequence.load(std::memory_order_relaxed);
+    });
+    
+    FILE* out = std::fopen(trace_path.c_str(), "w");
+    if (!out) {
+        std::perror(trace_path.c_str());
+        return;
+    }
+    
+    std::fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    std::fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+                      "\"args\":{\"name\":\"shell\"}}", trace_owner);
+    std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+                      "\"args\":{\"name\":\"shell\"}}", trace_owner);
+    
+    std::unordered_set<int> named_tracks;
+    for (const TraceEvent* event : events) {
+        if (event->track != 0 && named_tracks.insert(event->track).second) {
+            std::fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                              "\"args\":{\"name\":\"pid %d\"}}", trace_owner, event->track, event->track);
+        }
+        
+        std::fprintf(out, ",\n{\"name\":");
+        write_json_string(out, event->name);
+        std::fprintf(out, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                     (event->start_ns - trace_epoch_ns) / 1e3,
+                     (event->end_ns - event->start_ns) / 1e3, trace_owner, event->track);
+        if (event->detail[0]) {
+            std::fprintf(out, ",\"args\":{\"detail\":");
+            write_json_string(out, event->detail);
+            std::fputc('}', out);
+        }
+        std::fputc('}', out);
+    }
+    std::fprintf(out, "\n]}\n");
+    std::fclose(out);
+}
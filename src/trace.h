@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+#include <time.h>
+
+// Opt-in Chrome trace output (chrome://tracing, ui.perfetto.dev). Set
+// SHELL_TRACE_FILE=path before starting the shell; spans are collected in a
+// lock-free ring and written out when the shell exits. With tracing off a
+// span costs one relaxed atomic load.
+
+extern std::atomic<bool> trace_active;
+
+void init_tracing();
+void flush_trace();
+void record_trace_event(const char* name, int64_t start_ns, int64_t end_ns, int track,
+                        std::string_view detail);
+
+inline bool tracing_enabled() {
+    return trace_active.load(std::memory_order_relaxed);
+}
+
+inline int64_t trace_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Records [construction, destruction) as a complete event. The track is the
+// shell's own (0) unless set to a child pid, which gets its own row.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, std::string_view detail = {})
+        : name_(tracing_enabled() ? name : nullptr), detail_(detail) {
+        if (name_) start_ns_ = trace_clock_ns();
+    }
+    
+    ~TraceSpan() {
+        if (name_) record_trace_event(name_, start_ns_, trace_clock_ns(), track_, detail_);
+    }
+    
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    
+    void set_track(int track) { track_ = track; }
+    void set_detail(std::string_view detail) { detail_ = detail; }
+
+private:
+    const char* name_;
+    std::string_view detail_;
+    int64_t start_ns_ = 0;
+    int track_ = 0;
+};
+
+#endif // TRACE_H
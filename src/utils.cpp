@@ -1,9 +1,12 @@
 #include "utils.h"
+#include "trace.h"
+#include "variables.h"
 #include <sstream>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <algorithm>
 #include <cstdlib>
+#include <fcntl.h>
 
 std::vector<std::string> split_string(const std::string& str, char delimiter) {
     std::vector<std::string> tokens;
@@ -24,13 +27,22 @@ std::string trim(const std::string& str) {
     return str.substr(first, last - first + 1);
 }
 
-std::string find_executable_in_path(const std::string& cmd) {
-    const char* path_env = std::getenv("PATH");
-    if (!path_env) return "";
-    
-    std::vector<std::string> directories = split_string(path_env, ':');
+const std::vector<std::string>& path_directories() {
+    static std::string cached_path;
+    static std::vector<std::string> directories;
     
-    for (const auto& dir : directories) {
+    const char* path_env = get_variable("PATH");
+    if (!path_env) path_env = "";
+    if (cached_path != path_env) {
+        cached_path = path_env;
+        directories = split_string(cached_path, ':');
+    }
+    return directories;
+}
+
+std::string find_executable_in_path(const std::string& cmd) {
+    TraceSpan span("path_lookup", cmd);
+    for (const auto& dir : path_directories()) {
         std::string file_path = dir + "/" + cmd;
         struct stat sb;
         if (stat(file_path.c_str(), &sb) == 0 && (sb.st_mode & S_IXUSR)) {
@@ -41,26 +53,32 @@ std::string find_executable_in_path(const std::string& cmd) {
     return "";
 }
 
-std::vector<std::string> get_all_executables() {
-    std::vector<std::string> executables;
-    const char* path_env = std::getenv("PATH");
-    if (!path_env) return executables;
-    
-    std::vector<std::string> directories = split_string(path_env, ':');
+void list_executables_in_dir(const std::string& dir, std::vector<std::string>& out) {
+    DIR* dirp = opendir(dir.c_str());
+    if (!dirp) return;
     
-    for (const auto& dir : directories) {
-        DIR* dirp = opendir(dir.c_str());
-        if (!dirp) continue;
+    int dfd = dirfd(dirp);
+    struct dirent* entry;
+    while ((entry = readdir(dirp)) != nullptr) {
+        // d_type lets us skip directories, sockets etc. without a stat;
+        // regular files and symlinks still need one for the mode bits.
+        if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
         
-        struct dirent* entry;
-        while ((entry = readdir(dirp)) != nullptr) {
-            std::string file_path = dir + "/" + entry->d_name;
-            struct stat sb;
-            if (stat(file_path.c_str(), &sb) == 0 && (sb.st_mode & S_IXUSR)) {
-                executables.push_back(entry->d_name);
-            }
+        struct stat sb;
+        if (fstatat(dfd, entry->d_name, &sb, 0) == 0 && S_ISREG(sb.st_mode) && (sb.st_mode & S_IXUSR)) {
+            out.push_back(entry->d_name);
         }
-        closedir(dirp);
+    }
+    closedir(dirp);
+}
+
+std::vector<std::string> get_all_executables() {
+    std::vector<std::string> executables;
+    
+    for (const auto& dir : path_directories()) {
+        list_executables_in_dir(dir, executables);
     }
     
     // Remove duplicates
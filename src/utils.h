@@ -6,7 +6,9 @@
 
 std::vector<std::string> split_string(const std::string& str, char delimiter);
 std::string trim(const std::string& str);
+const std::vector<std::string>& path_directories();
 std::string find_executable_in_path(const std::string& cmd);
+void list_executables_in_dir(const std::string& dir, std::vector<std::string>& out);
 std::vector<std::string> get_all_executables();
 
 #endif // UTILS_H
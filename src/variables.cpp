@@ -0,0 +1,258 @@
+#include "variables.h"
+#include "shell.h"
+#include "job_control.h"
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+extern char** environ;
+
+static std::unordered_map<std::string, Variable> variables;
+static bool imported = false;
+static pid_t shell_pid;
+
+// NAME=value words of the commands being expanded, innermost last. Each one
+// shadows the variable for the words after it, as in `a=1 b=$a cmd`.
+static std::vector<std::string> pending_assignments;
+
+// Cached envp for launches; rebuilt on the next launch after a change.
+static std::vector<std::string> env_strings;
+static std::vector<char*> env_pointers;
+static bool env_stale = true;
+
+static inline bool is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static inline bool is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+bool is_valid_name(std::string_view name) {
+    if (name.empty() || !is_name_start(name[0])) return false;
+    return std::all_of(name.begin(), name.end(), is_name_char);
+}
+
+// Length of NAME in a `NAME=value` word, or 0 if the word is not one.
+size_t assignment_name_length(std::string_view word) {
+    size_t equals = word.find('=');
+    if (equals == std::string_view::npos || !is_valid_name(word.substr(0, equals))) return 0;
+    return equals;
+}
+
+void init_variables() {
+    if (imported) return;
+    imported = true;
+    shell_pid = getpid();
+    
+    for (char** entry = environ; entry && *entry; entry++) {
+        std::string_view text = *entry;
+        size_t length = assignment_name_length(text);
+        if (length == 0) continue;
+        Variable& variable = variables[std::string(text.substr(0, length))];
+        variable.value = std::string(text.substr(length + 1));
+        variable.exported = true;
+    }
+}
+
+const Variable* find_variable(const std::string& name) {
+    init_variables();
+    auto it = variables.find(name);
+    return it == variables.end() ? nullptr : &it->second;
+}
+
+const char* get_variable(const std::string& name) {
+    const Variable* variable = find_variable(name);
+    return variable ? variable->value.c_str() : nullptr;
+}
+
+// The value an expansion sees: a pending assignment to `name`, else the variable.
+const char* lookup_variable(const std::string& name) {
+    for (auto it = pending_assignments.rbegin(); it != pending_assignments.rend(); ++it) {
+        if (it->size() > name.size() && (*it)[name.size()] == '=' && it->compare(0, name.size(), name) == 0) {
+            return it->c_str() + name.size() + 1;
+        }
+    }
+    return get_variable(name);
+}
+
+size_t pending_assignment_mark() {
+    return pending_assignments.size();
+}
+
+// Readonly variables keep their value, as the assignment itself will fail.
+void push_pending_assignment(const std::string& assignment) {
+    const Variable* variable = find_variable(assignment.substr(0, assignment.find('=')));
+    if (variable && variable->readonly) return;
+    pending_assignments.push_back(assignment);
+}
+
+void drop_pending_assignments(size_t mark) {
+    pending_assignments.resize(mark);
+}
+
+bool set_variable(const std::string& name, const std::string& value) {
+    init_variables();
+    Variable& variable = variables[name];
+    if (variable.readonly) return false;
+    variable.value = value;
+    if (variable.exported) env_stale = true;
+    return true;
+}
+
+bool export_variable(const std::string& name) {
+    init_variables();
+    Variable& variable = variables[name];
+    if (!variable.exported) {
+        variable.exported = true;
+        env_stale = true;
+    }
+    return true;
+}
+
+bool unset_variable(const std::string& name) {
+    init_variables();
+    auto it = variables.find(name);
+    if (it == variables.end()) return true;
+    if (it->second.readonly) return false;
+    if (it->second.exported) env_stale = true;
+    variables.erase(it);
+    return true;
+}
+
+void mark_readonly(const std::string& name) {
+    init_variables();
+    variables[name].readonly = true;
+}
+
+std::vector<std::pair<std::string, const Variable*>> sorted_variables() {
+    init_variables();
+    std::vector<std::pair<std::string, const Variable*>> result;
+    result.reserve(variables.size());
+    for (const auto& entry : variables) {
+        result.emplace_back(entry.first, &entry.second);
+    }
+    std::sort(result.begin(), result.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+    return result;
+}
+
+// PIPESTATUS without real arrays: $PIPESTATUS, ${PIPESTATUS[n]},
+// ${PIPESTATUS[@]} (or [*]) and ${#PIPESTATUS[@]}.
+static bool expand_pipestatus(const std::string& name, std::string& out) {
+    bool count = !name.empty() && name[0] == '#';
+    std::string_view rest = std::string_view(name).substr(count ? 1 : 0);
+    if (rest.compare(0, 10, "PIPESTATUS") != 0) return false;
+    rest.remove_prefix(10);
+    
+    std::string_view index = "0";
+    if (!rest.empty()) {
+        if (rest.size() < 3 || rest.front() != '[' || rest.back() != ']') return false;
+        index = rest.substr(1, rest.size() - 2);
+    }
+    
+    if (index == "@" || index == "*") {
+        if (count) {
+            out += std::to_string(pipe_status.size());
+            return true;
+        }
+        for (size_t i = 0; i < pipe_status.size(); i++) {
+            if (i > 0) out += ' ';
+            out += std::to_string(pipe_status[i]);
+        }
+        return true;
+    }
+    if (!std::all_of(index.begin(), index.end(), [](char c) { return c >= '0' && c <= '9'; })) return false;
+    size_t i = index.size() > 9 ? pipe_status.size() : std::stoul(std::string(index));
+    if (i < pipe_status.size()) {
+        std::string value = std::to_string(pipe_status[i]);
+        out += count ? std::to_string(value.size()) : value;
+    } else if (count) {
+        out += '0';
+    }
+    return true;
+}
+
+// Expands the parameter whose '$' is at text[pos]: $NAME, ${NAME}, $?, $$
+// or $!. On success appends the value and leaves pos on the last character used.
+bool expand_parameter(std::string_view text, size_t& pos, std::string& out) {
+    if (pos + 1 >= text.size()) return false;
+    char c = text[pos + 1];
+    
+    if (c == '?') {
+        out += std::to_string(last_exit_status);
+        pos++;
+        return true;
+    }
+    if (c == '$') {
+        init_variables();
+        out += std::to_string(shell_pid);
+        pos++;
+        return true;
+    }
+    if (c == '!') {
+        if (last_background_pid > 0) out += std::to_string(last_background_pid);
+        pos++;
+        return true;
+    }
+    
+    size_t start = pos + 1;
+    size_t end = start;
+    bool braced = c == '{';
+    if (braced) {
+        end = text.find('}', start + 1);
+        if (end == std::string_view::npos) return false;
+        start++;
+    } else {
+        if (!is_name_start(c)) return false;
+        while (end < text.size() && is_name_char(text[end])) end++;
+    }
+    
+    std::string name(text.substr(start, end - start));
+    if (braced && name == "?") {
+        out += std::to_string(last_exit_status);
+    } else if (!expand_pipestatus(name, out)) {
+        if (const char* value = lookup_variable(name)) out += value;
+    }
+    pos = braced ? end : end - 1;
+    return true;
+}
+
+char* const* exec_environment() {
+    init_variables();
+    if (env_stale) {
+        env_strings.clear();
+        for (const auto& entry : variables) {
+            if (entry.second.exported) {
+                env_strings.push_back(entry.first + "=" + entry.second.value);
+            }
+        }
+        env_pointers.clear();
+        for (std::string& text : env_strings) {
+            env_pointers.push_back(&text[0]);
+        }
+        env_pointers.push_back(nullptr);
+        env_stale = false;
+    }
+    return env_pointers.data();
+}
+
+// The shared environment with `NAME=value` prefixes of one command layered
+// on top. Only the pointer array is copied; `assignments` must outlive envp.
+void build_command_environment(const std::vector<std::string>& assignments, std::vector<char*>& envp) {
+    char* const* base = exec_environment();
+    envp.clear();
+    for (char* const* entry = base; *entry; entry++) {
+        const char* equals = std::strchr(*entry, '=');
+        std::string_view name(*entry, equals - *entry);
+        bool overridden = std::any_of(assignments.begin(), assignments.end(), [&](const std::string& a) {
+            return a.size() > name.size() && a[name.size()] == '=' && a.compare(0, name.size(), name) == 0;
+        });
+        if (!overridden) envp.push_back(*entry);
+    }
+    for (const std::string& assignment : assignments) {
+        envp.push_back(const_cast<char*>(assignment.c_str()));
+    }
+    envp.push_back(nullptr);
+}
@@ -0,0 +1,41 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+struct Variable {
+    std::string value;
+    bool exported = false;
+    bool readonly = false;
+};
+
+// Shell variables, seeded from the process environment. Exported ones make
+// up the environment of launched commands; that envp array is built once and
+// shared by every launch until an exported variable changes.
+
+void init_variables();
+const Variable* find_variable(const std::string& name);
+const char* get_variable(const std::string& name);
+bool set_variable(const std::string& name, const std::string& value);
+const char* lookup_variable(const std::string& name);
+size_t pending_assignment_mark();
+void push_pending_assignment(const std::string& assignment);
+void drop_pending_assignments(size_t mark);
+bool export_variable(const std::string& name);
+bool unset_variable(const std::string& name);
+void mark_readonly(const std::string& name);
+std::vector<std::pair<std::string, const Variable*>> sorted_variables();
+
+bool is_valid_name(std::string_view name);
+size_t assignment_name_length(std::string_view word);
+bool expand_parameter(std::string_view text, size_t& pos, std::string& out);
+
+// Rebuilds the cached envp when stale, so only the main thread may call it
+// then; pipeline workers can use it once it is fresh.
+char* const* exec_environment();
+void build_command_environment(const std::vector<std::string>& assignments, std::vector<char*>& envp);
+
+#endif // VARIABLES_H